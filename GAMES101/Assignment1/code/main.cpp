@@ -4,6 +4,8 @@
 #include <iostream>
 #include <opencv2/opencv.hpp>
 #include <cmath>
+#include <chrono>
+#include <string>
 
 constexpr double MY_PI = 3.1415926;
 
@@ -74,24 +76,89 @@ Eigen::Matrix4f get_model_matrix_anyaxis(Vector3f axis, float angle)
     return model;
 }
 
+// Wireframe of an n x n grid of quads, two triangles each, filling most of the view
+void make_grid(int n, std::vector<Eigen::Vector3f>& pos, std::vector<Eigen::Vector3i>& ind)
+{
+    pos.clear();
+    ind.clear();
+    for (int j = 0; j <= n; ++j)
+        for (int i = 0; i <= n; ++i)
+            pos.emplace_back(-2.0f + 4.0f * i / n, -2.0f + 4.0f * j / n, -2.0f);
+    for (int j = 0; j < n; ++j)
+        for (int i = 0; i < n; ++i)
+        {
+            int v = j * (n + 1) + i;
+            ind.emplace_back(v, v + 1, v + n + 2);
+            ind.emplace_back(v, v + n + 2, v + n + 1);
+        }
+}
+
+// Frame time of the per triangle Bresenham wireframe against the anti-aliased line engine
+void benchmark_lines(Eigen::Vector3f eye_pos)
+{
+    rst::rasterizer r(700, 700);
+    r.set_view(get_view_matrix(eye_pos));
+    r.set_projection(get_projection_matrix(45, 1, 0.1, 50));
+
+    for (int n : {50, 200, 400})
+    {
+        std::vector<Eigen::Vector3f> pos;
+        std::vector<Eigen::Vector3i> ind;
+        make_grid(n, pos, ind);
+        auto pos_id = r.load_positions(pos);
+        auto ind_id = r.load_indices(ind);
+
+        for (auto mode : {rst::LineMode::Bresenham, rst::LineMode::AntiAliased})
+        {
+            r.set_line_mode(mode);
+            const int frames = 10;
+            double ms = 0;
+            for (int frame = 0; frame < frames + 1; ++frame)
+            {
+                r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+                r.set_model(get_model_matrix(frame * 3.0f));
+                auto start = std::chrono::steady_clock::now();
+                r.draw(pos_id, ind_id, rst::Primitive::Triangle);
+                auto end = std::chrono::steady_clock::now();
+                // 第一帧用来预热缓冲区，不计时
+                if (frame > 0)
+                    ms += std::chrono::duration<double, std::milli>(end - start).count();
+            }
+            std::cout << (mode == rst::LineMode::Bresenham ? "bresenham   " : "antialiased ")
+                      << ind.size() << " triangles, "
+                      << (mode == rst::LineMode::Bresenham ? 3 * ind.size() : (3 * n + 2) * n)
+                      << " lines: " << ms / frames << " ms/frame\n";
+        }
+    }
+}
+
 int main(int argc, const char** argv)
 {
     float angle = 0;
     bool command_line = false;
     std::string filename = "output.png";
 
+    Eigen::Vector3f eye_pos = {0, 0, 5};
+
+    if (argc >= 2 && std::string(argv[1]) == "bench") {
+        benchmark_lines(eye_pos);
+        return 0;
+    }
+
+    rst::rasterizer r(700, 700);
+
     if (argc >= 3) {
         command_line = true;
         angle = std::stof(argv[2]); // -r by default
-        if (argc == 4) {
+        if (argc >= 4) {
             filename = std::string(argv[3]);
         }
+        // 默认是作业原来的 Bresenham 画线，加上 antialiased 参数改用反走样的画线引擎
+        if (argc >= 5 && std::string(argv[4]) == "antialiased") {
+            r.set_line_mode(rst::LineMode::AntiAliased);
+        }
     }
 
-    rst::rasterizer r(700, 700);
-
-    Eigen::Vector3f eye_pos = {0, 0, 5};
-
     std::vector<Eigen::Vector3f> pos{{2, 0, -2}, {0, 2, -2}, {-2, 0, -2}};
 
     std::vector<Eigen::Vector3i> ind{{0, 1, 2}};
@@ -111,8 +178,7 @@ int main(int argc, const char** argv)
         r.set_projection(get_projection_matrix(45, 1, 0.1, 50));
 
         r.draw(pos_id, ind_id, rst::Primitive::Triangle);
-        cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-        image.convertTo(image, CV_8UC3, 1.0f);
+        cv::Mat image = r.output_image();
 
         cv::imwrite(filename, image);
 
@@ -129,8 +195,7 @@ int main(int argc, const char** argv)
 
         r.draw(pos_id, ind_id, rst::Primitive::Triangle);
 
-        cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-        image.convertTo(image, CV_8UC3, 1.0f);
+        cv::Mat image = r.output_image();
         cv::imshow("image", image);
         key = cv::waitKey(10);
 
@@ -7,6 +7,7 @@
 #include <opencv2/opencv.hpp>
 #include <math.h>
 #include <stdexcept>
+#include <omp.h>
 
 
 rst::pos_buf_id rst::rasterizer::load_positions(const std::vector<Eigen::Vector3f> &positions)
@@ -22,6 +23,25 @@ rst::ind_buf_id rst::rasterizer::load_indices(const std::vector<Eigen::Vector3i>
     auto id = get_next_id();
     ind_buf.emplace(id, indices);
 
+    // 每条边用 (小索引, 大索引) 表示，排序去重后相邻三角形共享的边只画一次
+    std::vector<Eigen::Vector2i> edges;
+    edges.reserve(indices.size() * 3);
+    for (auto& i : indices)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            int a = i[k], b = i[(k + 1) % 3];
+            edges.emplace_back(std::min(a, b), std::max(a, b));
+        }
+    }
+    auto less = [](const Eigen::Vector2i& a, const Eigen::Vector2i& b)
+    {
+        return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+    };
+    std::sort(edges.begin(), edges.end(), less);
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+    edge_buf.emplace(id, std::move(edges));
+
     return {id};
 }
 
@@ -34,8 +54,6 @@ void rst::rasterizer::draw_line(Eigen::Vector3f begin, Eigen::Vector3f end)
     auto x2 = end.x();
     auto y2 = end.y();
 
-    Eigen::Vector3f line_color = {255, 255, 255};
-
     int x,y,dx,dy,dx1,dy1,px,py,xe,ye,i;
 
     dx=x2-x1;
@@ -145,6 +163,39 @@ void rst::rasterizer::draw(rst::pos_buf_id pos_buffer, rst::ind_buf_id ind_buffe
     float f2 = (100 + 0.1) / 2.0;
 
     Eigen::Matrix4f mvp = projection * view * model;
+    if (line_mode == LineMode::AntiAliased)
+    {
+        // 投影矩阵 (3,2) 为正时可见点的 w 为负，取反后可见点 w > 0，裁剪条件统一
+        if (projection(3, 2) > 0)
+            mvp = -mvp;
+
+        // 每个顶点只变换一次
+        clip_pos.resize(buf.size());
+        for (size_t i = 0; i < buf.size(); ++i)
+            clip_pos[i] = mvp * to_vec4(buf[i], 1.0f);
+
+        // 在眼睛前方的平面 w = w_min 上裁掉线段在眼睛后面的部分，再做透视除法和视口变换
+        const float w_min = 1e-5f;
+        screen_lines.clear();
+        for (auto& e : edge_buf[ind_buffer.ind_id])
+        {
+            Eigen::Vector4f a = clip_pos[e.x()], b = clip_pos[e.y()];
+            float da = a.w() - w_min, db = b.w() - w_min;
+            if (da < 0 && db < 0)
+                continue;
+            if (da < 0)
+                a = a + (b - a) * (da / (da - db));
+            else if (db < 0)
+                b = b + (a - b) * (db / (db - da));
+            a /= a.w();
+            b /= b.w();
+            screen_lines.push_back({0.5f * width * (a.x() + 1.0f), 0.5f * height * (a.y() + 1.0f),
+                                    0.5f * width * (b.x() + 1.0f), 0.5f * height * (b.y() + 1.0f)});
+        }
+        draw_lines(screen_lines);
+        return;
+    }
+
     for (auto& i : ind)
     {
         Triangle t;
@@ -193,6 +244,167 @@ void rst::rasterizer::rasterize_wireframe(const Triangle& t)
     draw_line(t.b(), t.a());
 }
 
+void rst::rasterizer::draw_lines(const std::vector<line_segment>& segments)
+{
+    lines.clear();
+    for (auto l : segments)
+    {
+        if (clip_line(l))
+            lines.push_back(l);
+    }
+    rasterize_lines();
+}
+
+// Liang-Barsky 裁剪：把线段写成 p(t) = p0 + t * d, t 属于 [0, 1]，对四条边界依次收缩 t 的范围
+bool rst::rasterizer::clip_line(line_segment& l) const
+{
+    float dx = l.x1 - l.x0, dy = l.y1 - l.y0;
+    // 比屏幕大一个像素，屏幕边缘的像素也能得到完整的覆盖率
+    float p[4] = {-dx, dx, -dy, dy};
+    float q[4] = {l.x0 + 1.0f, float(width) - l.x0, l.y0 + 1.0f, float(height) - l.y0};
+    float t0 = 0.0f, t1 = 1.0f;
+    for (int i = 0; i < 4; ++i)
+    {
+        if (p[i] == 0.0f)
+        {
+            // 与这条边界平行，完全在外面就丢掉
+            if (q[i] < 0.0f)
+                return false;
+            continue;
+        }
+        float t = q[i] / p[i];
+        if (p[i] < 0.0f)
+            t0 = std::max(t0, t);
+        else
+            t1 = std::min(t1, t);
+        if (t0 > t1)
+            return false;
+    }
+    l = {l.x0 + t0 * dx, l.y0 + t0 * dy, l.x0 + t1 * dx, l.y0 + t1 * dy};
+    return true;
+}
+
+void rst::rasterizer::rasterize_lines()
+{
+    int bands = (height + band_height - 1) / band_height;
+    band_bins.resize(bands);
+    for (auto& bin : band_bins)
+        bin.clear();
+    coverage.resize(frame_buf.size(), 0.0f);
+
+    // 按线段覆盖的行把线段分到各个条带，一条线段可能落在多个条带里
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        const line_segment& l = lines[i];
+        int y_lo = std::max(int(std::floor(std::min(l.y0, l.y1))) - 1, 0);
+        int y_hi = std::min(int(std::floor(std::max(l.y0, l.y1))) + 1, height - 1);
+        for (int b = y_lo / band_height; b <= y_hi / band_height; ++b)
+            band_bins[b].push_back(int(i));
+    }
+
+    // 条带之间没有共享的像素，每个条带由一个线程画完再混合进 frame_buf
+    int threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+    for (int b = 0; b < bands; ++b)
+    {
+        if (band_bins[b].empty())
+            continue;
+        int y0 = b * band_height, y1 = std::min(y0 + band_height, height) - 1;
+        for (int i : band_bins[b])
+            draw_line_band(lines[i], y0, y1);
+
+        for (int y = y0; y <= y1; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                float& c = coverage[y * width + x];
+                if (c <= 0.0f)
+                    continue;
+                Eigen::Vector3f& pixel = frame_buf[get_index(x, y)];
+                pixel += (line_color - pixel) * c;
+                c = 0.0f;
+            }
+        }
+    }
+}
+
+/*
+ * Wu 风格的反走样直线：沿主方向每个像素中心求出线段在副方向上的位置，按到两个相邻像素中心的
+ * 距离分配覆盖率；端点所在的像素再乘上线段在主方向上覆盖这个像素的长度。
+ * 像素 (x, y) 的中心在 (x + 0.5, y + 0.5)，同一个像素上多条线段的覆盖率取最大值。
+ */
+void rst::rasterizer::draw_line_band(const line_segment& l, int y0, int y1)
+{
+    float dx = l.x1 - l.x0, dy = l.y1 - l.y0;
+    bool x_major = std::abs(dx) >= std::abs(dy);
+
+    // 统一成沿主方向 u 递增，副方向为 v
+    float u0 = x_major ? l.x0 : l.y0, v0 = x_major ? l.y0 : l.x0;
+    float u1 = x_major ? l.x1 : l.y1, v1 = x_major ? l.y1 : l.x1;
+    if (u1 < u0)
+    {
+        std::swap(u0, u1);
+        std::swap(v0, v1);
+    }
+    float gradient = u1 > u0 ? (v1 - v0) / (u1 - u0) : 0.0f;
+
+    auto plot = [&](int x, int y, float c)
+    {
+        if (x < 0 || x >= width || y < y0 || y > y1 || c <= 0.0f)
+            return;
+        float& cov = coverage[y * width + x];
+        cov = std::max(cov, std::min(c, 1.0f));
+    };
+
+    // 主方向上需要处理的像素范围，x 为主方向时只取落在这个条带里的那一段
+    float u_lo = u0, u_hi = u1;
+    if (x_major)
+    {
+        if (gradient != 0.0f)
+        {
+            // v(u) 在 [y0 - 1, y1 + 2] 之外的像素中心画不到这个条带里
+            float ua = u0 + (float(y0) - 1.0f - v0) / gradient;
+            float ub = u0 + (float(y1) + 2.0f - v0) / gradient;
+            u_lo = std::max(u_lo, std::min(ua, ub) - 1.0f);
+            u_hi = std::min(u_hi, std::max(ua, ub) + 1.0f);
+        }
+    }
+    else
+    {
+        u_lo = std::max(u_lo, float(y0));
+        u_hi = std::min(u_hi, float(y1) + 1.0f);
+    }
+    int first = std::max(int(std::floor(u_lo)), x_major ? 0 : y0);
+    int last = std::min(int(std::floor(u_hi)), x_major ? width - 1 : y1);
+
+    for (int u = first; u <= last; ++u)
+    {
+        // 线段在这个像素主方向 [u, u + 1] 上覆盖的长度，只有端点处小于 1
+        float weight = std::min(u1, float(u + 1)) - std::max(u0, float(u));
+        if (weight <= 0.0f)
+        {
+            // 长度为零的线段仍然画一个点
+            if (u1 > u0 || u != int(std::floor(u0)))
+                continue;
+            weight = 1.0f;
+        }
+
+        float v = v0 + gradient * (float(u) + 0.5f - u0) - 0.5f;
+        int vi = int(std::floor(v));
+        float f = v - float(vi);
+        if (x_major)
+        {
+            plot(u, vi, (1.0f - f) * weight);
+            plot(u, vi + 1, f * weight);
+        }
+        else
+        {
+            plot(vi, u, (1.0f - f) * weight);
+            plot(vi + 1, u, f * weight);
+        }
+    }
+}
+
 void rst::rasterizer::set_model(const Eigen::Matrix4f& m)
 {
     model = m;
@@ -208,6 +420,13 @@ void rst::rasterizer::set_projection(const Eigen::Matrix4f& p)
     projection = p;
 }
 
+cv::Mat rst::rasterizer::output_image()
+{
+    output_buf.resize(frame_buf.size() * output_channels);
+    quantize_bgr(frame_buf.data(), output_buf.data(), frame_buf.size(), output_channels, false);
+    return cv::Mat(height, width, output_channels == 4 ? CV_8UC4 : CV_8UC3, output_buf.data());
+}
+
 void rst::rasterizer::clear(rst::Buffers buff)
 {
     if ((buff & rst::Buffers::Color) == rst::Buffers::Color)
@@ -228,7 +447,7 @@ rst::rasterizer::rasterizer(int w, int h) : width(w), height(h)
 
 int rst::rasterizer::get_index(int x, int y)
 {
-    return (height-y)*width + x;
+    return (height-1-y)*width + x;
 }
 
 void rst::rasterizer::set_pixel(const Eigen::Vector3f& point, const Eigen::Vector3f& color)
@@ -236,7 +455,7 @@ void rst::rasterizer::set_pixel(const Eigen::Vector3f& point, const Eigen::Vecto
     //old index: auto ind = point.y() + point.x() * width;
     if (point.x() < 0 || point.x() >= width ||
         point.y() < 0 || point.y() >= height) return;
-    auto ind = (height-point.y())*width + point.x();
+    auto ind = (height-1-point.y())*width + point.x();
     frame_buf[ind] = color;
 }
 
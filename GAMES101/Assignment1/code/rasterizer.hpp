@@ -6,7 +6,10 @@
 
 #include "Triangle.hpp"
 #include <algorithm>
+#include <map>
+#include <vector>
 #include <eigen3/Eigen/Eigen>
+#include "FrameExport.hpp"
 using namespace Eigen;
 
 namespace rst {
@@ -32,6 +35,18 @@ enum class Primitive
     Triangle
 };
 
+enum class LineMode
+{
+    Bresenham,  // the original one pixel wide lines, three per triangle
+    AntiAliased // clipped, deduplicated, Wu style anti-aliased lines drawn in parallel
+};
+
+// A line in screen space, in pixels
+struct line_segment
+{
+    float x0, y0, x1, y1;
+};
+
 /*
  * For the curious : The draw function takes two buffer id's as its arguments.
  * These two structs make sure that if you mix up with their orders, the
@@ -62,14 +77,38 @@ class rasterizer
 
     void clear(Buffers buff);
 
+    // Draws the triangles as a wireframe; in AntiAliased mode every edge shared by two
+    // triangles is drawn once.
     void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, Primitive type);
+    // Draws a batch of screen space lines with the anti-aliased line engine.
+    void draw_lines(const std::vector<line_segment>& segments);
+
+    void set_line_mode(LineMode mode) { line_mode = mode; }
+    void set_line_color(const Eigen::Vector3f& color) { line_color = color; }
+    // 0 uses the OpenMP default (one thread per core)
+    void set_num_threads(int n) { num_threads = n; }
 
     std::vector<Eigen::Vector3f>& frame_buffer() { return frame_buf; }
 
+    // 3 for BGR, 4 for BGRA with an opaque alpha
+    void set_output_channels(int channels) { output_channels = channels; }
+    // Quantizes the frame buffer into the 8-bit output buffer and returns a cv::Mat that views
+    // it without a copy, ready for imshow/imwrite. The view is valid until the next call.
+    // The channels are written in frame buffer order: this assignment never converted the
+    // frame buffer to BGR, so line colors are given in OpenCV's order.
+    cv::Mat output_image();
+
   private:
     void draw_line(Eigen::Vector3f begin, Eigen::Vector3f end);
     void rasterize_wireframe(const Triangle& t);
 
+    // Liang-Barsky clipping of a line to the screen grown by one pixel; false if nothing is left.
+    bool clip_line(line_segment& l) const;
+    // Sorts the clipped lines into bands of band_height rows and draws the bands in parallel.
+    void rasterize_lines();
+    // Draws the part of line l that falls into rows [y0, y1] into the coverage buffer.
+    void draw_line_band(const line_segment& l, int y0, int y1);
+
   private:
     Eigen::Matrix4f model;
     Eigen::Matrix4f view;
@@ -77,13 +116,30 @@ class rasterizer
 
     std::map<int, std::vector<Eigen::Vector3f>> pos_buf;
     std::map<int, std::vector<Eigen::Vector3i>> ind_buf;
+    // unique edges of every index buffer, built by load_indices
+    std::map<int, std::vector<Eigen::Vector2i>> edge_buf;
 
     std::vector<Eigen::Vector3f> frame_buf;
+    std::vector<uint8_t> output_buf;
+    int output_channels = 3;
     std::vector<float> depth_buf;
     int get_index(int x, int y);
 
     int width, height;
 
+    LineMode line_mode = LineMode::Bresenham;
+    Eigen::Vector3f line_color = {255, 255, 255};
+    int num_threads = 0;
+
+    // per draw scratch buffers of the line engine, they keep their capacity between frames
+    static constexpr int band_height = 16;
+    std::vector<Eigen::Vector4f> clip_pos;
+    std::vector<line_segment> screen_lines;
+    std::vector<line_segment> lines;
+    std::vector<std::vector<int>> band_bins;
+    // coverage of the current batch of lines, blended into frame_buf band by band
+    std::vector<float> coverage;
+
     int next_id = 0;
     int get_next_id() { return next_id++; }
 };
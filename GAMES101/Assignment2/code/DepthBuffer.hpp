@@ -0,0 +1,453 @@
+//
+// Depth buffer with selectable storage formats.
+//
+
+#ifndef RASTERIZER_DEPTHBUFFER_H
+#define RASTERIZER_DEPTHBUFFER_H
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "EdgeFunction.hpp"
+
+namespace rst
+{
+    enum class DepthFormat
+    {
+        Float32,
+        Unorm16,
+        Unorm24,
+        TilePlane
+    };
+
+    /*
+     * Per sample depth storage, cleared to "infinitely far". Samples are addressed by pixel
+     * (x, y) and sample index s; sample positions are given relative to the pixel center.
+     *
+     *   Float32    4 bytes per sample.
+     *   Unorm16    2 bytes per sample: (z - near) / (far - near) quantized to 16 bits.
+     *   Unorm24    3 bytes per sample, packed, quantized to 24 bits.
+     *   TilePlane  float samples, but an 8x8 pixel tile that a single triangle fully covers
+     *              stores only that triangle's depth plane (try_plane). Writing a single
+     *              sample expands the tile back to floats. Like hardware depth compression
+     *              this saves bandwidth, not memory: the float storage stays allocated.
+     *
+     * The quantized formats keep the all-ones code for the cleared value, so anything
+     * drawn in [near, far] is nearer than a clear. Their depth test compares codes.
+     *
+     * TilePlane, and the other formats after set_tile_bounds(true), keep the nearest and
+     * farthest depth of each tile next to the samples. Stores keep the nearest one exact, so
+     * tile_min() never reads the tile; tile_max() reads it again only after the last sample
+     * at the farthest depth was replaced.
+     * */
+    class depth_buffer
+    {
+    public:
+        static constexpr int tile = 8;
+
+        // sample_pos holds samples x 2 offsets from the pixel center in pixels, nullptr for the center.
+        void resize(int w, int h, int samples, const float (*sample_pos)[2] = nullptr)
+        {
+            width = w;
+            height = h;
+            num_samples = samples;
+            offset_x.assign(samples, 0.0f);
+            offset_y.assign(samples, 0.0f);
+            for (int s = 0; sample_pos && s < samples; ++s)
+            {
+                offset_x[s] = sample_pos[s][0];
+                offset_y[s] = sample_pos[s][1];
+            }
+            tiles_x = (w + tile - 1) / tile;
+            tiles_y = (h + tile - 1) / tile;
+            allocate();
+        }
+
+        void set_format(DepthFormat f)
+        {
+            format = f;
+            allocate();
+        }
+
+        // Whether Float32 and the quantized formats keep tile bounds, for hierarchical z.
+        // Costs a little on every store. Call it right before a clear().
+        void set_tile_bounds(bool enable)
+        {
+            tile_bounds_requested = enable;
+            allocate_bounds();
+        }
+
+        // Depth range covered by the quantized formats; values outside are clamped.
+        void set_range(float near, float far)
+        {
+            range_near = near;
+            range_scale = 1.0f / (far - near);
+        }
+
+        DepthFormat get_format() const { return format; }
+
+        void clear()
+        {
+            std::fill(f32.begin(), f32.end(), std::numeric_limits<float>::infinity());
+            std::fill(u16.begin(), u16.end(), uint16_t(0xffff));
+            std::fill(u24.begin(), u24.end(), uint8_t(0xff));
+            std::fill(planes.begin(), planes.end(), tile_plane{});
+            clear_bounds();
+        }
+
+        float get(int x, int y, int s = 0) const
+        {
+            size_t i = index(x, y, s);
+            switch (format)
+            {
+            case DepthFormat::Unorm16:
+                return decode(u16[i], 0xffff);
+            case DepthFormat::Unorm24:
+                return decode(load24(i), 0xffffff);
+            case DepthFormat::TilePlane:
+            {
+                const tile_plane& p = planes[(y / tile) * tiles_x + x / tile];
+                if (p.state == tile_plane::Cleared)
+                    return std::numeric_limits<float>::infinity();
+                if (p.state == tile_plane::Plane)
+                    return plane_depth(p, x, y, s);
+                return f32[i];
+            }
+            default:
+                return f32[i];
+            }
+        }
+
+        // The depth test: stores z and returns true if it is nearer than the stored sample.
+        bool test_and_set(int x, int y, int s, float z)
+        {
+            if (keep_bounds)
+                return test_and_set_bounded(x, y, s, z);
+            size_t i = index(x, y, s);
+            switch (format)
+            {
+            case DepthFormat::Unorm16:
+            {
+                uint16_t code = uint16_t(encode(z, 0xffff));
+                if (code >= u16[i])
+                    return false;
+                u16[i] = code;
+                return true;
+            }
+            case DepthFormat::Unorm24:
+            {
+                uint32_t code = encode(z, 0xffffff);
+                if (code >= load24(i))
+                    return false;
+                store24(i, code);
+                return true;
+            }
+            default:
+                if (!(z < f32[i]))
+                    return false;
+                f32[i] = z;
+                return true;
+            }
+        }
+
+        // Row y of a single sample Float32 buffer, for the SIMD depth test. Samples that
+        // pass are written back with set_float, which keeps the tile bounds.
+        const float* float_row(int y) const { return &f32[size_t(y) * width]; }
+
+        void set_float(int x, int y, float z)
+        {
+            size_t i = index(x, y, 0);
+            float old = f32[i];
+            f32[i] = z;
+            if (keep_bounds)
+                stored(x, y, old, z);
+        }
+
+        /*
+         * TilePlane only: if the triangle covers all of tile (tx, ty) and is nearer than
+         * everything stored in it, replace the tile by the triangle's depth plane and return
+         * true. The caller then writes every pixel of the tile without a depth test.
+         * z holds the screen space depth of the three vertices.
+         * */
+        bool try_plane(const edge_setup& setup, const float z[3], int tx, int ty)
+        {
+            if (format != DepthFormat::TilePlane)
+                return false;
+
+            int x0 = tx * tile, y0 = ty * tile;
+            int x1 = std::min(width, x0 + tile) - 1, y1 = std::min(height, y0 + tile) - 1;
+
+            // with multisampling the whole pixel area has to be inside, otherwise only the centers
+            int extent = num_samples > 1 ? int(subpixel_one / 2) : 0;
+            int64_t e[3];
+            float bary[3];
+            setup.start(x0, y0, e, bary);
+            float z0 = 0, dzdx = 0, dzdy = 0;
+            for (int i = 0; i < 3; ++i)
+            {
+                z0 += bary[i] * z[i];
+                dzdx += setup.bary_step_x[i] * z[i];
+                dzdy += setup.bary_step_y[i] * z[i];
+            }
+
+            float farthest = -std::numeric_limits<float>::infinity();
+            const int corner_x[2] = {-extent, int((x1 - x0) * subpixel_one) + extent};
+            const int corner_y[2] = {-extent, int((y1 - y0) * subpixel_one) + extent};
+            for (int cx : corner_x)
+                for (int cy : corner_y)
+                {
+                    int64_t corner_e[3];
+                    float corner_bary[3];
+                    setup.offset(e, bary, cx, cy, corner_e, corner_bary);
+                    if (!setup.inside(corner_e))
+                        return false;
+                    farthest = std::max(farthest, z0 + (dzdx * cx + dzdy * cy) / float(subpixel_one));
+                }
+
+            if (!(farthest < tile_min(tx, ty)))
+                return false;
+
+            tile_plane& p = planes[ty * tiles_x + tx];
+            p.state = tile_plane::Plane;
+            p.z0 = z0;
+            p.dzdx = dzdx;
+            p.dzdy = dzdy;
+
+            // 平面是线性的，最近和最远的采样一定在四个角的像素上
+            tile_bounds& b = bounds[ty * tiles_x + tx];
+            b.nearest = std::numeric_limits<float>::infinity();
+            b.farthest = -std::numeric_limits<float>::infinity();
+            for (int y : {y0, y1})
+                for (int x : {x0, x1})
+                    for (int s = 0; s < num_samples; ++s)
+                    {
+                        float depth = plane_depth(p, x, y, s);
+                        b.nearest = std::min(b.nearest, depth);
+                        b.farthest = std::max(b.farthest, depth);
+                    }
+            // at least one sample holds the farthest depth; if more do, the count only runs
+            // out early and tile_max() scans the tile once more
+            b.at_farthest = 1;
+            return true;
+        }
+
+        // Nearest and farthest stored depth of tile (tx, ty). Without tile bounds they are
+        // -infinity and infinity, which never reject anything.
+        float tile_min(int tx, int ty) const
+        {
+            return keep_bounds ? bounds[ty * tiles_x + tx].nearest : -std::numeric_limits<float>::infinity();
+        }
+
+        float tile_max(int tx, int ty)
+        {
+            if (!keep_bounds)
+                return std::numeric_limits<float>::infinity();
+            tile_bounds& b = bounds[ty * tiles_x + tx];
+            if (b.at_farthest == 0)
+                bounds_rescan(tx, ty);
+            return b.farthest;
+        }
+
+        size_t bytes() const
+        {
+            return f32.size() * sizeof(float) + u16.size() * sizeof(uint16_t) + u24.size() +
+                   planes.size() * sizeof(tile_plane) + bounds.size() * sizeof(tile_bounds);
+        }
+
+        // Tiles currently stored as a plane.
+        int plane_tiles() const
+        {
+            return int(std::count_if(planes.begin(), planes.end(),
+                                     [](const tile_plane& p) { return p.state == tile_plane::Plane; }));
+        }
+
+    private:
+        struct tile_plane
+        {
+            enum State : uint8_t { Cleared, Plane, Expanded };
+            State state = Cleared;
+            float z0 = 0, dzdx = 0, dzdy = 0; // depth at the center of the tile's first pixel, and its steps
+        };
+
+        // at_farthest counts the samples at the farthest depth: a store can only bring a
+        // sample nearer, so the farthest depth changes only when the last of them is replaced.
+        // 0 means farthest is stale, an upper bound until tile_max() reads the tile again.
+        struct tile_bounds
+        {
+            float nearest, farthest;
+            int at_farthest;
+        };
+
+        void allocate()
+        {
+            size_t count = size_t(width) * height * num_samples;
+            bool is_float = format == DepthFormat::Float32 || format == DepthFormat::TilePlane;
+            f32.assign(is_float ? count : 0, std::numeric_limits<float>::infinity());
+            u16.assign(format == DepthFormat::Unorm16 ? count : 0, uint16_t(0xffff));
+            u24.assign(format == DepthFormat::Unorm24 ? 3 * count : 0, uint8_t(0xff));
+            planes.assign(format == DepthFormat::TilePlane ? size_t(tiles_x) * tiles_y : 0, tile_plane{});
+            allocate_bounds();
+        }
+
+        void allocate_bounds()
+        {
+            keep_bounds = tile_bounds_requested || format == DepthFormat::TilePlane;
+            bounds.resize(keep_bounds ? size_t(tiles_x) * tiles_y : 0);
+            clear_bounds();
+        }
+
+        size_t index(int x, int y, int s) const
+        {
+            return (size_t(y) * width + x) * num_samples + s;
+        }
+
+        uint32_t encode(float z, uint32_t max_code) const
+        {
+            float t = std::min(std::max((z - range_near) * range_scale, 0.0f), 1.0f);
+            return uint32_t(t * float(max_code - 1) + 0.5f);
+        }
+
+        float decode(uint32_t code, uint32_t max_code) const
+        {
+            if (code == max_code)
+                return std::numeric_limits<float>::infinity();
+            return range_near + float(code) / float(max_code - 1) / range_scale;
+        }
+
+        uint32_t load24(size_t i) const
+        {
+            const uint8_t* p = &u24[3 * i];
+            return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16);
+        }
+
+        void store24(size_t i, uint32_t code)
+        {
+            uint8_t* p = &u24[3 * i];
+            p[0] = uint8_t(code);
+            p[1] = uint8_t(code >> 8);
+            p[2] = uint8_t(code >> 16);
+        }
+
+        float plane_depth(const tile_plane& p, int x, int y, int s) const
+        {
+            return p.z0 + p.dzdx * (x % tile + offset_x[s]) + p.dzdy * (y % tile + offset_y[s]);
+        }
+
+        // Writes a plane or cleared tile out to its float samples.
+        void expand(int tx, int ty)
+        {
+            tile_plane& p = planes[ty * tiles_x + tx];
+            if (p.state == tile_plane::Expanded)
+                return;
+            for (int y = ty * tile; y < std::min(height, (ty + 1) * tile); ++y)
+                for (int x = tx * tile; x < std::min(width, (tx + 1) * tile); ++x)
+                    for (int s = 0; s < num_samples; ++s)
+                        f32[index(x, y, s)] = p.state == tile_plane::Plane ? plane_depth(p, x, y, s)
+                                                                           : std::numeric_limits<float>::infinity();
+            p.state = tile_plane::Expanded;
+        }
+
+        // test_and_set for a buffer that keeps tile bounds; TilePlane always does
+        bool test_and_set_bounded(int x, int y, int s, float z)
+        {
+            size_t i = index(x, y, s);
+            float old = get(x, y, s);
+            switch (format)
+            {
+            case DepthFormat::Unorm16:
+            {
+                uint16_t code = uint16_t(encode(z, 0xffff));
+                if (code >= u16[i])
+                    return false;
+                u16[i] = code;
+                stored(x, y, old, decode(code, 0xffff));
+                return true;
+            }
+            case DepthFormat::Unorm24:
+            {
+                uint32_t code = encode(z, 0xffffff);
+                if (code >= load24(i))
+                    return false;
+                store24(i, code);
+                stored(x, y, old, decode(code, 0xffffff));
+                return true;
+            }
+            case DepthFormat::TilePlane:
+                if (!(z < old))
+                    return false;
+                expand(x / tile, y / tile);
+                f32[i] = z;
+                stored(x, y, old, z);
+                return true;
+            default:
+                if (!(z < old))
+                    return false;
+                f32[i] = z;
+                stored(x, y, old, z);
+                return true;
+            }
+        }
+
+        // every sample of a cleared tile is at the farthest depth, infinity
+        void clear_bounds()
+        {
+            if (!keep_bounds)
+                return;
+            for (int ty = 0; ty < tiles_y; ++ty)
+                for (int tx = 0; tx < tiles_x; ++tx)
+                {
+                    int samples = (std::min(width, (tx + 1) * tile) - tx * tile) *
+                                  (std::min(height, (ty + 1) * tile) - ty * tile) * num_samples;
+                    bounds[ty * tiles_x + tx] = {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), samples};
+                }
+        }
+
+        // A sample of (x, y) went from old to z, nearer.
+        void stored(int x, int y, float old, float z)
+        {
+            int tx = x / tile, ty = y / tile;
+            tile_bounds& b = bounds[ty * tiles_x + tx];
+            b.nearest = std::min(b.nearest, z);
+            // 最远的采样全被替换之后只做标记，等真正要用 tile_max 时再扫描
+            if (b.at_farthest > 0 && old == b.farthest)
+                --b.at_farthest;
+        }
+
+        // Finds the farthest depth again and counts the samples at it.
+        void bounds_rescan(int tx, int ty)
+        {
+            tile_bounds& b = bounds[ty * tiles_x + tx];
+            b.farthest = -std::numeric_limits<float>::infinity();
+            b.at_farthest = 0;
+            for (int y = ty * tile; y < std::min(height, (ty + 1) * tile); ++y)
+                for (int x = tx * tile; x < std::min(width, (tx + 1) * tile); ++x)
+                    for (int s = 0; s < num_samples; ++s)
+                    {
+                        float depth = get(x, y, s);
+                        if (depth > b.farthest)
+                        {
+                            b.farthest = depth;
+                            b.at_farthest = 0;
+                        }
+                        b.at_farthest += depth == b.farthest;
+                    }
+        }
+
+        int width = 0, height = 0, num_samples = 1;
+        int tiles_x = 0, tiles_y = 0;
+        std::vector<float> offset_x, offset_y;
+        DepthFormat format = DepthFormat::Float32;
+        float range_near = 0.0f, range_scale = 1.0f;
+
+        std::vector<float> f32;
+        std::vector<uint16_t> u16;
+        std::vector<uint8_t> u24;
+        std::vector<tile_plane> planes;
+        std::vector<tile_bounds> bounds;
+        bool tile_bounds_requested = false, keep_bounds = false;
+    };
+}
+
+#endif //RASTERIZER_DEPTHBUFFER_H
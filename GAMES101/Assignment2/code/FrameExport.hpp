@@ -0,0 +1,208 @@
+//
+// 8-bit export of the float frame buffer.
+//
+
+#ifndef RASTERIZER_FRAMEEXPORT_H
+#define RASTERIZER_FRAMEEXPORT_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <eigen3/Eigen/Eigen>
+#include <opencv2/opencv.hpp>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+namespace rst
+{
+    /*
+     * Quantizes count RGB pixels with channels in [0, 255] to 8 bits and writes them in
+     * OpenCV's BGR order, or BGRA with an opaque alpha for channels = 4, in a single pass.
+     * Rounds to nearest even and saturates like cv::Mat::convertTo, so the bytes are the
+     * same as convertTo followed by cvtColor(RGB2BGR). With swap_red_blue = false the
+     * channels keep their order, the same as convertTo alone, for a frame buffer that
+     * already holds BGR.
+     * */
+    inline void quantize_bgr(const Eigen::Vector3f* rgb, uint8_t* out, size_t count, int channels, bool swap_red_blue = true)
+    {
+        const float* src = rgb->data();
+        size_t i = 0;
+#if defined(__SSSE3__)
+        // 4 pixels are 12 floats: three loads, clamp, round, pack to bytes, then one byte
+        // shuffle swaps R and B (and spreads the pixels to 4 bytes for BGRA)
+        const __m128 zero = _mm_setzero_ps(), max = _mm_set1_ps(255.0f);
+        const __m128i to_bgr = swap_red_blue ? _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, -1, -1, -1, -1)
+                                             : _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, -1, -1, -1, -1);
+        const __m128i to_bgra = swap_red_blue ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+                                              : _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 3 * i), zero), max));
+            __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 3 * i + 4), zero), max));
+            __m128i c = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 3 * i + 8), zero), max));
+            __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, c));
+            if (channels == 4)
+            {
+                _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_or_si128(_mm_shuffle_epi8(bytes, to_bgra), alpha));
+            }
+            else
+            {
+                // 12 bytes, without touching the 4 bytes after them
+                __m128i bgr = _mm_shuffle_epi8(bytes, to_bgr);
+                _mm_storel_epi64((__m128i*)(out + 3 * i), bgr);
+                int32_t last = _mm_cvtsi128_si32(_mm_srli_si128(bgr, 8));
+                std::memcpy(out + 3 * i + 8, &last, 4);
+            }
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                float v = src[3 * i + (swap_red_blue ? 2 - c : c)];
+                // NaN ends up as 0, like the SIMD path
+                v = v > 0.0f ? std::min(v, 255.0f) : 0.0f;
+                out[channels * i + c] = uint8_t(std::nearbyint(v));
+            }
+            if (channels == 4)
+                out[4 * i + 3] = 255;
+        }
+    }
+
+    /*
+     * Writes 8-bit images on a background thread, so encoding a PNG sequence overlaps with
+     * rendering the next frame. write() copies the pixels into a recycled buffer and returns
+     * at once; it only waits while max_pending images are still queued. The destructor
+     * finishes every queued image. An image that cannot be written is reported on std::cerr
+     * and counted in failures().
+     * */
+    class image_writer
+    {
+    public:
+        explicit image_writer(int max_pending = 4) : max_pending(max_pending), worker([this] { run(); }) {}
+
+        ~image_writer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+            }
+            wake.notify_all();
+            worker.join();
+        }
+
+        image_writer(const image_writer&) = delete;
+        image_writer& operator=(const image_writer&) = delete;
+
+        // image must be 8 bits per channel
+        void write(const std::string& filename, const cv::Mat& image)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.wait(lock, [this] { return (int)queue.size() < max_pending; });
+            job j;
+            if (!spare.empty())
+            {
+                j.pixels = std::move(spare.back());
+                spare.pop_back();
+            }
+            lock.unlock();
+
+            // 复制放在锁外面，后台线程同时在编码
+            size_t row_bytes = size_t(image.cols) * image.channels();
+            j.pixels.resize(row_bytes * image.rows);
+            for (int y = 0; y < image.rows; ++y)
+                std::memcpy(&j.pixels[row_bytes * y], image.ptr(y), row_bytes);
+            j.filename = filename;
+            j.rows = image.rows;
+            j.cols = image.cols;
+            j.type = image.type();
+
+            lock.lock();
+            queue.push_back(std::move(j));
+            wake.notify_one();
+        }
+
+        // Waits until every queued image is written.
+        void flush()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.wait(lock, [this] { return queue.empty() && !busy; });
+        }
+
+        // Images that could not be written so far
+        int failures()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return failed;
+        }
+
+    private:
+        struct job
+        {
+            std::string filename;
+            std::vector<uint8_t> pixels;
+            int rows = 0, cols = 0, type = 0;
+        };
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                wake.wait(lock, [this] { return done || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                job j = std::move(queue.front());
+                queue.pop_front();
+                busy = true;
+                lock.unlock();
+
+                // 异常不能从后台线程里抛出去，否则 std::terminate；记下来，继续写后面的图片
+                std::string error;
+                try
+                {
+                    if (!cv::imwrite(j.filename, cv::Mat(j.rows, j.cols, j.type, j.pixels.data())))
+                        error = "imwrite failed";
+                }
+                catch (const std::exception& e)
+                {
+                    error = e.what();
+                }
+
+                lock.lock();
+                if (!error.empty())
+                {
+                    ++failed;
+                    std::cerr << "cannot write " << j.filename << ": " << error << '\n';
+                }
+                busy = false;
+                spare.push_back(std::move(j.pixels));
+                idle.notify_all();
+            }
+        }
+
+        int max_pending;
+        std::mutex mutex;
+        std::condition_variable wake, idle;
+        std::deque<job> queue;
+        std::vector<std::vector<uint8_t>> spare;
+        bool busy = false;
+        bool done = false;
+        int failed = 0;
+        // last, so everything above exists before the thread starts
+        std::thread worker;
+    };
+}
+
+#endif //RASTERIZER_FRAMEEXPORT_H
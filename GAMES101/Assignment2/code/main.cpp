@@ -1,5 +1,7 @@
 // clang-format off
 #include <iostream>
+#include <set>
+#include <chrono>
 #include <opencv2/opencv.hpp>
 #include "rasterizer.hpp"
 #include "global.hpp"
@@ -58,13 +60,29 @@ int main(int argc, const char** argv)
     bool command_line = false;
     std::string filename = "output.png";
 
-    if (argc == 2)
+    if (argc >= 2)
     {
         command_line = true;
         filename = std::string(argv[1]);
     }
+    // 其余参数是选项，例如 ./Rasterizer output.png msaa8
+    std::set<std::string> options(argv + std::min(argc, 2), argv + argc);
 
     rst::rasterizer r(700, 700);
+    if (options.count("noaa"))
+        r.set_antialiasing(rst::AntiAliasing::None);
+    else if (options.count("ssaa"))
+        r.set_antialiasing(rst::AntiAliasing::Supersample);
+    else if (options.count("msaa2"))
+        r.set_antialiasing(rst::AntiAliasing::Multisample, 2);
+    else if (options.count("msaa8"))
+        r.set_antialiasing(rst::AntiAliasing::Multisample, 8);
+    if (options.count("depth16"))
+        r.set_depth_format(rst::DepthFormat::Unorm16);
+    else if (options.count("depth24"))
+        r.set_depth_format(rst::DepthFormat::Unorm24);
+    else if (options.count("depthplane"))
+        r.set_depth_format(rst::DepthFormat::TilePlane);
 
     Eigen::Vector3f eye_pos = {0,0,5};
 
@@ -102,6 +120,86 @@ int main(int argc, const char** argv)
     int key = 0;
     int frame_count = 0;
 
+    if (options.count("depth_bench"))
+    {
+        // 各深度格式在 1080p 和 4K 下的深度缓冲大小、帧时间和存成平面的块数
+        struct depth_config { const char* name; rst::DepthFormat format; };
+        const depth_config formats[] = {
+            {"float32", rst::DepthFormat::Float32},
+            {"unorm16", rst::DepthFormat::Unorm16},
+            {"unorm24", rst::DepthFormat::Unorm24},
+            {"tile plane", rst::DepthFormat::TilePlane},
+        };
+        const int resolutions[2][2] = {{1920, 1080}, {3840, 2160}};
+        for (auto& resolution : resolutions)
+        {
+            rst::rasterizer big(resolution[0], resolution[1]);
+            auto big_pos = big.load_positions(pos);
+            auto big_ind = big.load_indices(ind);
+            auto big_col = big.load_colors(cols);
+            big.set_model(get_model_matrix(angle));
+            big.set_view(get_view_matrix(eye_pos));
+            big.set_projection(get_projection_matrix(45, float(resolution[0]) / resolution[1], 0.1, 50));
+            for (int samples : {1, 4})
+            {
+                big.set_antialiasing(samples == 1 ? rst::AntiAliasing::None : rst::AntiAliasing::Multisample, samples);
+                for (auto& config : formats)
+                {
+                    big.set_depth_format(config.format);
+                    double best = 1e30;
+                    for (int run = 0; run < 5; ++run)
+                    {
+                        auto start = std::chrono::high_resolution_clock::now();
+                        big.clear(rst::Buffers::Color | rst::Buffers::Depth);
+                        big.draw(big_pos, big_ind, big_col, rst::Primitive::Triangle);
+                        big.resolve();
+                        auto end = std::chrono::high_resolution_clock::now();
+                        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+                    }
+                    std::cout << resolution[0] << "x" << resolution[1] << " " << samples << "x " << config.name << ": depth "
+                              << big.depth_bytes() / (1024.0 * 1024.0) << " MiB, " << big.depth_plane_tiles()
+                              << " plane tiles, frame " << best << " ms\n";
+                }
+            }
+        }
+        return 0;
+    }
+
+    if (options.count("aa_bench"))
+    {
+        // 每种抗锯齿模式的缓冲大小和帧时间（清屏 + 绘制 + resolve，取最好的一次）
+        struct aa_config { const char* name; rst::AntiAliasing mode; int samples; };
+        const aa_config configs[] = {
+            {"none", rst::AntiAliasing::None, 1},
+            {"ssaa 4x (old)", rst::AntiAliasing::Supersample, 4},
+            {"msaa 2x", rst::AntiAliasing::Multisample, 2},
+            {"msaa 4x", rst::AntiAliasing::Multisample, 4},
+            {"msaa 8x", rst::AntiAliasing::Multisample, 8},
+        };
+        r.set_model(get_model_matrix(angle));
+        r.set_view(get_view_matrix(eye_pos));
+        r.set_projection(get_projection_matrix(45, 1, 0.1, 50));
+        for (auto& config : configs)
+        {
+            r.set_antialiasing(config.mode, config.samples);
+            double best_frame = 1e30, best_resolve = 1e30;
+            for (int run = 0; run < 20; ++run)
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+                r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle);
+                auto drawn = std::chrono::high_resolution_clock::now();
+                r.resolve();
+                auto end = std::chrono::high_resolution_clock::now();
+                best_frame = std::min(best_frame, std::chrono::duration<double, std::milli>(end - start).count());
+                best_resolve = std::min(best_resolve, std::chrono::duration<double, std::milli>(end - drawn).count());
+            }
+            std::cout << config.name << ": " << r.buffer_bytes() / (1024.0 * 1024.0) << " MiB, frame "
+                      << best_frame << " ms, resolve " << best_resolve << " ms\n";
+        }
+        return 0;
+    }
+
     if (command_line)
     {
         r.clear(rst::Buffers::Color | rst::Buffers::Depth);
@@ -111,9 +209,8 @@ int main(int argc, const char** argv)
         r.set_projection(get_projection_matrix(45, 1, 0.1, 50));
 
         r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle);
-        cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-        image.convertTo(image, CV_8UC3, 1.0f);
-        cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+        r.resolve();
+        cv::Mat image = r.output_image();
 
         cv::imwrite(filename, image);
 
@@ -129,10 +226,9 @@ int main(int argc, const char** argv)
         r.set_projection(get_projection_matrix(45, 1, 0.1, 50));
 
         r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle);
+        r.resolve();
 
-        cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-        image.convertTo(image, CV_8UC3, 1.0f);
-        cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+        cv::Mat image = r.output_image();
         cv::imshow("image", image);
         key = cv::waitKey(10);
 
@@ -8,6 +8,7 @@
 #include "rasterizer.hpp"
 #include <opencv2/opencv.hpp>
 #include <math.h>
+#include <stdexcept>
 
 
 rst::pos_buf_id rst::rasterizer::load_positions(const std::vector<Eigen::Vector3f> &positions)
@@ -40,36 +41,6 @@ auto to_vec4(const Eigen::Vector3f& v3, float w = 1.0f)
 }
 
 
-static bool insideTriangle(float x, float y, const Vector3f* _v)
-{   
-    // TODO : Implement this function to check if the point (x, y) is inside the triangle represented by _v[0], _v[1], _v[2]
-    Eigen::Vector2f AP(x - _v[0].x(), y - _v[0].y());
-    Eigen::Vector2f AB(_v[1].x() - _v[0].x(), _v[1].y()- _v[0].y());
-    Eigen::Vector2f BP(x - _v[1].x(), y - _v[1].y());
-    Eigen::Vector2f BC(_v[2].x()-_v[1].x(), _v[2].y()-_v[1].y());
-    Eigen::Vector2f CP(x - _v[2].x(), y - _v[2].y());
-    Eigen::Vector2f CA(_v[0].x() - _v[2].x(), _v[0].y() - _v[2].y());
-
-    auto P_AB = AP.x() * AB.y() - AB.x() * AP.y();
-    auto P_BC = BP.x() * BC.y() - BC.x() * BP.y();
-    auto P_CA = CP.x() * CA.y() - CA.x() * CP.y();
-
-    if ((P_AB >0 && P_BC >0 && P_CA >0) || (P_AB < 0 && P_BC < 0 && P_CA < 0)) {
-        return true;
-    }
-    else {
-        return false;
-    }
-}  
-
-static std::tuple<float, float, float> computeBarycentric2D(float x, float y, const Vector3f* v)
-{
-    float c1 = (x*(v[1].y() - v[2].y()) + (v[2].x() - v[1].x())*y + v[1].x()*v[2].y() - v[2].x()*v[1].y()) / (v[0].x()*(v[1].y() - v[2].y()) + (v[2].x() - v[1].x())*v[0].y() + v[1].x()*v[2].y() - v[2].x()*v[1].y());
-    float c2 = (x*(v[2].y() - v[0].y()) + (v[0].x() - v[2].x())*y + v[2].x()*v[0].y() - v[0].x()*v[2].y()) / (v[1].x()*(v[2].y() - v[0].y()) + (v[0].x() - v[2].x())*v[1].y() + v[2].x()*v[0].y() - v[0].x()*v[2].y());
-    float c3 = (x*(v[0].y() - v[1].y()) + (v[1].x() - v[0].x())*y + v[0].x()*v[1].y() - v[1].x()*v[0].y()) / (v[2].x()*(v[0].y() - v[1].y()) + (v[1].x() - v[0].x())*v[2].y() + v[0].x()*v[1].y() - v[1].x()*v[0].y());
-    return {c1,c2,c3};
-}
-
 void rst::rasterizer::draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type)
 {
     auto& buf = pos_buf[pos_buffer.pos_id];
@@ -124,80 +95,104 @@ void rst::rasterizer::draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf
 //Screen space rasterization
 void rst::rasterizer::rasterize_triangle(const Triangle& t) {
     auto v = t.toVector4();
+
+    // 边函数只在三角形开始时建立一次，之后每个像素只需要加法
+    edge_setup setup;
+    if (!setup.setup(v[0].x(), v[0].y(), v[1].x(), v[1].y(), v[2].x(), v[2].y()))
+        return;
+
     // TODO : Find out the bounding box of current triangle.
-    int bounding_box_left_x = std::min(v[0].x(), std::min(v[1].x(), v[2].x()));
-    int bounding_box_right_x = std::max(v[0].x(), std::max(v[1].x(), v[2].x()));
-    int bounding_box_bottom_y = std::min(v[0].y(), std::min(v[1].y(), v[2].y()));
-    int bounding_box_top_y = std::max(v[0].y(), std::max(v[1].y(), v[2].y()));
+    // 包围盒裁剪到屏幕范围内
+    int bounding_box_left_x = std::max<int>(0, std::min(v[0].x(), std::min(v[1].x(), v[2].x())));
+    int bounding_box_right_x = std::min<int>(width - 1, std::max(v[0].x(), std::max(v[1].x(), v[2].x())));
+    int bounding_box_bottom_y = std::max<int>(0, std::min(v[0].y(), std::min(v[1].y(), v[2].y())));
+    int bounding_box_top_y = std::min<int>(height - 1, std::max(v[0].y(), std::max(v[1].y(), v[2].y())));
+
+    float z_over_w[3];
+    for (int i = 0; i < 3; ++i)
+        z_over_w[i] = v[i].z() / v[i].w();
+
+    if (antialiasing == AntiAliasing::Multisample) {
+        rasterize_triangle_msaa(t, setup, z_over_w, bounding_box_left_x, bounding_box_bottom_y,
+                                bounding_box_right_x, bounding_box_top_y);
+        return;
+    }
+    if (antialiasing == AntiAliasing::Supersample) {
+        rasterize_triangle_supersample(t, setup, z_over_w, bounding_box_left_x, bounding_box_bottom_y,
+                                       bounding_box_right_x, bounding_box_top_y);
+        return;
+    }
 
     /*without MSAA*/
-    
-    // iterate through the pixel and find if the current pixel is inside the triangle
-    /*
-    for (int x = bounding_box_left_x; x <= bounding_box_right_x; x++) {
-        for (int y = bounding_box_bottom_y; y <= bounding_box_top_y; y++) {
-            if (insideTriangle(x + 0.5, y + 0.5, t.v)) {
-                // If so, use the following code to get the interpolated z value.   
-                auto[alpha, beta, gamma] = computeBarycentric2D(x + 0.5, y + 0.5, t.v);
-                float w_reciprocal = 1.0/(alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());
-                float z_interpolated = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
-                z_interpolated *= w_reciprocal;
-                if (z_interpolated <  depth_buf[get_index(x, y)]) {
-                    depth_buf[get_index(x, y)] = z_interpolated;
-                    // TODO : set the current pixel (use the set_pixel function) to the color of the triangle (use getColor function) if it should be painted.
-                    set_pixel(Eigen::Vector3f(x, y, z_interpolated),  t.getColor());
+    // 按 8x8 的深度块扫描：整块被三角形覆盖且更近时，深度块只存平面，块内不再逐像素做深度测试
+    constexpr int tile = depth_buffer::tile;
+    for (int block_y = bounding_box_bottom_y; block_y <= bounding_box_top_y; block_y = (block_y / tile + 1) * tile) {
+        int block_top_y = std::min(bounding_box_top_y, (block_y / tile + 1) * tile - 1);
+        for (int block_x = bounding_box_left_x; block_x <= bounding_box_right_x; block_x = (block_x / tile + 1) * tile) {
+            int block_right_x = std::min(bounding_box_right_x, (block_x / tile + 1) * tile - 1);
+            bool covered = depth_buf.try_plane(setup, z_over_w, block_x / tile, block_y / tile);
+
+            // iterate through the pixel and find if the current pixel is inside the triangle
+            for (int y = block_y; y <= block_top_y; y++) {
+                int64_t e[3];
+                float bary[3];
+                setup.start(block_x, y, e, bary);
+                for (int x = block_x; x <= block_right_x; x++) {
+                    if (covered || setup.inside(e)) {
+                        float z_interpolated = bary[0] * z_over_w[0] + bary[1] * z_over_w[1] + bary[2] * z_over_w[2];
+                        if (covered || depth_buf.test_and_set(x, y, 0, z_interpolated)) {
+                            // TODO : set the current pixel (use the set_pixel function) to the color of the triangle (use getColor function) if it should be painted.
+                            set_pixel(Eigen::Vector3f(x, y, z_interpolated),  t.getColor());
+                        }
+                    }
+                    for (int i = 0; i < 3; ++i) {
+                        e[i] += setup.step_x[i];
+                        bary[i] += setup.bary_step_x[i];
+                    }
                 }
             }
         }
     }
-    */
+}
 
-   
-   /*with MSAA*/
+void rst::rasterizer::rasterize_triangle_supersample(const Triangle& t, const edge_setup& setup, const float z_over_w[3],
+                                                     int bounding_box_left_x, int bounding_box_bottom_y,
+                                                     int bounding_box_right_x, int bounding_box_top_y) {
     // iterate through the pixel and find if the current pixel is inside the triangle
     
     int inNumber;
-    float x_sample;
-    float y_sample;
     int sample_index[4];
 
-    std::vector<Eigen::Vector3f> pixelvec;
-
     float rd[4][2] ={
                     {0.25, 0.25}, 
                     {0.25, 0.75},
                     {0.75, 0.25},
                     {0.75, 0.75}};
-    for (int x = bounding_box_left_x; x <= bounding_box_right_x; x++) {
-        for (int y = bounding_box_bottom_y; y <= bounding_box_top_y; y++) {
+    // 采样点相对像素中心的偏移，单位是子像素
+    int sample_offset[4][2];
+    for (int i = 0; i < 4; i++) {
+        sample_offset[i][0] = int((rd[i][0] - 0.5f) * subpixel_one);
+        sample_offset[i][1] = int((rd[i][1] - 0.5f) * subpixel_one);
+    }
+    for (int y = bounding_box_bottom_y; y <= bounding_box_top_y; y++) {
+        int64_t e[3];
+        float bary[3];
+        setup.start(bounding_box_left_x, y, e, bary);
+        for (int x = bounding_box_left_x; x <= bounding_box_right_x; x++) {
             inNumber = 0;
             for (int i = 0; i < 4; i++){
-                    x_sample = x + rd[i][0];
-                    y_sample = y + rd[i][1];
-                    sample_index[i] =  get_sample_index(int(2 * x_sample), int(2 * y_sample));
-                    if (insideTriangle(x_sample, y_sample, t.v)) {
-                    // If so, use the following code to get the interpolated z value.   
-                    //auto[alpha, beta, gamma] = computeBarycentric2D(x, y, t.v);
-                    //float w_reciprocal = 1.0/(alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());
-                    //float z_interpolated = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
-                    //z_interpolated *= w_reciprocal;
-
-                        
-                        //std::tuple <float, float, float> sample_Barycentric= computeBarycentric2D(x_sample, y_sample, t.v);
-                        //float sample_alpha, sample_beta, sample_gamma;
-                        //std::tie(sample_alpha, sample_beta, sample_gamma) = sample_Barycentric;
-                        auto[sample_alpha, sample_beta, sample_gamma] = computeBarycentric2D(x_sample, y_sample, t.v);
-                        float sample_w_reciprocal = 1.0/(sample_alpha / v[0].w() + sample_beta / v[1].w() + sample_gamma / v[2].w());
-                        float sample_z_interpolated = sample_alpha * v[0].z() / v[0].w() + sample_beta * v[1].z() / v[1].w() + sample_gamma * v[2].z() / v[2].w();
-                        sample_z_interpolated *= sample_w_reciprocal;
-                        //depth_buf[ind] = 0;
-                        //depth_buf[get_index(x, y)] = 0;
+                    sample_index[i] =  get_sample_index(int(2 * (x + rd[i][0])), int(2 * (y + rd[i][1])));
+                    int64_t sample_e[3];
+                    float sample_bary[3];
+                    setup.offset(e, bary, sample_offset[i][0], sample_offset[i][1], sample_e, sample_bary);
+                    if (setup.inside(sample_e)) {
+                        // If so, use the following code to get the interpolated z value.
+                        float sample_z_interpolated = sample_bary[0] * z_over_w[0] + sample_bary[1] * z_over_w[1] + sample_bary[2] * z_over_w[2];
                         if (sample_z_interpolated <  sample_depth_buf[sample_index[i]]) {
                             sample_depth_buf[sample_index[i]] = sample_z_interpolated;
                         // TODO : set the current pixel (use the set_pixel function) to the color of the triangle (use getColor function) if it should be painted.
                             sample_frame_buf[sample_index[i]] = t.getColor();
                             inNumber = inNumber + 1;
-                        //std::cout << pixelColor<<std::endl;
                         }
                     }    
             }
@@ -208,11 +203,176 @@ void rst::rasterizer::rasterize_triangle(const Triangle& t) {
                                                 + sample_frame_buf[sample_index[2]] + sample_frame_buf[sample_index[3]])/ 4;
                 set_pixel(Eigen::Vector3f(x, y, 0),   pixelColor);
             }
+            for (int i = 0; i < 3; ++i) {
+                e[i] += setup.step_x[i];
+                bary[i] += setup.bary_step_x[i];
+            }
         }
     } 
     
 }
 
+// 旋转网格采样位置，单位 1/16 像素，相对像素中心（D3D 标准采样模式）
+static const int msaa_pattern_2x[2][2] = {{4, 4}, {-4, -4}};
+static const int msaa_pattern_4x[4][2] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+static const int msaa_pattern_8x[8][2] = {{1, -3}, {-1, 3}, {5, 1}, {-3, -5},
+                                          {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+
+static const int (*msaa_pattern(int samples))[2]
+{
+    return samples == 2 ? msaa_pattern_2x : samples == 8 ? msaa_pattern_8x : msaa_pattern_4x;
+}
+
+static uint32_t pack_color(const Eigen::Vector3f& c)
+{
+    auto channel = [](float v) { return uint32_t(std::min(std::max(v, 0.0f), 255.0f) + 0.5f); };
+    return channel(c.x()) | (channel(c.y()) << 8) | (channel(c.z()) << 16);
+}
+
+/*
+ * Multisampling: coverage is one edge function evaluation at the pixel center plus a
+ * per-triangle constant offset for each sample, giving a bit mask; depth is tested per
+ * sample from the depth plane, and the color is shaded once per pixel and written to
+ * every sample that passed. resolve() averages the samples once per frame.
+ * */
+void rst::rasterizer::rasterize_triangle_msaa(const Triangle& t, const edge_setup& setup, const float z_over_w[3],
+                                              int bounding_box_left_x, int bounding_box_bottom_y,
+                                              int bounding_box_right_x, int bounding_box_top_y) {
+    const int n = num_samples;
+    const int full_mask = (1 << n) - 1;
+    auto pattern = msaa_pattern(n);
+
+    // 每个采样点的边函数和深度相对像素中心的偏移，每个三角形只算一次
+    constexpr int pattern_scale = int(subpixel_one / 16);
+    float z_step_x = 0, z_step_y = 0;
+    for (int i = 0; i < 3; ++i) {
+        z_step_x += setup.bary_step_x[i] * z_over_w[i];
+        z_step_y += setup.bary_step_y[i] * z_over_w[i];
+    }
+    int64_t edge_offset[3][8];
+    float depth_offset[8];
+    for (int s = 0; s < n; ++s) {
+        int ox = pattern[s][0] * pattern_scale, oy = pattern[s][1] * pattern_scale;
+        for (int i = 0; i < 3; ++i)
+            edge_offset[i][s] = -setup.dy[i] * ox + setup.dx[i] * oy + setup.bias[i];
+        depth_offset[s] = (z_step_x * ox + z_step_y * oy) / float(subpixel_one);
+    }
+
+    constexpr int tile = depth_buffer::tile;
+    for (int block_y = bounding_box_bottom_y; block_y <= bounding_box_top_y; block_y = (block_y / tile + 1) * tile) {
+        int block_top_y = std::min(bounding_box_top_y, (block_y / tile + 1) * tile - 1);
+        for (int block_x = bounding_box_left_x; block_x <= bounding_box_right_x; block_x = (block_x / tile + 1) * tile) {
+            int block_right_x = std::min(bounding_box_right_x, (block_x / tile + 1) * tile - 1);
+            // 整块覆盖且更近：深度只存平面，块内所有采样点都通过
+            bool covered = depth_buf.try_plane(setup, z_over_w, block_x / tile, block_y / tile);
+
+            for (int y = block_y; y <= block_top_y; y++) {
+                int64_t e[3];
+                float bary[3];
+                setup.start(block_x, y, e, bary);
+                for (int x = block_x; x <= block_right_x; x++) {
+                    int passed = covered ? full_mask : 0;
+                    if (!covered) {
+                        int coverage = 0;
+                        for (int s = 0; s < n; ++s)
+                            coverage |= int(((e[0] + edge_offset[0][s]) | (e[1] + edge_offset[1][s]) | (e[2] + edge_offset[2][s])) >= 0) << s;
+                        if (coverage) {
+                            float z_center = bary[0] * z_over_w[0] + bary[1] * z_over_w[1] + bary[2] * z_over_w[2];
+                            for (int s = 0; s < n; ++s)
+                                if ((coverage >> s & 1) && depth_buf.test_and_set(x, y, s, z_center + depth_offset[s]))
+                                    passed |= 1 << s;
+                        }
+                    }
+
+                    if (passed) {
+                        // 每个像素每个三角形只着色一次
+                        int pixel = get_index(x, y);
+                        uint32_t color = pack_color(t.getColor());
+                        uint32_t* samples = &sample_color_buf[size_t(pixel) * n];
+                        if (passed == full_mask) {
+                            samples[0] = color;
+                            sample_uniform[pixel] = 1;
+                        } else {
+                            if (sample_uniform[pixel]) {
+                                std::fill(samples + 1, samples + n, samples[0]);
+                                sample_uniform[pixel] = 0;
+                            }
+                            for (int s = 0; s < n; ++s)
+                                if (passed >> s & 1)
+                                    samples[s] = color;
+                        }
+                    }
+                    for (int i = 0; i < 3; ++i) {
+                        e[i] += setup.step_x[i];
+                        bary[i] += setup.bary_step_x[i];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void rst::rasterizer::resolve()
+{
+    if (antialiasing != AntiAliasing::Multisample)
+        return;
+
+    const int n = num_samples;
+    const float inv_n = 1.0f / n;
+    for (size_t pixel = 0; pixel < frame_buf.size(); ++pixel) {
+        const uint32_t* samples = &sample_color_buf[pixel * n];
+        if (sample_uniform[pixel]) {
+            uint32_t c = samples[0];
+            frame_buf[pixel] = Eigen::Vector3f(c & 0xff, c >> 8 & 0xff, c >> 16 & 0xff);
+            continue;
+        }
+        uint32_t r = 0, g = 0, b = 0;
+        for (int s = 0; s < n; ++s) {
+            r += samples[s] & 0xff;
+            g += samples[s] >> 8 & 0xff;
+            b += samples[s] >> 16 & 0xff;
+        }
+        frame_buf[pixel] = Eigen::Vector3f(r * inv_n, g * inv_n, b * inv_n);
+    }
+}
+
+void rst::rasterizer::set_antialiasing(AntiAliasing mode, int samples)
+{
+    if (mode == AntiAliasing::Multisample && samples != 2 && samples != 4 && samples != 8)
+        throw std::invalid_argument("MSAA supports 2, 4 or 8 samples");
+
+    antialiasing = mode;
+    num_samples = mode == AntiAliasing::None ? 1 : mode == AntiAliasing::Supersample ? 4 : samples;
+
+    // 只为当前模式分配采样缓冲
+    size_t pixels = size_t(width) * height;
+    bool ssaa = mode == AntiAliasing::Supersample, msaa = mode == AntiAliasing::Multisample;
+    sample_frame_buf.assign(ssaa ? 4 * pixels : 0, Eigen::Vector3f{0, 0, 0});
+    sample_depth_buf.assign(ssaa ? 4 * pixels : 0, std::numeric_limits<float>::infinity());
+    sample_color_buf.assign(msaa ? num_samples * pixels : 0, 0);
+    sample_uniform.assign(msaa ? pixels : 0, 1);
+
+    float positions[8][2];
+    auto pattern = msaa_pattern(num_samples);
+    for (int s = 0; s < num_samples; ++s) {
+        positions[s][0] = msaa ? pattern[s][0] / 16.0f : 0.0f;
+        positions[s][1] = msaa ? pattern[s][1] / 16.0f : 0.0f;
+    }
+    depth_buf.resize(ssaa ? 0 : width, ssaa ? 0 : height, num_samples, positions);
+}
+
+void rst::rasterizer::set_depth_format(DepthFormat format)
+{
+    depth_buf.set_format(format);
+}
+
+size_t rst::rasterizer::buffer_bytes() const
+{
+    return frame_buf.size() * sizeof(Eigen::Vector3f) + depth_buf.bytes() +
+           sample_frame_buf.size() * sizeof(Eigen::Vector3f) + sample_depth_buf.size() * sizeof(float) +
+           sample_color_buf.size() * sizeof(uint32_t) + sample_uniform.size() * sizeof(uint8_t);
+}
+
 
 
 void rst::rasterizer::set_model(const Eigen::Matrix4f& m)
@@ -230,6 +390,13 @@ void rst::rasterizer::set_projection(const Eigen::Matrix4f& p)
     projection = p;
 }
 
+cv::Mat rst::rasterizer::output_image()
+{
+    output_buf.resize(frame_buf.size() * output_channels);
+    quantize_bgr(frame_buf.data(), output_buf.data(), frame_buf.size(), output_channels);
+    return cv::Mat(height, width, output_channels == 4 ? CV_8UC4 : CV_8UC3, output_buf.data());
+}
+
 void rst::rasterizer::clear(rst::Buffers buff)
 {
     if ((buff & rst::Buffers::Color) == rst::Buffers::Color)
@@ -237,10 +404,12 @@ void rst::rasterizer::clear(rst::Buffers buff)
         std::fill(frame_buf.begin(), frame_buf.end(), Eigen::Vector3f{0, 0, 0});
         //MSAA sample_frame_buf
         std::fill(sample_frame_buf.begin(), sample_frame_buf.end(), Eigen::Vector3f{0, 0, 0});
+        std::fill(sample_color_buf.begin(), sample_color_buf.end(), 0);
+        std::fill(sample_uniform.begin(), sample_uniform.end(), 1);
     }
     if ((buff & rst::Buffers::Depth) == rst::Buffers::Depth)
     {
-        std::fill(depth_buf.begin(), depth_buf.end(), std::numeric_limits<float>::infinity());
+        depth_buf.clear();
         //MSAA sample_depth_buf
         std::fill(sample_depth_buf.begin(), sample_depth_buf.end(), std::numeric_limits<float>::infinity());
     }
@@ -249,11 +418,11 @@ void rst::rasterizer::clear(rst::Buffers buff)
 rst::rasterizer::rasterizer(int w, int h) : width(w), height(h)
 {
     frame_buf.resize(w * h);
-    depth_buf.resize(w * h);
-    
+    // draw() 的视口变换把深度映射到 [0.1, 50]
+    depth_buf.set_range(0.1f, 50.0f);
+
     //MSAA
-    sample_frame_buf.resize(4 * w * h);
-    sample_depth_buf.resize(4 * w * h);
+    set_antialiasing(AntiAliasing::Multisample, 4);
 }
 
 int rst::rasterizer::get_index(int x, int y)
@@ -6,8 +6,12 @@
 
 #include <eigen3/Eigen/Eigen>
 #include <algorithm>
+#include <cstdint>
 #include "global.hpp"
 #include "Triangle.hpp"
+#include "EdgeFunction.hpp"
+#include "DepthBuffer.hpp"
+#include "FrameExport.hpp"
 using namespace Eigen;
 
 namespace rst
@@ -34,6 +38,13 @@ namespace rst
         Triangle
     };
 
+    enum class AntiAliasing
+    {
+        None,
+        Supersample, // 旧的 4x 超采样：每个采样点一份颜色，每次写入都重新平均
+        Multisample
+    };
+
     /*
      * For the curious : The draw function takes two buffer id's as its arguments. These two structs
      * make sure that if you mix up with their orders, the compiler won't compile it.
@@ -72,12 +83,34 @@ namespace rst
 
         void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type);
 
+        // samples is 2, 4 or 8 for Multisample; Supersample is always 4x.
+        void set_antialiasing(AntiAliasing mode, int samples = 4);
+        // Storage format of the depth buffer used by None and Multisample.
+        void set_depth_format(DepthFormat format);
+        // Averages the multisample buffer into frame_buf, once per frame after all draws.
+        void resolve();
+        // Bytes held by the frame, depth and sample buffers.
+        size_t buffer_bytes() const;
+        size_t depth_bytes() const { return depth_buf.bytes(); }
+        int depth_plane_tiles() const { return depth_buf.plane_tiles(); }
+
         std::vector<Eigen::Vector3f>& frame_buffer() { return frame_buf; }
 
+        // 3 for BGR, 4 for BGRA with an opaque alpha
+        void set_output_channels(int channels) { output_channels = channels; }
+        // Quantizes the frame buffer into the 8-bit output buffer in OpenCV's channel order and
+        // returns a cv::Mat that views it without a copy, ready for imshow/imwrite. The view is
+        // valid until the next call.
+        cv::Mat output_image();
+
     private:
         void draw_line(Eigen::Vector3f begin, Eigen::Vector3f end);
 
         void rasterize_triangle(const Triangle& t);
+        void rasterize_triangle_supersample(const Triangle& t, const edge_setup& setup, const float z_over_w[3],
+                                            int x0, int y0, int x1, int y1);
+        void rasterize_triangle_msaa(const Triangle& t, const edge_setup& setup, const float z_over_w[3],
+                                     int x0, int y0, int x1, int y1);
 
         // VERTEX SHADER -> MVP -> Clipping -> /.W -> VIEWPORT -> DRAWLINE/DRAWTRI -> FRAGSHADER
 
@@ -91,10 +124,20 @@ namespace rst
         std::map<int, std::vector<Eigen::Vector3f>> col_buf;
 
         std::vector<Eigen::Vector3f> frame_buf;
-        std::vector<float> depth_buf;
+        std::vector<uint8_t> output_buf;
+        int output_channels = 3;
+        // None 和 Multisample 的深度（多重采样时每个像素 num_samples 个）
+        depth_buffer depth_buf;
         //MSAA
         std::vector<Eigen::Vector3f> sample_frame_buf;
         std::vector<float> sample_depth_buf;
+        // 多重采样：每个像素 num_samples 个 RGB8 颜色，按像素连续存放。
+        // sample_uniform 为 1 时所有采样点颜色相同，只有第 0 个有效。
+        std::vector<uint32_t> sample_color_buf;
+        std::vector<uint8_t> sample_uniform;
+
+        AntiAliasing antialiasing = AntiAliasing::Multisample;
+        int num_samples = 4;
 
         int get_index(int x, int y);
         //MSAA
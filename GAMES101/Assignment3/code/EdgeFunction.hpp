@@ -0,0 +1,110 @@
+//
+// Incremental edge function setup for triangle rasterization.
+//
+
+#ifndef RASTERIZER_EDGEFUNCTION_H
+#define RASTERIZER_EDGEFUNCTION_H
+
+#include <cstdint>
+#include <cmath>
+
+namespace rst
+{
+    // Vertices are snapped to 1/256 pixel, so the edge functions are exact 64 bit integers.
+    constexpr int subpixel_bits = 8;
+    constexpr int64_t subpixel_one = int64_t(1) << subpixel_bits;
+
+    /*
+     * E_i(x, y) is the edge function of the edge opposite to vertex i, scaled so that the
+     * inside of the triangle is positive whatever the winding. It is set up once per
+     * triangle and then stepped from pixel to pixel with adds only:
+     *     E_i(x + 1, y) = E_i(x, y) + step_x[i]
+     *     E_i(x, y + 1) = E_i(x, y) + step_y[i]
+     * The barycentric coordinates are E_i / area and are stepped the same way.
+     *
+     * Pixels exactly on an edge follow the top-left fill rule: they belong to the triangle
+     * only if the edge is a top or a left edge, so two triangles sharing an edge never
+     * both cover the same pixel.
+     * */
+    struct edge_setup
+    {
+        int64_t origin_x[3], origin_y[3]; // start vertex of each edge, in sub pixels
+        int64_t dx[3], dy[3];             // edge direction, in sub pixels
+        int64_t bias[3];                  // 0 for top-left edges, -1 otherwise
+        int64_t step_x[3], step_y[3];     // edge function change for one pixel step
+        float inv_area;
+        float bary_step_x[3], bary_step_y[3];
+
+        // Returns false for degenerate (zero area) triangles, which cover no pixel.
+        bool setup(float x0, float y0, float x1, float y1, float x2, float y2)
+        {
+            const int64_t X[3] = {snap(x0), snap(x1), snap(x2)};
+            const int64_t Y[3] = {snap(y0), snap(y1), snap(y2)};
+
+            int64_t area = (X[2] - X[1]) * (Y[0] - Y[1]) - (Y[2] - Y[1]) * (X[0] - X[1]);
+            if (area == 0)
+                return false;
+            int64_t sign = area > 0 ? 1 : -1;
+
+            for (int i = 0; i < 3; ++i)
+            {
+                int j = (i + 1) % 3, k = (i + 2) % 3;
+                origin_x[i] = X[j];
+                origin_y[i] = Y[j];
+                dx[i] = sign * (X[k] - X[j]);
+                dy[i] = sign * (Y[k] - Y[j]);
+
+                bool top_left = dy[i] < 0 || (dy[i] == 0 && dx[i] < 0);
+                bias[i] = top_left ? 0 : -1;
+
+                step_x[i] = -dy[i] * subpixel_one;
+                step_y[i] = dx[i] * subpixel_one;
+            }
+
+            inv_area = 1.0f / float(sign * area);
+            for (int i = 0; i < 3; ++i)
+            {
+                bary_step_x[i] = float(step_x[i]) * inv_area;
+                bary_step_y[i] = float(step_y[i]) * inv_area;
+            }
+            return true;
+        }
+
+        // Edge functions and barycentric coordinates at the center of pixel (x, y).
+        void start(int x, int y, int64_t e[3], float bary[3]) const
+        {
+            int64_t px = int64_t(x) * subpixel_one + subpixel_one / 2;
+            int64_t py = int64_t(y) * subpixel_one + subpixel_one / 2;
+            for (int i = 0; i < 3; ++i)
+            {
+                e[i] = dx[i] * (py - origin_y[i]) - dy[i] * (px - origin_x[i]);
+                bary[i] = float(e[i]) * inv_area;
+            }
+        }
+
+        // Edge functions and barycentric coordinates at an offset of (ox, oy) sub pixels
+        // from the point where e and bary were evaluated, e.g. for multisampling.
+        void offset(const int64_t e[3], const float bary[3], int ox, int oy,
+                    int64_t e_out[3], float bary_out[3]) const
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                e_out[i] = e[i] - dy[i] * ox + dx[i] * oy;
+                bary_out[i] = bary[i] + (bary_step_x[i] * ox + bary_step_y[i] * oy) / float(subpixel_one);
+            }
+        }
+
+        // Coverage of a pixel with edge function values e, top-left rule included.
+        bool inside(const int64_t e[3]) const
+        {
+            return ((e[0] + bias[0]) | (e[1] + bias[1]) | (e[2] + bias[2])) >= 0;
+        }
+
+        static int64_t snap(float v)
+        {
+            return (int64_t)std::lround(v * float(subpixel_one));
+        }
+    };
+}
+
+#endif //RASTERIZER_EDGEFUNCTION_H
@@ -4,9 +4,37 @@
 
 #ifndef RASTERIZER_SHADER_H
 #define RASTERIZER_SHADER_H
+#include <array>
 #include <eigen3/Eigen/Eigen>
 #include "Texture.hpp"
 
+struct fragment_quad;
+
+struct light
+{
+    Eigen::Vector3f position;
+    Eigen::Vector3f intensity;
+};
+
+/*
+ * Constants of the Phong family shaders: lights, material and camera. They are set once
+ * per draw with rasterizer::set_uniforms() and reach the shaders by reference through the
+ * payload, instead of being rebuilt for every pixel.
+ * */
+struct uniform_block
+{
+    std::array<light, 2> lights = {light{{20, 20, 20}, {500, 500, 500}}, light{{-20, 20, 0}, {500, 500, 500}}};
+    Eigen::Vector3f amb_light_intensity{10, 10, 10};
+    Eigen::Vector3f ka{0.005, 0.005, 0.005};
+    Eigen::Vector3f ks{0.7937, 0.7937, 0.7937};
+    Eigen::Vector3f eye_pos{0, 0, 10};
+    float p = 150;
+
+    // derived from the above by update()
+    Eigen::Vector3f ambient = ka.cwiseProduct(amb_light_intensity);
+
+    void update() { ambient = ka.cwiseProduct(amb_light_intensity); }
+};
 
 struct fragment_shader_payload
 {
@@ -19,13 +47,81 @@ struct fragment_shader_payload
          color(col), normal(nor), tex_coords(tc), texture(tex) {}
 
 
-    Eigen::Vector3f view_pos;
-    Eigen::Vector3f color;
-    Eigen::Vector3f normal;
-    Eigen::Vector2f tex_coords;
+    Eigen::Vector3f view_pos = Eigen::Vector3f::Zero();
+    Eigen::Vector3f color = Eigen::Vector3f::Zero();
+    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+    Eigen::Vector2f tex_coords = Eigen::Vector2f::Zero();
+    // change of tex_coords from one pixel to the next along screen x and y, for mip mapping
+    Eigen::Vector2f duv_dx = Eigen::Vector2f::Zero();
+    Eigen::Vector2f duv_dy = Eigen::Vector2f::Zero();
     Texture* texture;
+    // nullptr: the defaults of uniform_block
+    const uniform_block* uniforms = nullptr;
+
+    // The quad this fragment is shaded in and its lane, nullptr when shaded on its own
+    const fragment_quad* quad = nullptr;
+    int lane = 0;
+
+    // Screen space derivatives of an interpolated attribute, e.g. ddx(&fragment_shader_payload::normal):
+    // the difference to the neighbouring lane of the quad along x / y, zero outside a quad.
+    template <typename T>
+    T ddx(T fragment_shader_payload::*attribute) const;
+    template <typename T>
+    T ddy(T fragment_shader_payload::*attribute) const;
+};
+
+/*
+ * Four fragments shaded together, like a GPU shades 2x2 pixel quads. Lane i is pixel
+ * (x + (i & 1), y + (i >> 1)). Lanes whose bit is clear in mask are helper lanes: outside
+ * the triangle or hidden, their attributes are extrapolated and they are shaded only so the
+ * other lanes can take differences with them; their color is thrown away.
+ * */
+struct fragment_quad
+{
+    std::array<fragment_shader_payload, 4> lanes;
+    int mask = 0;
+
+    // Fine derivatives of a value that every lane computed: the difference along the
+    // lane's row (ddx) or column (ddy) of the quad.
+    template <typename T>
+    static T ddx(const std::array<T, 4>& value, int lane)
+    {
+        int row = lane & 2;
+        return value[row + 1] - value[row];
+    }
+
+    template <typename T>
+    static T ddy(const std::array<T, 4>& value, int lane)
+    {
+        int column = lane & 1;
+        return value[column + 2] - value[column];
+    }
 };
 
+inline const uniform_block& get_uniforms(const fragment_shader_payload& payload)
+{
+    static const uniform_block defaults;
+    return payload.uniforms ? *payload.uniforms : defaults;
+}
+
+template <typename T>
+T fragment_shader_payload::ddx(T fragment_shader_payload::*attribute) const
+{
+    if (!quad)
+        return this->*attribute - this->*attribute;
+    int row = lane & 2;
+    return quad->lanes[row + 1].*attribute - quad->lanes[row].*attribute;
+}
+
+template <typename T>
+T fragment_shader_payload::ddy(T fragment_shader_payload::*attribute) const
+{
+    if (!quad)
+        return this->*attribute - this->*attribute;
+    int column = lane & 1;
+    return quad->lanes[column + 2].*attribute - quad->lanes[column].*attribute;
+}
+
 struct vertex_shader_payload
 {
     Eigen::Vector3f position;
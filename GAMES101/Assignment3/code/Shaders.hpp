@@ -0,0 +1,429 @@
+//
+// Transforms and shaders shared by the Rasterizer and rasterizer_bench targets.
+//
+
+#ifndef RASTERIZER_SHADERS_H
+#define RASTERIZER_SHADERS_H
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <eigen3/Eigen/Eigen>
+#include "global.hpp"
+#include "Shader.hpp"
+#include "Texture.hpp"
+
+// log2 of a normal float x > 0: the exponent comes from the float bits, the mantissa m is
+// shifted into [sqrt(1/2), sqrt(2)) and log2(m) = 2 / ln 2 * atanh((m - 1) / (m + 1)) uses four
+// terms of its series. Absolute error below 1e-7. No branches, so loops over it vectorize.
+inline float fast_log2(float x)
+{
+    int32_t bits;
+    std::memcpy(&bits, &x, 4);
+    // 0x3f3504f3 是 sqrt(1/2) 的位模式，减掉之后的指数部分就是 m 落在 [sqrt(1/2), sqrt(2)) 要除掉的 2 的幂
+    int32_t exponent = (bits - 0x3f3504f3) >> 23;
+    bits -= exponent << 23;
+    float m;
+    std::memcpy(&m, &bits, 4);
+    float s = (m - 1.0f) / (m + 1.0f), s2 = s * s;
+    return float(exponent) + 2.88539008f * s * (1.0f + s2 * (1.0f / 3 + s2 * (1.0f / 5 + s2 * (1.0f / 7))));
+}
+
+// 2^y: the integer part goes straight into the exponent bits, 2^f of the fraction comes from
+// a degree 5 Taylor series around f = 0.5. Relative error below 3e-6; 0 below 2^-126 and
+// saturates at 2^128.
+inline float fast_exp2(float y)
+{
+    // 下限 -127：偏移后的指数为 0，scale 的位模式就是 0.0f，不需要单独判断下溢
+    float clamped = std::fmin(std::fmax(y, -127.0f), 127.0f);
+    // 加上 127 之后非负，截断就是 floor，也正好是指数的偏移
+    int32_t biased = int32_t(clamped + 127.0f);
+    float g = (clamped - float(biased - 127) - 0.5f) * 0.693147181f;
+    float fraction = 1.41421356f * (1.0f + g * (1.0f + g * (0.5f + g * (1.0f / 6 + g * (1.0f / 24 + g * (1.0f / 120))))));
+    int32_t bits = biased << 23;
+    float scale;
+    std::memcpy(&scale, &bits, 4);
+    return fraction * scale;
+}
+
+// x^p for the specular term, in float; 0 for x <= 0
+inline float fast_pow(float x, float p)
+{
+    float result = fast_exp2(p * fast_log2(std::max(x, std::numeric_limits<float>::min())));
+    return x > 0.0f ? result : 0.0f;
+}
+
+inline Eigen::Matrix4f get_view_matrix(Eigen::Vector3f eye_pos)
+{
+    Eigen::Matrix4f view = Eigen::Matrix4f::Identity();
+
+    Eigen::Matrix4f translate;
+    translate << 1,0,0,-eye_pos[0],
+                 0,1,0,-eye_pos[1],
+                 0,0,1,-eye_pos[2],
+                 0,0,0,1;
+
+    view = translate*view;
+
+    return view;
+}
+
+inline Eigen::Matrix4f get_model_matrix(float angle)
+{
+    Eigen::Matrix4f rotation;
+    angle = angle * MY_PI / 180.f;
+    rotation << cos(angle), 0, sin(angle), 0,
+                0, 1, 0, 0,
+                -sin(angle), 0, cos(angle), 0,
+                0, 0, 0, 1;
+
+    Eigen::Matrix4f scale;
+    scale << 2.5, 0, 0, 0,
+              0, 2.5, 0, 0,
+              0, 0, 2.5, 0,
+              0, 0, 0, 1;
+
+    Eigen::Matrix4f translate;
+    translate << 1, 0, 0, 0,
+            0, 1, 0, 0,
+            0, 0, 1, 0,
+            0, 0, 0, 1;
+
+    return translate * rotation * scale;
+}
+
+inline Eigen::Matrix4f get_projection_matrix(float eye_fov, float aspect_ratio, float zNear, float zFar)
+{
+    // TODO: Use the same projection matrix from the previous assignments
+    Eigen::Matrix4f projection = Eigen::Matrix4f::Identity();
+
+    float t = abs(zNear) * tan(eye_fov * MY_PI / (180 * 2));
+    float r = aspect_ratio * t;
+    float l = -r;
+    float b = -t;
+    float n = -zNear;
+    float f = -zFar;
+    projection(0, 0) = 2 * n / (r - l);
+    projection(0, 2) = (l + r) / (l - r);
+    projection(1, 1) = 2 * n / (t - b);
+    projection(1, 2) = (b + t) / (b - t);
+    projection(2, 2) = (f + n) / (n - f);
+    projection(2, 3) = 2 * f * n / (f - n);
+    projection(3, 2) = 1.0;
+    projection(3, 3) = 0.0;
+
+    return projection;
+
+}
+
+inline Eigen::Vector3f vertex_shader(const vertex_shader_payload& payload)
+{
+    return payload.position;
+}
+
+inline Eigen::Vector3f normal_fragment_shader(const fragment_shader_payload& payload)
+{
+    // Eigen::Vector3f return_color = (payload.normal.head<3>().normalized() + Eigen::Vector3f(1.0f, 1.0f, 1.0f)) / 2.f;
+    // Eigen::Vector3f result;
+    // result << return_color.x() * 255, return_color.y() * 255, return_color.z() * 255;
+    // return result;
+        Eigen::Vector3f return_color = (payload.normal.head<3>().normalized() + Eigen::Vector3f(1.0f, 1.0f, 1.0f)) / 2.f;
+    // if (payload.texture)
+    // {
+    //     // TODO: Get the texture value at the texture coordinates of the current fragment
+    //     return_color = (payload.normal.head<3>().normalized()*255 + payload.texture->getColor(payload.tex_coords.x(), payload.tex_coords.y())) / 2.f;
+    //     Eigen::Vector3f result;
+    //     result << return_color.x(), return_color.y(), return_color.z();
+    //     return result;
+    // }
+    Eigen::Vector3f result;
+    result << return_color.x() * 255, return_color.y() * 255, return_color.z() * 255;
+    return result;
+}
+
+inline Eigen::Vector3f reflect(const Eigen::Vector3f& vec, const Eigen::Vector3f& axis)
+{
+    // axis是法线方向，vec是光线入射的方向
+    auto costheta = vec.dot(axis);
+    return (2 * costheta * axis - vec).normalized();
+}
+
+inline Eigen::Vector3f texture_fragment_shader(const fragment_shader_payload& payload)
+{
+    Eigen::Vector3f return_color = {0, 0, 0};
+    if (payload.texture)
+    {
+        // TODO: Get the texture value at the texture coordinates of the current fragment
+        float u = payload.tex_coords[0];
+        float v = payload.tex_coords[1];
+        // 按纹理设置的过滤方式采样，默认是最近邻，和 getColor(u, v) 一样
+        return_color = payload.texture->sample(u, v, payload.duv_dx, payload.duv_dy);
+        // return_color = payload.texture->getColorBilinear(u, v);
+
+    }
+    Eigen::Vector3f texture_color;
+    texture_color << return_color.x(), return_color.y(), return_color.z();
+
+    // 光源、材质和相机参数每次 draw 设置一次，不再每个像素重新构造
+    const uniform_block& uniforms = get_uniforms(payload);
+    Eigen::Vector3f kd = texture_color / 255.f;
+
+    Eigen::Vector3f color = texture_color;
+    Eigen::Vector3f point = payload.view_pos;
+    Eigen::Vector3f normal = payload.normal;
+
+    Eigen::Vector3f result_color = {0, 0, 0};
+
+    for (auto& light : uniforms.lights)
+    {
+        // TODO: For each light source in the code, calculate what the *ambient*, *diffuse*, and *specular* 
+        // components are. Then, accumulate that result on the *result_color* object.
+               // TODO: For each light source in the code, calculate what the *ambient*, *diffuse*, and *specular* 
+        Eigen::Vector3f r = light.position - point;
+        Eigen::Vector3f l = r.normalized();
+        Eigen::Vector3f v = (uniforms.eye_pos - point).normalized();
+        Eigen::Vector3f h = (l + v).normalized();
+        const Eigen::Vector3f& ambient = uniforms.ambient;
+        Eigen::Vector3f diffuse = kd.cwiseProduct(light.intensity) / (r.dot(r)) * std::max((float)0.0, normal.dot(l));
+        Eigen::Vector3f specular = uniforms.ks.cwiseProduct(light.intensity) / (r.dot(r)) * fast_pow(normal.dot(h), uniforms.p);
+        // components are. Then, accumulate that result on the *result_color* object.
+        
+        result_color = result_color + ambient + diffuse + specular; 
+    }
+
+    return result_color * 255.f;
+}
+
+inline Eigen::Vector3f phong_fragment_shader(const fragment_shader_payload& payload)
+{
+    // 光源、材质和相机参数每次 draw 设置一次，不再每个像素重新构造
+    const uniform_block& uniforms = get_uniforms(payload);
+    Eigen::Vector3f kd = payload.color;
+
+    Eigen::Vector3f color = payload.color;
+    Eigen::Vector3f point = payload.view_pos;
+    Eigen::Vector3f normal = payload.normal;
+
+    Eigen::Vector3f result_color = {0, 0, 0};
+
+    for (auto& light : uniforms.lights)
+    {
+        // TODO: For each light source in the code, calculate what the *ambient*, *diffuse*, and *specular* 
+        Eigen::Vector3f r = light.position - point;
+        Eigen::Vector3f l = r.normalized();
+        Eigen::Vector3f v = (uniforms.eye_pos - point).normalized();
+        Eigen::Vector3f h = (l + v).normalized();
+        const Eigen::Vector3f& ambient = uniforms.ambient;
+        Eigen::Vector3f diffuse = kd.cwiseProduct(light.intensity) / (r.dot(r)) * std::max((float)0.0, normal.normalized().dot(l));
+        Eigen::Vector3f specular = uniforms.ks.cwiseProduct(light.intensity) / (r.dot(r)) * fast_pow(normal.normalized().dot(h), uniforms.p);
+        // components are. Then, accumulate that result on the *result_color* object.
+        
+        result_color = result_color + ambient + diffuse + specular;  
+    }
+ 
+    return result_color * 255.f;
+
+} 
+
+
+
+
+
+// Displacement shading with the height at the fragment and its differences dU, dV over one
+// texel along u and v
+inline Eigen::Vector3f displacement_shade(const fragment_shader_payload& payload, float height, float dU, float dV)
+{
+    
+    // 光源、材质和相机参数每次 draw 设置一次，不再每个像素重新构造
+    const uniform_block& uniforms = get_uniforms(payload);
+    Eigen::Vector3f kd = payload.color;
+
+    Eigen::Vector3f color = payload.color; 
+    Eigen::Vector3f point = payload.view_pos;
+    Eigen::Vector3f normal = payload.normal;
+
+    float kn = 0.1;
+    
+    // TODO: Implement displacement mapping here
+    // Let n = normal = (x, y, z)
+    // Vector t = (x*y/sqrt(x*x+z*z),sqrt(x*x+z*z),z*y/sqrt(x*x+z*z))
+    // Vector b = n cross product t
+    // Matrix TBN = [t b n]
+    // dU = kh * kn * (h(u+1/w,v)-h(u,v))
+    // dV = kh * kn * (h(u,v+1/h)-h(u,v))
+    // Vector ln = (-dU, -dV, 1)
+    // Position p = p + kn * n * h(u,v)
+    // Normal n = normalize(TBN * ln)
+     float x = normal.x();
+    float y = normal.y();
+    float z = normal.z();
+    Eigen::Vector3f t = {x*y/sqrt(x*x+z*z),sqrt(x*x+z*z),z*y/sqrt(x*x+z*z)};
+    Eigen::Vector3f b = normal.cross(t);
+    Eigen::Matrix3f TBN;
+    TBN << t.x(), b.x(), normal.x(),
+                    t.y(), b.y(), normal.y(),
+                    t.z(), b.z(), normal.z();
+    Eigen::Vector3f ln = {-dU, -dV, 1};
+    point = point + kn * normal * height;
+    normal = (TBN * ln).normalized();
+
+
+
+    Eigen::Vector3f result_color = {0, 0, 0};
+
+    for (auto& light : uniforms.lights)
+    {
+        // TODO: For each light source in the code, calculate what the *ambient*, *diffuse*, and *specular* 
+        Eigen::Vector3f r = light.position - point;
+        Eigen::Vector3f l = r.normalized();
+        Eigen::Vector3f v = (uniforms.eye_pos - point).normalized();
+        Eigen::Vector3f h = (l + v).normalized();
+        const Eigen::Vector3f& ambient = uniforms.ambient;
+        Eigen::Vector3f diffuse = kd.cwiseProduct(light.intensity) / (r.dot(r)) * std::max((float)0, normal.dot(l));
+        Eigen::Vector3f specular = uniforms.ks.cwiseProduct(light.intensity) / (r.dot(r)) * fast_pow(normal.dot(h), uniforms.p);
+        // components are. Then, accumulate that result on the *result_color* object.
+        result_color = result_color + ambient + diffuse + specular; 
+
+
+    }
+
+    return result_color * 255.f;
+}
+
+
+inline Eigen::Vector3f displacement_fragment_shader(const fragment_shader_payload& payload)
+{
+    float kh = 0.2, kn = 0.1;
+    float u = payload.tex_coords.x();
+    float v = payload.tex_coords.y();
+    float w = payload.texture->width;
+    float h = payload.texture->height;
+    // 高度图的三个采样一次取完
+    Eigen::Vector2f uv[3] = {{u, v}, {float(u + 1.0 / w), v}, {u, float(v + 1.0 / h)}};
+    Eigen::Vector3f height_map[3];
+    payload.texture->getColors(uv, 3, height_map);
+    float dU = kh * kn * (height_map[1].norm() - height_map[0].norm());
+    float dV = kh * kn * (height_map[2].norm() - height_map[0].norm());
+    return displacement_shade(payload, height_map[0].norm(), dU, dV);
+}
+
+// Bump shading with the height differences dU, dV over one texel along u and v
+inline Eigen::Vector3f bump_shade(const fragment_shader_payload& payload, float dU, float dV)
+{
+    
+    Eigen::Vector3f kd = payload.color;
+
+    Eigen::Vector3f color = payload.color; 
+    Eigen::Vector3f point = payload.view_pos;
+    Eigen::Vector3f normal = payload.normal;
+
+
+    // TODO: Implement bump mapping here
+    // Let n = normal = (x, y, z)
+    // Vector t = (x*y/sqrt(x*x+z*z),sqrt(x*x+z*z),z*y/sqrt(x*x+z*z))
+    // Vector b = n cross product t
+    // Matrix TBN = [t b n]
+    // dU = kh * kn * (h(u+1/w,v)-h(u,v))
+    // dV = kh * kn * (h(u,v+1/h)-h(u,v))
+    // Vector ln = (-dU, -dV, 1)
+    // Normal n = normalize(TBN * ln)
+    float x = normal.x();
+    float y = normal.y();
+    float z = normal.z();
+    Eigen::Vector3f t = {-x*y/sqrt(x*x+z*z),sqrt(x*x+z*z),-z*y/sqrt(x*x+z*z)};
+    Eigen::Vector3f b = normal.cross(t);
+    Eigen::Matrix3f TBN;
+    TBN << t.x(), b.x(), normal.x(),
+                    t.y(), b.y(), normal.y(),
+                    t.z(), b.z(), normal.z();
+    Eigen::Vector3f ln = {-dU, -dV, 1};
+    normal = (TBN * ln).normalized();
+    
+
+
+    Eigen::Vector3f result_color = {0, 0, 0};
+    result_color = normal;
+
+    return result_color * 255.f;
+}
+
+inline Eigen::Vector3f bump_fragment_shader(const fragment_shader_payload& payload)
+{
+    float kh = 0.2, kn = 0.1;
+    float u = payload.tex_coords.x();
+    float v = payload.tex_coords.y();
+    float w = payload.texture->width;
+    float h = payload.texture->height;
+    // 高度图的三个采样一次取完
+    Eigen::Vector2f uv[3] = {{u, v}, {float(u + 1.0 / w), v}, {u, float(v + 1.0 / h)}};
+    Eigen::Vector3f height_map[3];
+    payload.texture->getColors(uv, 3, height_map);
+    float dU = kh * kn * (height_map[1].norm() - height_map[0].norm());
+    float dV = kh * kn * (height_map[2].norm() - height_map[0].norm());
+    return bump_shade(payload, dU, dV);
+}
+
+// Heights of the four lanes of a quad, one fetch per lane
+inline std::array<float, 4> quad_heights(const fragment_quad& quad)
+{
+    Eigen::Vector2f uv[4];
+    for (int lane = 0; lane < 4; ++lane)
+        uv[lane] = quad.lanes[lane].tex_coords;
+    Eigen::Vector3f height_map[4];
+    quad.lanes[0].texture->getColors(uv, 4, height_map);
+    return {height_map[0].norm(), height_map[1].norm(), height_map[2].norm(), height_map[3].norm()};
+}
+
+// Height differences over one texel along u and v (dh/du / width, dh/dv / height) of a lane,
+// from the screen space differences of the heights across the quad:
+// [dh/dx dh/dy] = [dh/du dh/dv] * [duv_dx duv_dy]
+inline Eigen::Vector2f texel_height_differences(const fragment_quad& quad, const std::array<float, 4>& height, int lane)
+{
+    const fragment_shader_payload& payload = quad.lanes[lane];
+    Eigen::Matrix2f jacobian;
+    jacobian.col(0) = payload.duv_dx;
+    jacobian.col(1) = payload.duv_dy;
+    if (std::abs(jacobian.determinant()) < 1e-12f)
+        return Eigen::Vector2f::Zero();
+    Eigen::Vector2f screen(fragment_quad::ddx(height, lane), fragment_quad::ddy(height, lane));
+    Eigen::Vector2f gradient = jacobian.transpose().inverse() * screen;
+    return {gradient.x() / payload.texture->width, gradient.y() / payload.texture->height};
+}
+
+// Quad versions of the bump and displacement shaders: the height gradient comes from the
+// differences between the lanes instead of two extra fetches per pixel.
+inline std::array<Eigen::Vector3f, 4> bump_fragment_shader_quad(const fragment_quad& quad)
+{
+    float kh = 0.2, kn = 0.1;
+    std::array<float, 4> height = quad_heights(quad);
+    std::array<Eigen::Vector3f, 4> result;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        if (!(quad.mask & (1 << lane)))
+            continue;
+        Eigen::Vector2f d = kh * kn * texel_height_differences(quad, height, lane);
+        result[lane] = bump_shade(quad.lanes[lane], d.x(), d.y());
+    }
+    return result;
+}
+
+inline std::array<Eigen::Vector3f, 4> displacement_fragment_shader_quad(const fragment_quad& quad)
+{
+    float kh = 0.2, kn = 0.1;
+    std::array<float, 4> height = quad_heights(quad);
+    std::array<Eigen::Vector3f, 4> result;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        if (!(quad.mask & (1 << lane)))
+            continue;
+        Eigen::Vector2f d = kh * kn * texel_height_differences(quad, height, lane);
+        result[lane] = displacement_shade(quad.lanes[lane], height[lane], d.x(), d.y());
+    }
+    return result;
+}
+
+#endif //RASTERIZER_SHADERS_H
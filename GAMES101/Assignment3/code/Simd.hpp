@@ -0,0 +1,109 @@
+//
+// Small SIMD wrapper for the block rasterizer: 8 lanes with AVX2, 4 lanes with SSE2,
+// and a one lane scalar fallback everywhere else.
+//
+
+#ifndef RASTERIZER_SIMD_H
+#define RASTERIZER_SIMD_H
+
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace rst
+{
+namespace simd
+{
+#if defined(__AVX2__)
+    constexpr int width = 8;
+
+    struct vfloat
+    {
+        __m256 v;
+    };
+
+    inline vfloat set1(float a) { return {_mm256_set1_ps(a)}; }
+    inline vfloat load(const float* p) { return {_mm256_loadu_ps(p)}; }
+    inline void store(float* p, vfloat a) { _mm256_storeu_ps(p, a.v); }
+    inline vfloat lane_index() { return {_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)}; }
+    inline vfloat operator+(vfloat a, vfloat b) { return {_mm256_add_ps(a.v, b.v)}; }
+    inline vfloat operator*(vfloat a, vfloat b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    inline vfloat operator/(vfloat a, vfloat b) { return {_mm256_div_ps(a.v, b.v)}; }
+
+    // Bit k is set when lane k of a is less than lane k of b.
+    inline int less(vfloat a, vfloat b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+
+    // Bit k is set when e[i] + offset[i][k] >= 0 for all three edges.
+    inline int coverage(const int64_t e[3], const int64_t offset[3][width])
+    {
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        for (int i = 0; i < 3; ++i)
+        {
+            __m256i base = _mm256_set1_epi64x(e[i]);
+            lo = _mm256_or_si256(lo, _mm256_add_epi64(base, _mm256_loadu_si256((const __m256i*)&offset[i][0])));
+            hi = _mm256_or_si256(hi, _mm256_add_epi64(base, _mm256_loadu_si256((const __m256i*)&offset[i][4])));
+        }
+        int outside = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) | (_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4);
+        return ~outside & 0xff;
+    }
+#elif defined(__SSE2__)
+    constexpr int width = 4;
+
+    struct vfloat
+    {
+        __m128 v;
+    };
+
+    inline vfloat set1(float a) { return {_mm_set1_ps(a)}; }
+    inline vfloat load(const float* p) { return {_mm_loadu_ps(p)}; }
+    inline void store(float* p, vfloat a) { _mm_storeu_ps(p, a.v); }
+    inline vfloat lane_index() { return {_mm_setr_ps(0, 1, 2, 3)}; }
+    inline vfloat operator+(vfloat a, vfloat b) { return {_mm_add_ps(a.v, b.v)}; }
+    inline vfloat operator*(vfloat a, vfloat b) { return {_mm_mul_ps(a.v, b.v)}; }
+    inline vfloat operator/(vfloat a, vfloat b) { return {_mm_div_ps(a.v, b.v)}; }
+
+    inline int less(vfloat a, vfloat b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+
+    inline int coverage(const int64_t e[3], const int64_t offset[3][width])
+    {
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        for (int i = 0; i < 3; ++i)
+        {
+            __m128i base = _mm_set1_epi64x(e[i]);
+            lo = _mm_or_si128(lo, _mm_add_epi64(base, _mm_loadu_si128((const __m128i*)&offset[i][0])));
+            hi = _mm_or_si128(hi, _mm_add_epi64(base, _mm_loadu_si128((const __m128i*)&offset[i][2])));
+        }
+        int outside = _mm_movemask_pd(_mm_castsi128_pd(lo)) | (_mm_movemask_pd(_mm_castsi128_pd(hi)) << 2);
+        return ~outside & 0xf;
+    }
+#else
+    constexpr int width = 1;
+
+    struct vfloat
+    {
+        float v;
+    };
+
+    inline vfloat set1(float a) { return {a}; }
+    inline vfloat load(const float* p) { return {*p}; }
+    inline void store(float* p, vfloat a) { *p = a.v; }
+    inline vfloat lane_index() { return {0.0f}; }
+    inline vfloat operator+(vfloat a, vfloat b) { return {a.v + b.v}; }
+    inline vfloat operator*(vfloat a, vfloat b) { return {a.v * b.v}; }
+    inline vfloat operator/(vfloat a, vfloat b) { return {a.v / b.v}; }
+
+    inline int less(vfloat a, vfloat b) { return a.v < b.v ? 1 : 0; }
+
+    inline int coverage(const int64_t e[3], const int64_t offset[3][width])
+    {
+        return ((e[0] + offset[0][0]) | (e[1] + offset[1][0]) | (e[2] + offset[2][0])) >= 0 ? 1 : 0;
+    }
+#endif
+}
+}
+
+#endif //RASTERIZER_SIMD_H
@@ -2,3 +2,116 @@
 // Created by LEI XU on 4/27/19.
 //
 
+#include "Texture.hpp"
+#include <algorithm>
+#include <cmath>
+
+void Texture::build_mipmaps()
+{
+    mip_levels.clear();
+    mip_levels.emplace_back(width, height);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            const cv::Vec3b& c = image_data.at<cv::Vec3b>(y, x);
+            mip_levels[0].at(x, y) = Eigen::Vector3f(c[0], c[1], c[2]);
+        }
+
+    while (mip_levels.back().width > 1 || mip_levels.back().height > 1)
+    {
+        const level& src = mip_levels.back();
+        level dst(std::max(1, src.width / 2), std::max(1, src.height / 2));
+        // 2x2 box filter; for odd sizes the last row/column of src is dropped
+        for (int y = 0; y < dst.height; ++y)
+        {
+            int y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+            for (int x = 0; x < dst.width; ++x)
+            {
+                int x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+                dst.at(x, y) = (src.at(x0, y0) + src.at(x1, y0) + src.at(x0, y1) + src.at(x1, y1)) / 4.0f;
+            }
+        }
+        mip_levels.push_back(std::move(dst));
+    }
+}
+
+float Texture::getLod(const Eigen::Vector2f& duv_dx, const Eigen::Vector2f& duv_dy) const
+{
+    float lx = std::hypot(duv_dx.x() * width, duv_dx.y() * height);
+    float ly = std::hypot(duv_dy.x() * width, duv_dy.y() * height);
+    return std::log2(std::max({lx, ly, 1e-8f}));
+}
+
+void Texture::fetchBilinear(int level, float u, float v, Eigen::Vector3f footprint[4], float& s, float& t) const
+{
+    const Texture::level& img = mip_levels[level];
+    // texel centers are at half integers
+    float x = std::clamp(u, 0.0f, 1.0f) * img.width - 0.5f;
+    float y = (1 - std::clamp(v, 0.0f, 1.0f)) * img.height - 0.5f;
+    int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+    s = x - x0;
+    t = y - y0;
+    int x1 = std::min(x0 + 1, img.width - 1), y1 = std::min(y0 + 1, img.height - 1);
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+
+    footprint[0] = img.at(x0, y0);
+    footprint[1] = img.at(x1, y0);
+    footprint[2] = img.at(x0, y1);
+    footprint[3] = img.at(x1, y1);
+}
+
+Eigen::Vector3f Texture::getColorLevel(int level, float u, float v) const
+{
+    Eigen::Vector3f c[4];
+    float s, t;
+    fetchBilinear(level, u, v, c, s, t);
+    Eigen::Vector3f top = c[0] + s * (c[1] - c[0]);
+    Eigen::Vector3f bottom = c[2] + s * (c[3] - c[2]);
+    return top + t * (bottom - top);
+}
+
+Eigen::Vector3f Texture::getColorTrilinear(float u, float v, float lod) const
+{
+    lod = std::clamp(lod, 0.0f, float(levels() - 1));
+    int level = (int)lod;
+    float frac = lod - level;
+    Eigen::Vector3f fine = getColorLevel(level, u, v);
+    if (frac == 0)
+        return fine;
+    return fine + frac * (getColorLevel(level + 1, u, v) - fine);
+}
+
+Eigen::Vector3f Texture::getColorAnisotropic(float u, float v, const Eigen::Vector2f& duv_dx, const Eigen::Vector2f& duv_dy) const
+{
+    float lx = std::hypot(duv_dx.x() * width, duv_dx.y() * height);
+    float ly = std::hypot(duv_dy.x() * width, duv_dy.y() * height);
+    float major = std::max(lx, ly), minor = std::min(lx, ly);
+    const Eigen::Vector2f& axis = lx > ly ? duv_dx : duv_dy;
+
+    // the footprint is covered by n probes along the major axis, each one minor wide
+    int n = std::clamp((int)std::ceil(major / std::max(minor, 1e-8f)), 1, max_anisotropy);
+    float lod = std::log2(std::max(major / n, 1e-8f));
+    Eigen::Vector3f color = Eigen::Vector3f::Zero();
+    for (int i = 0; i < n; ++i)
+    {
+        float offset = (i + 0.5f) / n - 0.5f;
+        color += getColorTrilinear(u + offset * axis.x(), v + offset * axis.y(), lod);
+    }
+    return color / float(n);
+}
+
+Eigen::Vector3f Texture::sample(float u, float v, const Eigen::Vector2f& duv_dx, const Eigen::Vector2f& duv_dy) const
+{
+    switch (filter)
+    {
+        case Filter::Bilinear:
+            return getColorLevel(0, u, v);
+        case Filter::Trilinear:
+            return getColorTrilinear(u, v, getLod(duv_dx, duv_dy));
+        case Filter::Anisotropic:
+            return getColorAnisotropic(u, v, duv_dx, duv_dy);
+        default:
+            return getColor(u, v);
+    }
+}
@@ -7,11 +7,48 @@
 #include "global.hpp"
 #include <eigen3/Eigen/Eigen>
 #include <opencv2/opencv.hpp>
+#include <vector>
+
 class Texture{
 private:
     cv::Mat image_data;
 
+    /*
+     * One mip level in the sampling format: texels are converted to float once at load
+     * time and stored in 4x4 tiles, 16 texels one after another, the tiles in row major
+     * order. A bilinear footprint then mostly sits in one tile instead of two image rows
+     * that are a whole row pitch apart.
+     * */
+    struct level
+    {
+        static constexpr int tile = 4;
+        int width, height, tiles_x;
+        std::vector<Eigen::Vector3f> texels;
+
+        level(int w, int h) : width(w), height(h), tiles_x((w + tile - 1) / tile),
+                              texels(size_t(tiles_x) * ((h + tile - 1) / tile) * tile * tile) {}
+
+        // x and y must be inside the level
+        Eigen::Vector3f& at(int x, int y)
+        {
+            return texels[((y / tile) * tiles_x + x / tile) * (tile * tile) + (y % tile) * tile + x % tile];
+        }
+        const Eigen::Vector3f& at(int x, int y) const { return const_cast<level*>(this)->at(x, y); }
+    };
+    // mip_levels[0] is the full image, every next level is half the size, down to 1x1
+    std::vector<level> mip_levels;
+
+    void build_mipmaps();
+
 public:
+    enum class Filter
+    {
+        Nearest,     // getColor()
+        Bilinear,    // bilinear in the base level
+        Trilinear,   // bilinear in the two closest mip levels
+        Anisotropic  // several trilinear probes along the longer axis of the pixel footprint
+    };
+
     Texture(const std::string& name)
     {
         // for (auto& t:name)
@@ -26,11 +63,38 @@ public:
         cv::cvtColor(image_data, image_data, cv::COLOR_RGB2BGR);
         width = image_data.cols;
         height = image_data.rows;
+        build_mipmaps();
     }
 
     int width, height;
+    Filter filter = Filter::Nearest;
+    int max_anisotropy = 8;
+
+    Eigen::Vector3f getColor(float u, float v) const
+    {
+
+        if(u<0) u=0;
+        if(v<0) v=0;
+        if(u>1) u=1;
+        if(v>1) v=1;
+
+        // u = 1 或 v = 0 时会落到图像外面一个像素，夹到最后一行/列
+        int u_img = std::min(int(u * width), width - 1);
+        int v_img = std::min(int((1 - v) * height), height - 1);
+
+        return mip_levels[0].at(u_img, v_img);
+    }
+
+    // Nearest lookups of count texture coordinates in one call, e.g. the height map
+    // differences of the bump and displacement shaders.
+    void getColors(const Eigen::Vector2f* uv, int count, Eigen::Vector3f* colors) const
+    {
+        for (int i = 0; i < count; ++i)
+            colors[i] = getColor(uv[i].x(), uv[i].y());
+    }
 
-    Eigen::Vector3f getColor(float u, float v)
+    // The original lookup straight from the cv::Mat, kept to compare against
+    Eigen::Vector3f getColorMat(float u, float v)
     {
 
         if(u<0) u=0;
@@ -78,5 +142,19 @@ public:
         return Eigen::Vector3f(color[0], color[1], color[2]);
     }
 
+    // Filtered lookup with `filter`. duv_dx and duv_dy are the changes of (u, v) from one
+    // pixel to the next on screen; they choose the mip level.
+    Eigen::Vector3f sample(float u, float v, const Eigen::Vector2f& duv_dx, const Eigen::Vector2f& duv_dy) const;
+
+    int levels() const { return (int)mip_levels.size(); }
+    // log2 of the number of texels one pixel step covers along its longer axis
+    float getLod(const Eigen::Vector2f& duv_dx, const Eigen::Vector2f& duv_dy) const;
+    // The four texels around (u, v) in one mip level and the bilinear weights between them:
+    // footprint = {(x0, y0), (x1, y0), (x0, y1), (x1, y1)}, s along x, t along y.
+    void fetchBilinear(int level, float u, float v, Eigen::Vector3f footprint[4], float& s, float& t) const;
+    // Bilinear lookup in one mip level, clamped to the edges
+    Eigen::Vector3f getColorLevel(int level, float u, float v) const;
+    Eigen::Vector3f getColorTrilinear(float u, float v, float lod) const;
+    Eigen::Vector3f getColorAnisotropic(float u, float v, const Eigen::Vector2f& duv_dx, const Eigen::Vector2f& duv_dy) const;
 };
 #endif //RASTERIZER_TEXTURE_H
@@ -0,0 +1,863 @@
+// Headless benchmark: renders N frames of a rotating model without any window and prints
+// per-stage times, throughput and frame time percentiles as JSON.
+//
+//   rasterizer_bench [--model spot|rock|sphere|grid] [--triangles N] [--shader phong|normal|texture|bump|displacement]
+//                    [--width W] [--height H] [--frames N] [--warmup N] [--threads N]
+//                    [--path indexed|list] [--deferred] [--simd] [--models DIR] [--output FILE]
+//                    [--filter nearest|bilinear|trilinear|aniso] [--mode MODE]
+//
+// --mode frames, the default, is the JSON report above. The other modes render one still frame
+// and print a comparison as text:
+//   texture      cv::Mat against tiled texel fetches
+//   shaders      std::function against compile-time shader binding, for every shader
+//   scaling      1 to N threads, checked against the single-threaded frame
+//   vertex       vertex stage of the triangle list against the indexed draw
+//   setup_cache  triangle list without and with a registered mesh handle, over a full turn
+//   export       convertTo + cvtColor against output_image(), and imwrite against image_writer
+//   quad         per-pixel against 2x2 quad shading
+//   uniform      std::pow against fast_pow, and the phong and texture shaders
+//   hiz          hierarchical z off and on
+//   shading      forward against deferred shading
+//   depth        every depth format at 1080p and 4K
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <filesystem>
+#include <omp.h>
+
+#include "global.hpp"
+#include "rasterizer.hpp"
+#include "Shader.hpp"
+#include "Texture.hpp"
+#include "OBJ_Loader.h"
+#include "Shaders.hpp"
+
+// Every heap allocation of the process goes through the replacements below, so the frame
+// loop can count them: all forms of new and delete, the array, nothrow and over-aligned ones
+// included. They stay out of line; inlined into a caller, GCC pairs the new with the free()
+// inside delete and warns about a mismatch.
+static std::atomic<long> allocations{0};
+
+static void* counted_alloc(std::size_t size, std::size_t alignment) noexcept
+{
+    ++allocations;
+    size = std::max<std::size_t>(size, 1);
+    if (alignment <= alignof(std::max_align_t))
+        return std::malloc(size);
+    // aligned_alloc wants the size to be a multiple of the alignment
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void* counted_alloc_or_throw(std::size_t size, std::size_t alignment)
+{
+    if (void* p = counted_alloc(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new(std::size_t size) { return counted_alloc_or_throw(size, 0); }
+[[gnu::noinline]] void* operator new[](std::size_t size) { return counted_alloc_or_throw(size, 0); }
+[[gnu::noinline]] void* operator new(std::size_t size, std::align_val_t a) { return counted_alloc_or_throw(size, std::size_t(a)); }
+[[gnu::noinline]] void* operator new[](std::size_t size, std::align_val_t a) { return counted_alloc_or_throw(size, std::size_t(a)); }
+[[gnu::noinline]] void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, 0); }
+[[gnu::noinline]] void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, 0); }
+[[gnu::noinline]] void* operator new(std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept { return counted_alloc(size, std::size_t(a)); }
+[[gnu::noinline]] void* operator new[](std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept { return counted_alloc(size, std::size_t(a)); }
+
+// malloc and aligned_alloc memory are both released with free()
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete[](void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+
+struct mesh
+{
+    std::vector<Eigen::Vector3f> positions, normals, colors;
+    std::vector<Eigen::Vector2f> texcoords;
+    std::vector<Eigen::Vector3i> indices;
+
+    void add_vertex(const Eigen::Vector3f& p, const Eigen::Vector3f& n, const Eigen::Vector2f& uv)
+    {
+        positions.push_back(p);
+        normals.push_back(n);
+        texcoords.push_back(uv);
+        colors.emplace_back(148, 121.0, 92.0);
+    }
+};
+
+// Same vertex deduplication as main.cpp
+static mesh load_obj(const std::string& path)
+{
+    objl::Loader loader;
+    if (!loader.LoadFile(path))
+        throw std::runtime_error("cannot load " + path);
+
+    mesh m;
+    std::map<std::array<float, 8>, int> vertex_ids;
+    for (auto& loaded : loader.LoadedMeshes)
+    {
+        for (int i = 0; i + 2 < (int)loaded.Vertices.size(); i += 3)
+        {
+            Eigen::Vector3i tri;
+            for (int j = 0; j < 3; j++)
+            {
+                const objl::Vertex& vert = loaded.Vertices[i + j];
+                std::array<float, 8> key = {vert.Position.X, vert.Position.Y, vert.Position.Z,
+                                            vert.Normal.X, vert.Normal.Y, vert.Normal.Z,
+                                            vert.TextureCoordinate.X, vert.TextureCoordinate.Y};
+                auto inserted = vertex_ids.emplace(key, (int)m.positions.size());
+                if (inserted.second)
+                    m.add_vertex({key[0], key[1], key[2]}, {key[3], key[4], key[5]}, {key[6], key[7]});
+                tri[j] = inserted.first->second;
+            }
+            m.indices.push_back(tri);
+        }
+    }
+    return m;
+}
+
+// UV sphere of radius 1 with about `triangles` triangles
+static mesh make_sphere(long triangles)
+{
+    int stacks = std::max(2, (int)std::sqrt(triangles / 4.0));
+    int slices = std::max(3, (int)(triangles / (2.0 * stacks)));
+    mesh m;
+    for (int i = 0; i <= stacks; ++i)
+    {
+        float v = float(i) / stacks;
+        float theta = v * MY_PI;
+        for (int j = 0; j <= slices; ++j)
+        {
+            float u = float(j) / slices;
+            float phi = u * 2 * MY_PI;
+            Eigen::Vector3f n(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            m.add_vertex(n, n, {u, 1 - v});
+        }
+    }
+    for (int i = 0; i < stacks; ++i)
+        for (int j = 0; j < slices; ++j)
+        {
+            int a = i * (slices + 1) + j, b = a + slices + 1;
+            m.indices.emplace_back(a, a + 1, b);
+            m.indices.emplace_back(a + 1, b + 1, b);
+        }
+    return m;
+}
+
+// Rippled square in the xy plane, 2 x cells x cells triangles
+static mesh make_grid(long triangles)
+{
+    int cells = std::max(1, (int)std::sqrt(triangles / 2.0));
+    mesh m;
+    for (int i = 0; i <= cells; ++i)
+        for (int j = 0; j <= cells; ++j)
+        {
+            float u = float(j) / cells, v = float(i) / cells;
+            float x = 2 * u - 1, y = 2 * v - 1;
+            float z = 0.05f * std::sin(8 * x) * std::cos(8 * y);
+            Eigen::Vector3f n(-0.4f * std::cos(8 * x) * std::cos(8 * y), 0.4f * std::sin(8 * x) * std::sin(8 * y), 1);
+            m.add_vertex({x, y, z}, n.normalized(), {u, v});
+        }
+    for (int i = 0; i < cells; ++i)
+        for (int j = 0; j < cells; ++j)
+        {
+            int a = i * (cells + 1) + j, b = a + cells + 1;
+            m.indices.emplace_back(a, a + 1, b + 1);
+            m.indices.emplace_back(a, b + 1, b);
+        }
+    return m;
+}
+
+// Nearest-rank percentile of values, p in [0, 100]
+static double percentile(std::vector<double> values, double p)
+{
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+    return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// 纹理读取的微基准：原来直接读 cv::Mat 的路径和转换好的分块浮点纹理，随机访问和按行连续访问各测一次
+static void benchmark_texture(Texture& texture)
+{
+    const int count = 1 << 20;
+    std::vector<Eigen::Vector2f> random_uv(count), coherent_uv(count);
+    std::mt19937 rng(101);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    for (int i = 0; i < count; ++i)
+    {
+        random_uv[i] = {dist(rng), dist(rng)};
+        // 1024 x 1024 的扫描线，相邻像素在纹理上相距半个纹素
+        coherent_uv[i] = {(i % 1024) / 1024.0f * 0.999f, (i / 1024) / 1024.0f * 0.999f};
+    }
+
+    auto ns_per_fetch = [&](const std::vector<Eigen::Vector2f>& uvs, auto&& fetch) {
+        double best = 1e30;
+        float checksum = 0;
+        for (int run = 0; run < 5; ++run)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (const auto& uv : uvs)
+                checksum += fetch(uv.x(), uv.y()).x();
+            auto stop = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::nano>(stop - start).count() / uvs.size());
+        }
+        if (checksum == -1)
+            std::cout << checksum;
+        return best;
+    };
+
+    for (auto* pattern : {&random_uv, &coherent_uv})
+    {
+        const char* name = pattern == &random_uv ? "random  " : "coherent";
+        double mat_nearest = ns_per_fetch(*pattern, [&](float u, float v) { return texture.getColorMat(u, v); });
+        double tiled_nearest = ns_per_fetch(*pattern, [&](float u, float v) { return texture.getColor(u, v); });
+        double mat_bilinear = ns_per_fetch(*pattern, [&](float u, float v) { return texture.getColorBilinear(u, v); });
+        double tiled_bilinear = ns_per_fetch(*pattern, [&](float u, float v) { return texture.getColorLevel(0, u, v); });
+        std::cout << name << "  nearest  cv::Mat: " << mat_nearest << " ns  tiled: " << tiled_nearest
+                  << " ns    bilinear  cv::Mat: " << mat_bilinear << " ns  tiled: " << tiled_bilinear << " ns\n";
+    }
+}
+
+// 高光指数的微基准：std::pow 和 fast_pow 在 [0, 1] 上各算 1M 次，取最快的一次，并给出最大误差
+static void benchmark_pow(float p)
+{
+    const int count = 1 << 20;
+    std::vector<float> x(count);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    for (auto& v : x)
+        v = dist(rng);
+
+    auto ns_per_call = [&](auto&& power) {
+        double best = 1e30;
+        float checksum = 0;
+        for (int run = 0; run < 5; ++run)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (float v : x)
+                checksum += power(v);
+            auto stop = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::nano>(stop - start).count() / count);
+        }
+        if (checksum == -1)
+            std::cout << checksum;
+        return best;
+    };
+
+    double std_ns = ns_per_call([p](float v) { return std::pow(v, p); });
+    double fast_ns = ns_per_call([p](float v) { return fast_pow(v, p); });
+    float max_abs = 0, max_rel = 0;
+    for (float v : x)
+    {
+        float exact = std::pow(v, p), approx = fast_pow(v, p);
+        max_abs = std::max(max_abs, std::abs(exact - approx));
+        if (exact > 1e-30f)
+            max_rel = std::max(max_rel, std::abs(exact - approx) / exact);
+    }
+    std::cout << "pow(x, " << p << ")  std::pow: " << std_ns << " ns  fast_pow: " << fast_ns
+              << " ns  max abs error: " << max_abs << "  max rel error: " << max_rel << '\n';
+}
+
+// 同一个着色器分别走 std::function 路径和模板路径，两条路径交替渲染，各取最快的一次
+template <typename Shader>
+static void benchmark_shader(rst::rasterizer& r, const std::vector<Triangle>& TriangleList, const std::string& name, const Shader& shader)
+{
+    auto time_ms = [&](auto&& draw) {
+        r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+        auto start = std::chrono::steady_clock::now();
+        draw();
+        auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(stop - start).count();
+    };
+
+    r.set_fragment_shader(shader);
+    double runtime_ms = 1e30, static_ms = 1e30;
+    for (int run = 0; run < 20; ++run)
+    {
+        runtime_ms = std::min(runtime_ms, time_ms([&] { r.draw(TriangleList); r.resolve(); }));
+        static_ms = std::min(static_ms, time_ms([&] { r.draw(TriangleList, shader); r.resolve(); }));
+    }
+
+    std::vector<Eigen::Vector3f> reference = r.frame_buffer();
+    time_ms([&] { r.draw(TriangleList); r.resolve(); });
+    bool identical = std::equal(reference.begin(), reference.end(), r.frame_buffer().begin());
+
+    std::cout << name << "  std::function: " << runtime_ms << " ms  template: " << static_ms
+              << " ms  speedup: " << runtime_ms / static_ms << (identical ? "" : "  (MISMATCH)") << '\n';
+}
+
+// What the comparison modes of --mode render: one still frame of the mesh at the starting
+// angle of the Rasterizer program, with the bench's shader, texture and path.
+struct bench_scene
+{
+    rst::rasterizer& r;
+    const mesh& m;
+    const std::vector<Triangle>& triangles;
+    rst::mesh_handle static_mesh;
+    rst::pos_buf_id pos_id;
+    rst::ind_buf_id ind_id;
+    rst::col_buf_id col_id;
+    rst::nor_buf_id nor_id;
+    rst::tex_buf_id tex_id;
+    bool list, deferred;
+    std::string texture_path;
+    Texture::Filter filter;
+    std::function<Eigen::Vector3f(const fragment_shader_payload&)> shader;
+    rst::quad_fragment_shader_fn quad_shader;
+    Eigen::Vector3f eye_pos;
+    int width, height;
+    float angle = 140.0f;
+
+    // 一帧：按索引或按三角形列表绘制，延迟着色时再做一次 resolve
+    void draw_frame()
+    {
+        if (list)
+            r.draw(triangles, static_mesh);
+        else
+            r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle, nor_id, tex_id);
+        r.resolve();
+    }
+};
+
+static void mode_texture(bench_scene& scene)
+{
+    Texture texture(scene.texture_path);
+    benchmark_texture(texture);
+}
+
+static void mode_shaders(bench_scene& scene)
+{
+    rst::rasterizer& r = scene.r;
+    benchmark_shader(r, scene.triangles, "normal", [](const fragment_shader_payload& p) { return normal_fragment_shader(p); });
+    benchmark_shader(r, scene.triangles, "phong", [](const fragment_shader_payload& p) { return phong_fragment_shader(p); });
+    benchmark_shader(r, scene.triangles, "texture", [](const fragment_shader_payload& p) { return texture_fragment_shader(p); });
+    benchmark_shader(r, scene.triangles, "bump", [](const fragment_shader_payload& p) { return bump_fragment_shader(p); });
+    benchmark_shader(r, scene.triangles, "displacement", [](const fragment_shader_payload& p) { return displacement_fragment_shader(p); });
+    r.set_fragment_shader(scene.shader);
+}
+
+static void mode_scaling(bench_scene& scene)
+{
+    rst::rasterizer& r = scene.r;
+    // 用1~N个线程渲染同一帧，统计耗时并检查结果与单线程完全一致
+    std::vector<Eigen::Vector3f> reference;
+    double serial_ms = 0;
+    for (int threads = 1; threads <= omp_get_max_threads(); ++threads)
+    {
+        r.set_num_threads(threads);
+        double best_ms = 1e30;
+        for (int run = 0; run < 5; ++run)
+        {
+            r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+            auto start = std::chrono::steady_clock::now();
+            scene.draw_frame();
+            auto stop = std::chrono::steady_clock::now();
+            best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(stop - start).count());
+        }
+        if (threads == 1)
+        {
+            reference = r.frame_buffer();
+            serial_ms = best_ms;
+        }
+        bool identical = std::equal(reference.begin(), reference.end(), r.frame_buffer().begin());
+        std::cout << "threads: " << threads << "  time: " << best_ms << " ms  speedup: "
+                  << serial_ms / best_ms << (identical ? "" : "  (MISMATCH)") << '\n';
+    }
+}
+
+static void mode_vertex(bench_scene& scene)
+{
+    rst::rasterizer& r = scene.r;
+    // 顶点阶段：按三角形列表和按索引各渲染 20 次，取最快的一次，并检查两者画面一致。
+    // 三角形列表不带登记的句柄，两条路径都从头做完整的顶点变换
+    std::vector<Eigen::Vector3f> reference;
+    double list_ms = 1e30, indexed_ms = 1e30;
+    for (int run = 0; run < 20; ++run)
+    {
+        r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+        r.draw(scene.triangles);
+        r.resolve();
+        list_ms = std::min(list_ms, r.frame_statistics().vertex_ms);
+        reference = r.frame_buffer();
+
+        r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+        r.draw(scene.pos_id, scene.ind_id, scene.col_id, rst::Primitive::Triangle, scene.nor_id, scene.tex_id);
+        r.resolve();
+        indexed_ms = std::min(indexed_ms, r.frame_statistics().vertex_ms);
+    }
+    bool identical = std::equal(reference.begin(), reference.end(), r.frame_buffer().begin());
+    std::cout << "vertex stage  triangle list: " << list_ms << " ms  indexed: " << indexed_ms
+              << " ms  speedup: " << list_ms / indexed_ms << (identical ? "" : "  (MISMATCH)") << '\n';
+}
+
+static void mode_setup_cache(bench_scene& scene)
+{
+    rst::rasterizer& r = scene.r;
+    // 三角形列表路径：不带和带登记的句柄各转一圈，比较顶点阶段耗时并检查结果一致
+    std::vector<std::vector<Eigen::Vector3f>> reference;
+    rst::mesh_handle registered = scene.static_mesh;
+    bool list = scene.list;
+    scene.list = true;
+    for (bool enable : {false, true})
+    {
+        scene.static_mesh = enable ? registered : rst::mesh_handle{};
+        double vertex_ms = 0;
+        for (int step = 0; step < 36; ++step)
+        {
+            r.set_model(get_model_matrix(scene.angle + step * 10.0f));
+            r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+            scene.draw_frame();
+            vertex_ms += r.frame_statistics().vertex_ms;
+            if (!enable)
+                reference.push_back(r.frame_buffer());
+            else if (reference[step] != r.frame_buffer())
+                std::cout << "setup cache: frame " << step << " MISMATCH\n";
+        }
+        std::cout << "setup cache " << (enable ? "on " : "off") << "  vertex stage: "
+                  << vertex_ms / 36 << " ms/frame  back-face culled: "
+                  << r.frame_statistics().backface_culled << '\n';
+    }
+    scene.list = list;
+    r.set_model(get_model_matrix(scene.angle));
+}
+
+static void mode_export(bench_scene& scene)
+{
+    rst::rasterizer& r = scene.r;
+    const int width = scene.width, height = scene.height;
+    // 导出 8 位图像：convertTo + cvtColor 和合并成一遍的 output_image() 比较；
+    // 再把转一圈的 36 帧存成 png 序列，同步写和后台线程写比较。序列写到临时目录，测完删掉
+    r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+    scene.draw_frame();
+    const int runs = 50;
+    cv::Mat reference;
+    auto start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; ++run)
+    {
+        cv::Mat image(height, width, CV_32FC3, r.frame_buffer().data());
+        image.convertTo(image, CV_8UC3, 1.0f);
+        cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+        reference = image;
+    }
+    auto converted = std::chrono::steady_clock::now();
+    cv::Mat image;
+    for (int run = 0; run < runs; ++run)
+        image = r.output_image();
+    auto quantized = std::chrono::steady_clock::now();
+    bool identical = std::memcmp(reference.data, image.data, size_t(width) * height * 3) == 0;
+    std::cout << "convertTo + cvtColor: " << std::chrono::duration<double, std::milli>(converted - start).count() / runs
+              << " ms  output_image: " << std::chrono::duration<double, std::milli>(quantized - converted).count() / runs
+              << " ms" << (identical ? "" : "  (MISMATCH)") << '\n';
+
+    std::filesystem::path sequence_dir = std::filesystem::temp_directory_path() / "rasterizer_export_bench";
+    std::filesystem::create_directories(sequence_dir);
+    for (bool async : {false, true})
+    {
+        auto sequence_start = std::chrono::steady_clock::now();
+        {
+            rst::image_writer writer;
+            for (int step = 0; step < 36; ++step)
+            {
+                r.set_model(get_model_matrix(scene.angle + step * 10.0f));
+                r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+                scene.draw_frame();
+                std::string name = (sequence_dir / ("frame_" + std::to_string(step) + ".png")).string();
+                if (async)
+                    writer.write(name, r.output_image());
+                else
+                    cv::imwrite(name, r.output_image());
+            }
+        }
+        std::cout << (async ? "background writer: " : "imwrite:           ")
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sequence_start).count() / 36
+                  << " ms/frame\n";
+    }
+    std::filesystem::remove_all(sequence_dir);
+    r.set_model(get_model_matrix(scene.angle));
+}
+
+static void mode_quad(bench_scene& scene)
+{
+    rst::rasterizer& r = scene.r;
+    // 逐像素着色和按 quad 着色各渲染 10 次取最快的一次，比较时间、辅助像素数和画面差异
+    std::vector<Eigen::Vector3f> per_pixel;
+    for (bool quads : {false, true})
+    {
+        r.set_quad_fragment_shader(quads ? scene.quad_shader : nullptr);
+        double best_ms = 1e30;
+        for (int run = 0; run < 10; ++run)
+        {
+            r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+            auto start = std::chrono::steady_clock::now();
+            scene.draw_frame();
+            auto stop = std::chrono::steady_clock::now();
+            best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(stop - start).count());
+        }
+        float max_diff = 0, mean_diff = 0;
+        if (!quads)
+            per_pixel = r.frame_buffer();
+        else
+            for (size_t i = 0; i < per_pixel.size(); ++i)
+            {
+                float diff = (per_pixel[i] - r.frame_buffer()[i]).cwiseAbs().maxCoeff();
+                max_diff = std::max(max_diff, diff);
+                mean_diff += diff / per_pixel.size();
+            }
+        std::cout << (quads ? "quads     " : "per pixel ") << "time: " << best_ms << " ms  shader invocations: "
+                  << r.frame_statistics().shader_invocations << "  helper lanes: " << r.frame_statistics().helper_lanes;
+        if (quads)
+            std::cout << "  difference to per pixel: max " << max_diff << " mean " << mean_diff;
+        std::cout << '\n';
+    }
+    r.set_quad_fragment_shader(nullptr);
+}
+
+static void mode_uniform(bench_scene& scene)
+{
+    rst::rasterizer& r = scene.r;
+    benchmark_pow(r.get_uniforms().p);
+    benchmark_shader(r, scene.triangles, "phong", [](const fragment_shader_payload& p) { return phong_fragment_shader(p); });
+    benchmark_shader(r, scene.triangles, "texture", [](const fragment_shader_payload& p) { return texture_fragment_shader(p); });
+    r.set_fragment_shader(scene.shader);
+}
+
+static void mode_hiz(bench_scene& scene)
+{
+    rst::rasterizer& r = scene.r;
+    // 分别关闭和打开 hierarchical z 渲染同一帧，比较耗时并检查结果一致
+    std::vector<Eigen::Vector3f> reference;
+    for (bool enable : {false, true})
+    {
+        r.set_hierarchical_z(enable);
+        double best_ms = 1e30;
+        for (int run = 0; run < 5; ++run)
+        {
+            r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+            auto start = std::chrono::steady_clock::now();
+            scene.draw_frame();
+            auto stop = std::chrono::steady_clock::now();
+            best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(stop - start).count());
+        }
+        if (!enable)
+            reference = r.frame_buffer();
+        bool identical = std::equal(reference.begin(), reference.end(), r.frame_buffer().begin());
+        std::cout << "hierarchical z " << (enable ? "on " : "off") << "  time: " << best_ms
+                  << " ms  shader invocations: " << r.frame_statistics().shader_invocations << (identical ? "" : "  (MISMATCH)") << '\n';
+    }
+    r.set_hierarchical_z(false);
+}
+
+static void mode_shading(bench_scene& scene)
+{
+    rst::rasterizer& r = scene.r;
+    // 同一帧分别用前向和延迟着色渲染，比较着色器调用次数和耗时
+    std::vector<Eigen::Vector3f> forward_frame;
+    for (auto mode : {rst::ShadingMode::Forward, rst::ShadingMode::Deferred})
+    {
+        r.set_shading_mode(mode);
+        r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+        auto start = std::chrono::steady_clock::now();
+        scene.draw_frame();
+        auto stop = std::chrono::steady_clock::now();
+
+        float max_diff = 0;
+        if (mode == rst::ShadingMode::Forward)
+            forward_frame = r.frame_buffer();
+        else
+            for (size_t i = 0; i < forward_frame.size(); ++i)
+                max_diff = std::max(max_diff, (forward_frame[i] - r.frame_buffer()[i]).cwiseAbs().maxCoeff());
+
+        std::cout << (mode == rst::ShadingMode::Forward ? "forward " : "deferred")
+                  << "  shader invocations: " << r.frame_statistics().shader_invocations
+                  << "  time: " << std::chrono::duration<double, std::milli>(stop - start).count() << " ms";
+        if (mode == rst::ShadingMode::Deferred)
+            std::cout << "  max difference to forward: " << max_diff;
+        std::cout << '\n';
+    }
+    r.set_shading_mode(scene.deferred ? rst::ShadingMode::Deferred : rst::ShadingMode::Forward);
+}
+
+static void mode_depth(bench_scene& scene)
+{
+    // 各深度格式在 1080p 和 4K 下的深度缓冲大小、帧时间和存成平面的块数
+    struct depth_config { const char* name; rst::DepthFormat format; };
+    const depth_config formats[] = {
+        {"float32", rst::DepthFormat::Float32},
+        {"unorm16", rst::DepthFormat::Unorm16},
+        {"unorm24", rst::DepthFormat::Unorm24},
+        {"tile plane", rst::DepthFormat::TilePlane},
+    };
+    const int resolutions[2][2] = {{1920, 1080}, {3840, 2160}};
+    for (auto& resolution : resolutions)
+    {
+        rst::rasterizer big(resolution[0], resolution[1]);
+        auto big_pos = big.load_positions(scene.m.positions);
+        auto big_ind = big.load_indices(scene.m.indices);
+        auto big_col = big.load_colors(scene.m.colors);
+        auto big_nor = big.load_normals(scene.m.normals);
+        auto big_tex = big.load_texcoords(scene.m.texcoords);
+        Texture texture(scene.texture_path);
+        texture.filter = scene.filter;
+        big.set_texture(texture);
+        big.set_vertex_shader(vertex_shader);
+        big.set_fragment_shader(scene.shader);
+        big.set_model(get_model_matrix(scene.angle));
+        big.set_view(get_view_matrix(scene.eye_pos));
+        big.set_projection(get_projection_matrix(45.0, float(resolution[0]) / resolution[1], 0.1, 50));
+        for (auto& config : formats)
+        {
+            big.set_depth_format(config.format);
+            double best_ms = 1e30;
+            for (int run = 0; run < 3; ++run)
+            {
+                big.clear(rst::Buffers::Color | rst::Buffers::Depth);
+                auto start = std::chrono::steady_clock::now();
+                big.draw(big_pos, big_ind, big_col, rst::Primitive::Triangle, big_nor, big_tex);
+                auto stop = std::chrono::steady_clock::now();
+                best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(stop - start).count());
+            }
+            std::cout << resolution[0] << "x" << resolution[1] << " " << config.name << ": depth "
+                      << big.depth_bytes() / (1024.0 * 1024.0) << " MiB, " << big.depth_plane_tiles()
+                      << " plane tiles, frame " << best_ms << " ms\n";
+        }
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    std::map<std::string, std::string> options = {
+        {"model", "spot"}, {"triangles", "1000000"}, {"shader", "phong"}, {"width", "700"}, {"height", "700"},
+        {"frames", "100"}, {"warmup", "3"}, {"threads", "0"}, {"models", "../models"}, {"output", ""},
+        {"path", "indexed"}, {"filter", "nearest"}, {"mode", "frames"}};
+    bool deferred = false, simd = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--deferred")
+            deferred = true;
+        else if (arg == "--simd")
+            simd = true;
+        else if (arg.rfind("--", 0) == 0 && options.count(arg.substr(2)) && i + 1 < argc)
+            options[arg.substr(2)] = argv[++i];
+        else
+        {
+            std::cerr << "unknown option " << arg << '\n';
+            return 1;
+        }
+    }
+
+    const std::string model = options["model"], shader_name = options["shader"];
+    const int width = std::stoi(options["width"]), height = std::stoi(options["height"]);
+    const int frames = std::max(1, std::stoi(options["frames"])), warmup = std::stoi(options["warmup"]);
+    const int threads = std::stoi(options["threads"]);
+    const std::string models = options["models"] + "/";
+    const bool list = options["path"] == "list";
+    const std::string mode = options["mode"];
+
+    const std::map<std::string, void (*)(bench_scene&)> modes = {
+        {"texture", mode_texture}, {"shaders", mode_shaders}, {"scaling", mode_scaling}, {"vertex", mode_vertex},
+        {"setup_cache", mode_setup_cache}, {"export", mode_export}, {"quad", mode_quad}, {"uniform", mode_uniform},
+        {"hiz", mode_hiz}, {"shading", mode_shading}, {"depth", mode_depth}};
+    if (mode != "frames" && !modes.count(mode))
+    {
+        std::cerr << "unknown mode " << mode << '\n';
+        return 1;
+    }
+    const std::map<std::string, Texture::Filter> filters = {
+        {"nearest", Texture::Filter::Nearest}, {"bilinear", Texture::Filter::Bilinear},
+        {"trilinear", Texture::Filter::Trilinear}, {"aniso", Texture::Filter::Anisotropic}};
+    if (!filters.count(options["filter"]))
+    {
+        std::cerr << "unknown filter " << options["filter"] << '\n';
+        return 1;
+    }
+
+    mesh m;
+    if (model == "sphere")
+        m = make_sphere(std::stol(options["triangles"]));
+    else if (model == "grid")
+        m = make_grid(std::stol(options["triangles"]));
+    else if (model == "rock")
+        m = load_obj(models + "rock/rock.obj");
+    else
+        m = load_obj(models + "spot/spot_triangulated_good.obj");
+
+    std::map<std::string, std::function<Eigen::Vector3f(const fragment_shader_payload&)>> shaders = {
+        {"normal", normal_fragment_shader}, {"phong", phong_fragment_shader}, {"texture", texture_fragment_shader},
+        {"bump", bump_fragment_shader}, {"displacement", displacement_fragment_shader}};
+    if (!shaders.count(shader_name))
+    {
+        std::cerr << "unknown shader " << shader_name << '\n';
+        return 1;
+    }
+
+    rst::rasterizer r(width, height);
+    auto pos_id = r.load_positions(m.positions);
+    auto ind_id = r.load_indices(m.indices);
+    auto col_id = r.load_colors(m.colors);
+    auto nor_id = r.load_normals(m.normals);
+    auto tex_id = r.load_texcoords(m.texcoords);
+
+    // the same mesh as a triangle list, for the draw(TriangleList) path and the modes comparing against it
+    std::vector<Triangle> triangles;
+    if (list || mode != "frames")
+    {
+        triangles.resize(m.indices.size());
+        for (size_t i = 0; i < m.indices.size(); ++i)
+            for (int j = 0; j < 3; ++j)
+            {
+                int k = m.indices[i][j];
+                triangles[i].setVertex(j, Eigen::Vector4f(m.positions[k].x(), m.positions[k].y(), m.positions[k].z(), 1.0f));
+                triangles[i].setNormal(j, m.normals[k]);
+                triangles[i].setTexCoord(j, m.texcoords[k]);
+            }
+    }
+
+    // the list never changes, so its back faces are culled against planes computed once
+    rst::mesh_handle static_mesh;
+    if (!triangles.empty())
+        static_mesh = r.register_static_mesh(triangles);
+
+    // the procedural meshes borrow spot's textures
+    std::string texture_dir = models + (model == "rock" ? "rock/" : "spot/");
+    std::string texture_file = model == "rock" ? "rock.png" : shader_name == "texture" ? "spot_texture_512.jpg" : "hmap.jpg";
+    Texture texture(texture_dir + texture_file);
+    texture.filter = filters.at(options["filter"]);
+    r.set_texture(texture);
+    r.set_vertex_shader(vertex_shader);
+    r.set_fragment_shader(shaders[shader_name]);
+    r.set_num_threads(threads);
+    if (deferred)
+        r.set_shading_mode(rst::ShadingMode::Deferred);
+    if (simd)
+        r.set_raster_mode(rst::RasterMode::SIMD);
+
+    Eigen::Vector3f eye_pos = {0, 0, 10};
+    r.set_view(get_view_matrix(eye_pos));
+    r.set_projection(get_projection_matrix(45.0, float(width) / height, 0.1, 50));
+
+    if (mode != "frames")
+    {
+        std::map<std::string, rst::quad_fragment_shader_fn> quad_shaders = {
+            {"bump", bump_fragment_shader_quad}, {"displacement", displacement_fragment_shader_quad}};
+        // 没有专门版本的着色器逐个像素调用
+        rst::quad_fragment_shader_fn quad_shader = quad_shaders[shader_name];
+        if (!quad_shader)
+            quad_shader = [shader = shaders[shader_name]](const fragment_quad& quad) {
+                std::array<Eigen::Vector3f, 4> result;
+                for (int lane = 0; lane < 4; ++lane)
+                    if (quad.mask & (1 << lane))
+                        result[lane] = shader(quad.lanes[lane]);
+                return result;
+            };
+        bench_scene scene{r, m, triangles, static_mesh, pos_id, ind_id, col_id, nor_id, tex_id, list, deferred,
+                          texture_dir + texture_file, texture.filter, shaders[shader_name], quad_shader, eye_pos, width, height};
+        r.set_model(get_model_matrix(scene.angle));
+        modes.at(mode)(scene);
+        return 0;
+    }
+
+    std::vector<double> frame_ms;
+    rst::frame_stats total;
+    double clear_ms = 0, present_ms = 0;
+    long frame_allocations = 0;
+    cv::Mat image;
+    for (int frame = -warmup; frame < frames; ++frame)
+    {
+        r.set_model(get_model_matrix(140.0f + 360.0f * frame / frames));
+        long allocated = allocations;
+        auto start = std::chrono::steady_clock::now();
+        r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+        auto cleared = std::chrono::steady_clock::now();
+        if (list)
+            r.draw(triangles, static_mesh);
+        else
+            r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle, nor_id, tex_id);
+        r.resolve();
+        auto drawn = std::chrono::steady_clock::now();
+        image = r.output_image();
+        auto stop = std::chrono::steady_clock::now();
+        if (frame < 0)
+            continue;
+        frame_allocations += allocations - allocated;
+
+        frame_ms.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+        clear_ms += std::chrono::duration<double, std::milli>(cleared - start).count();
+        present_ms += std::chrono::duration<double, std::milli>(stop - drawn).count();
+        const rst::frame_stats& stats = r.frame_statistics();
+        total.emitted += stats.emitted;
+        total.fragments += stats.fragments;
+        total.shader_invocations += stats.shader_invocations;
+        total.vertex_ms += stats.vertex_ms;
+        total.setup_ms += stats.setup_ms;
+        total.raster_ms += stats.raster_ms;
+        total.resolve_ms += stats.resolve_ms;
+    }
+
+    double seconds = 0;
+    for (double ms : frame_ms)
+        seconds += ms / 1000.0;
+
+    std::ofstream file;
+    if (!options["output"].empty())
+        file.open(options["output"]);
+    std::ostream& out = file.is_open() ? file : std::cout;
+    // Forward shading runs per fragment inside the raster stage and is part of "raster";
+    // "deferred_resolve" is the shading of resolve() and stays 0 without --deferred.
+    // "present" is the 8-bit conversion of output_image().
+    out << "{\n"
+        << "  \"model\": \"" << model << "\",\n"
+        << "  \"triangles\": " << m.indices.size() << ",\n"
+        << "  \"vertices\": " << m.positions.size() << ",\n"
+        << "  \"width\": " << width << ",\n"
+        << "  \"height\": " << height << ",\n"
+        << "  \"shader\": \"" << shader_name << "\",\n"
+        << "  \"shading\": \"" << (deferred ? "deferred" : "forward") << "\",\n"
+        << "  \"path\": \"" << (list ? "list" : "indexed") << "\",\n"
+        << "  \"raster\": \"" << (simd ? "simd" : "scalar") << "\",\n"
+        << "  \"threads\": " << (threads > 0 ? threads : omp_get_max_threads()) << ",\n"
+        << "  \"frames\": " << frames << ",\n"
+        << "  \"stage_ms\": {\n"
+        << "    \"clear\": " << clear_ms / frames << ",\n"
+        << "    \"vertex\": " << total.vertex_ms / frames << ",\n"
+        << "    \"setup\": " << total.setup_ms / frames << ",\n"
+        << "    \"raster\": " << total.raster_ms / frames << ",\n"
+        << "    \"deferred_resolve\": " << total.resolve_ms / frames << ",\n"
+        << "    \"present\": " << present_ms / frames << "\n"
+        << "  },\n"
+        << "  \"frame_ms\": {\n"
+        << "    \"mean\": " << seconds * 1000.0 / frames << ",\n"
+        << "    \"p50\": " << percentile(frame_ms, 50) << ",\n"
+        << "    \"p99\": " << percentile(frame_ms, 99) << "\n"
+        << "  },\n"
+        << "  \"allocations_per_frame\": " << double(frame_allocations) / frames << ",\n"
+        << "  \"triangles_per_second\": " << m.indices.size() * double(frames) / seconds << ",\n"
+        << "  \"emitted_triangles_per_second\": " << total.emitted / seconds << ",\n"
+        << "  \"fragments_per_second\": " << total.fragments / seconds << ",\n"
+        << "  \"shader_invocations_per_second\": " << total.shader_invocations / seconds << "\n"
+        << "}\n";
+    return 0;
+}
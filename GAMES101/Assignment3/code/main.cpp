@@ -7,426 +7,204 @@
 #include "Shader.hpp"
 #include "Texture.hpp"
 #include "OBJ_Loader.h"
+#include "Shaders.hpp"
 #include <algorithm>
-
-Eigen::Matrix4f get_view_matrix(Eigen::Vector3f eye_pos)
-{
-    Eigen::Matrix4f view = Eigen::Matrix4f::Identity();
-
-    Eigen::Matrix4f translate;
-    translate << 1,0,0,-eye_pos[0],
-                 0,1,0,-eye_pos[1],
-                 0,0,1,-eye_pos[2],
-                 0,0,0,1;
-
-    view = translate*view;
-
-    return view;
-}
-
-Eigen::Matrix4f get_model_matrix(float angle)
-{
-    Eigen::Matrix4f rotation;
-    angle = angle * MY_PI / 180.f;
-    rotation << cos(angle), 0, sin(angle), 0,
-                0, 1, 0, 0,
-                -sin(angle), 0, cos(angle), 0,
-                0, 0, 0, 1;
-
-    Eigen::Matrix4f scale;
-    scale << 2.5, 0, 0, 0,
-              0, 2.5, 0, 0,
-              0, 0, 2.5, 0,
-              0, 0, 0, 1;
-
-    Eigen::Matrix4f translate;
-    translate << 1, 0, 0, 0,
-            0, 1, 0, 0,
-            0, 0, 1, 0,
-            0, 0, 0, 1;
-
-    return translate * rotation * scale;
-}
-
-Eigen::Matrix4f get_projection_matrix(float eye_fov, float aspect_ratio, float zNear, float zFar)
-{
-    // TODO: Use the same projection matrix from the previous assignments
-    Eigen::Matrix4f projection = Eigen::Matrix4f::Identity();
-
-    float t = abs(zNear) * tan(eye_fov * MY_PI / (180 * 2));
-    float r = aspect_ratio * t;
-    float l = -r;
-    float b = -t;
-    float n = -zNear;
-    float f = -zFar;
-    projection(0, 0) = 2 * n / (r - l);
-    projection(0, 2) = (l + r) / (l - r);
-    projection(1, 1) = 2 * n / (t - b);
-    projection(1, 2) = (b + t) / (b - t);
-    projection(2, 2) = (f + n) / (n - f);
-    projection(2, 3) = 2 * f * n / (f - n);
-    projection(3, 2) = 1.0;
-    projection(3, 3) = 0.0;
-
-    return projection;
-
-}
-
-Eigen::Vector3f vertex_shader(const vertex_shader_payload& payload)
-{
-    return payload.position;
-}
-
-Eigen::Vector3f normal_fragment_shader(const fragment_shader_payload& payload)
-{
-    // Eigen::Vector3f return_color = (payload.normal.head<3>().normalized() + Eigen::Vector3f(1.0f, 1.0f, 1.0f)) / 2.f;
-    // Eigen::Vector3f result;
-    // result << return_color.x() * 255, return_color.y() * 255, return_color.z() * 255;
-    // return result;
-        Eigen::Vector3f return_color = (payload.normal.head<3>().normalized() + Eigen::Vector3f(1.0f, 1.0f, 1.0f)) / 2.f;
-    // if (payload.texture)
-    // {
-    //     // TODO: Get the texture value at the texture coordinates of the current fragment
-    //     return_color = (payload.normal.head<3>().normalized()*255 + payload.texture->getColor(payload.tex_coords.x(), payload.tex_coords.y())) / 2.f;
-    //     Eigen::Vector3f result;
-    //     result << return_color.x(), return_color.y(), return_color.z();
-    //     return result;
-    // }
-    Eigen::Vector3f result;
-    result << return_color.x() * 255, return_color.y() * 255, return_color.z() * 255;
-    return result;
-}
-
-static Eigen::Vector3f reflect(const Eigen::Vector3f& vec, const Eigen::Vector3f& axis)
-{
-    // axis是法线方向，vec是光线入射的方向
-    auto costheta = vec.dot(axis);
-    return (2 * costheta * axis - vec).normalized();
-}
-
-struct light
-{
-    Eigen::Vector3f position;
-    Eigen::Vector3f intensity;
-};
-
-Eigen::Vector3f texture_fragment_shader(const fragment_shader_payload& payload)
-{
-    Eigen::Vector3f return_color = {0, 0, 0};
-    if (payload.texture)
-    {
-        // TODO: Get the texture value at the texture coordinates of the current fragment
-        float u = payload.tex_coords[0];
-        float v = payload.tex_coords[1];
-        return_color = payload.texture->getColor(u, v);
-        // return_color = payload.texture->getColorBilinear(u, v);
-
-    }
-    Eigen::Vector3f texture_color;
-    texture_color << return_color.x(), return_color.y(), return_color.z();
-
-    Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
-    Eigen::Vector3f kd = texture_color / 255.f;
-    Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-    auto l1 = light{{20, 20, 20}, {500, 500, 500}};
-    auto l2 = light{{-20, 20, 0}, {500, 500, 500}};
-
-    std::vector<light> lights = {l1, l2};
-    Eigen::Vector3f amb_light_intensity{10, 10, 10};
-    Eigen::Vector3f eye_pos{0, 0, 10};
-    // Eigen::Vector3f eye_pos{0, 0, 40};
-
-    float p = 150;
-
-    Eigen::Vector3f color = texture_color;
-    Eigen::Vector3f point = payload.view_pos;
-    Eigen::Vector3f normal = payload.normal;
-
-    Eigen::Vector3f result_color = {0, 0, 0};
-
-    for (auto& light : lights)
-    {
-        // TODO: For each light source in the code, calculate what the *ambient*, *diffuse*, and *specular* 
-        // components are. Then, accumulate that result on the *result_color* object.
-               // TODO: For each light source in the code, calculate what the *ambient*, *diffuse*, and *specular* 
-        Eigen::Vector3f r = light.position - point;
-        Eigen::Vector3f l = r.normalized();
-        Eigen::Vector3f v = (eye_pos - point).normalized();
-        Eigen::Vector3f h = (l + v).normalized();
-        Eigen::Vector3f ambient = ka.cwiseProduct(amb_light_intensity);
-        Eigen::Vector3f diffuse = kd.cwiseProduct(light.intensity) / (r.dot(r)) * std::max((float)0.0, normal.dot(l));
-        Eigen::Vector3f specular = ks.cwiseProduct(light.intensity) / (r.dot(r)) * std::max((float)0.0, pow(normal.dot(h), p));
-        // components are. Then, accumulate that result on the *result_color* object.
-        
-        result_color = result_color + ambient + diffuse + specular; 
-    }
-
-    return result_color * 255.f;
-}
-
-Eigen::Vector3f phong_fragment_shader(const fragment_shader_payload& payload)
-{
-    Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
-    Eigen::Vector3f kd = payload.color;
-    Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-    auto l1 = light{{20, 20, 20}, {500, 500, 500}};
-    auto l2 = light{{-20, 20, 0}, {500, 500, 500}};
-
-    std::vector<light> lights = {l1, l2};
-    Eigen::Vector3f amb_light_intensity{10, 10, 10};
-    Eigen::Vector3f eye_pos{0, 0, 10};
-    // Eigen::Vector3f eye_pos{0, 0, 40};
-
-    float p = 150;
-
-    Eigen::Vector3f color = payload.color;
-    Eigen::Vector3f point = payload.view_pos;
-    Eigen::Vector3f normal = payload.normal;
-
-    Eigen::Vector3f result_color = {0, 0, 0};
-
-    for (auto& light : lights)
-    {
-        // TODO: For each light source in the code, calculate what the *ambient*, *diffuse*, and *specular* 
-        Eigen::Vector3f r = light.position - point;
-        Eigen::Vector3f l = r.normalized();
-        Eigen::Vector3f v = (eye_pos - point).normalized();
-        Eigen::Vector3f h = (l + v).normalized();
-        Eigen::Vector3f ambient = ka.cwiseProduct(amb_light_intensity);
-        Eigen::Vector3f diffuse = kd.cwiseProduct(light.intensity) / (r.dot(r)) * std::max((float)0.0, normal.normalized().dot(l));
-        Eigen::Vector3f specular = ks.cwiseProduct(light.intensity) / (r.dot(r)) * std::max((float)0.0, pow(normal.normalized().dot(h), p));
-        // components are. Then, accumulate that result on the *result_color* object.
-        
-        result_color = result_color + ambient + diffuse + specular;  
-    }
- 
-    return result_color * 255.f;
-
-} 
-
-
-
-
-
-Eigen::Vector3f displacement_fragment_shader(const fragment_shader_payload& payload)
-{
-    
-    Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
-    Eigen::Vector3f kd = payload.color;
-    Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-    auto l1 = light{{20, 20, 20}, {500, 500, 500}};
-    auto l2 = light{{-20, 20, 0}, {500, 500, 500}};
-
-    std::vector<light> lights = {l1, l2};
-    Eigen::Vector3f amb_light_intensity{10, 10, 10};
-    Eigen::Vector3f eye_pos{0, 0, 10};
-    // Eigen::Vector3f eye_pos{0, 0, 40};
-
-    float p = 150;
-
-    Eigen::Vector3f color = payload.color; 
-    Eigen::Vector3f point = payload.view_pos;
-    Eigen::Vector3f normal = payload.normal;
-
-    float kh = 0.2, kn = 0.1;
-    
-    // TODO: Implement displacement mapping here
-    // Let n = normal = (x, y, z)
-    // Vector t = (x*y/sqrt(x*x+z*z),sqrt(x*x+z*z),z*y/sqrt(x*x+z*z))
-    // Vector b = n cross product t
-    // Matrix TBN = [t b n]
-    // dU = kh * kn * (h(u+1/w,v)-h(u,v))
-    // dV = kh * kn * (h(u,v+1/h)-h(u,v))
-    // Vector ln = (-dU, -dV, 1)
-    // Position p = p + kn * n * h(u,v)
-    // Normal n = normalize(TBN * ln)
-     float x = normal.x();
-    float y = normal.y();
-    float z = normal.z();
-    Eigen::Vector3f t = {x*y/sqrt(x*x+z*z),sqrt(x*x+z*z),z*y/sqrt(x*x+z*z)};
-    Eigen::Vector3f b = normal.cross(t);
-    Eigen::Matrix3f TBN;
-    TBN << t.x(), b.x(), normal.x(),
-                    t.y(), b.y(), normal.y(),
-                    t.z(), b.z(), normal.z();
-    float u = payload.tex_coords.x();
-    float v = payload.tex_coords.y();
-    float w = payload.texture->width;
-    float h = payload.texture->height;
-    float dU = kh * kn * (payload.texture->getColor(u + 1.0/w, v).norm() - payload.texture->getColor(u, v).norm());
-    float dV = kh * kn * (payload.texture->getColor(u, v + 1.0 / h).norm() - payload.texture->getColor(u, v). norm());
-    Eigen::Vector3f ln = {-dU, -dV, 1};
-    point = point + kn * normal * payload.texture->getColor(u, v).norm();
-    normal = (TBN * ln).normalized();
-
-
-
-    Eigen::Vector3f result_color = {0, 0, 0};
-
-    for (auto& light : lights)
-    {
-        // TODO: For each light source in the code, calculate what the *ambient*, *diffuse*, and *specular* 
-        Eigen::Vector3f r = light.position - point;
-        Eigen::Vector3f l = r.normalized();
-        Eigen::Vector3f v = (eye_pos - point).normalized();
-        Eigen::Vector3f h = (l + v).normalized();
-        Eigen::Vector3f ambient = ka.cwiseProduct(amb_light_intensity);
-        Eigen::Vector3f diffuse = kd.cwiseProduct(light.intensity) / (r.dot(r)) * std::max((float)0, normal.dot(l));
-        Eigen::Vector3f specular = ks.cwiseProduct(light.intensity) / (r.dot(r)) * std::max((float)0, pow(normal.dot(h), p));
-        // components are. Then, accumulate that result on the *result_color* object.
-        result_color = result_color + ambient + diffuse + specular; 
-
-
-    }
-
-    return result_color * 255.f;
-}
-
-
-Eigen::Vector3f bump_fragment_shader(const fragment_shader_payload& payload)
-{
-    
-    Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
-    Eigen::Vector3f kd = payload.color;
-    Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-    auto l1 = light{{20, 20, 20}, {500, 500, 500}};
-    auto l2 = light{{-20, 20, 0}, {500, 500, 500}};
-
-    std::vector<light> lights = {l1, l2};
-    Eigen::Vector3f amb_light_intensity{10, 10, 10};
-    Eigen::Vector3f eye_pos{0, 0, 10};
-    // Eigen::Vector3f eye_pos{0, 0, 40};
-
-    float p = 150;
-
-    Eigen::Vector3f color = payload.color; 
-    Eigen::Vector3f point = payload.view_pos;
-    Eigen::Vector3f normal = payload.normal;
-
-
-    float kh = 0.2, kn = 0.1;
-
-    // TODO: Implement bump mapping here
-    // Let n = normal = (x, y, z)
-    // Vector t = (x*y/sqrt(x*x+z*z),sqrt(x*x+z*z),z*y/sqrt(x*x+z*z))
-    // Vector b = n cross product t
-    // Matrix TBN = [t b n]
-    // dU = kh * kn * (h(u+1/w,v)-h(u,v))
-    // dV = kh * kn * (h(u,v+1/h)-h(u,v))
-    // Vector ln = (-dU, -dV, 1)
-    // Normal n = normalize(TBN * ln)
-    float x = normal.x();
-    float y = normal.y();
-    float z = normal.z();
-    Eigen::Vector3f t = {-x*y/sqrt(x*x+z*z),sqrt(x*x+z*z),-z*y/sqrt(x*x+z*z)};
-    Eigen::Vector3f b = normal.cross(t);
-    Eigen::Matrix3f TBN;
-    TBN << t.x(), b.x(), normal.x(),
-                    t.y(), b.y(), normal.y(),
-                    t.z(), b.z(), normal.z();
-    float u = payload.tex_coords.x();
-    float v = payload.tex_coords.y();
-    float w = payload.texture->width;
-    float h = payload.texture->height;
-    float dU = kh * kn * (payload.texture->getColor(u + 1.0/w, v).norm() - payload.texture->getColor(u, v).norm());
-    float dV = kh * kn * (payload.texture->getColor(u, v + 1.0 / h).norm() - payload.texture->getColor(u, v). norm());
-    Eigen::Vector3f ln = {-dU, -dV, 1};
-    normal = (TBN * ln).normalized();
-    
-
-
-    Eigen::Vector3f result_color = {0, 0, 0};
-    result_color = normal;
-
-    return result_color * 255.f;
-}
+#include <set>
+#include <map>
+#include <array>
 
 int main(int argc, const char** argv)
 {
-    std::vector<Triangle*> TriangleList;
+    // 所有三角形连续存放，不再每个面 new 一次
+    std::vector<Triangle> TriangleList;
 
     float angle = 140.0;
     bool command_line = false;
 
     std::string filename = "output.png";
+    // 着色器之后的参数都是开关选项，例如 simd、rock；各种性能比较在 rasterizer_bench --mode 里
+    std::set<std::string> options(argv + std::min(argc, 3), argv + argc);
+    bool rock = options.count("rock") > 0;
+
     objl::Loader Loader;
-    std::string obj_path = "../models/spot/";
+    std::string obj_path = rock ? "../models/rock/" : "../models/spot/";
     // std::string obj_path = "./models/spot/";
     // std::string obj_path = "../models/rock/";
     // std::string obj_path = "../models/rock/";//在main文件所在路径debug用.，在build路径命令行输出用..，路径不一样
     // Load .obj File
     // bool loadout = Loader.LoadFile("../models/rock/rock.obj");//在main文件所在路径debug用.，在build路径命令行输出用..，路径不一样
-    bool loadout = Loader.LoadFile("../models/spot/spot_triangulated_good.obj");
+    bool loadout = Loader.LoadFile(obj_path + (rock ? "rock.obj" : "spot_triangulated_good.obj"));
     // bool loadout = Loader.LoadFile("./models/spot/spot_triangulated_good.obj");
-    for(auto mesh:Loader.LoadedMeshes)
+    for(auto& mesh:Loader.LoadedMeshes)
     {
+        TriangleList.reserve(TriangleList.size() + mesh.Vertices.size() / 3);
         for(int i=0;i<mesh.Vertices.size();i+=3)
         {
-            Triangle* t = new Triangle();
+            Triangle& t = TriangleList.emplace_back();
             for(int j=0;j<3;j++)
             {
-                t->setVertex(j,Vector4f(mesh.Vertices[i+j].Position.X,mesh.Vertices[i+j].Position.Y,mesh.Vertices[i+j].Position.Z,1.0));
-                t->setNormal(j,Vector3f(mesh.Vertices[i+j].Normal.X,mesh.Vertices[i+j].Normal.Y,mesh.Vertices[i+j].Normal.Z));
-                t->setTexCoord(j,Vector2f(mesh.Vertices[i+j].TextureCoordinate.X, mesh.Vertices[i+j].TextureCoordinate.Y));
+                t.setVertex(j,Vector4f(mesh.Vertices[i+j].Position.X,mesh.Vertices[i+j].Position.Y,mesh.Vertices[i+j].Position.Z,1.0));
+                t.setNormal(j,Vector3f(mesh.Vertices[i+j].Normal.X,mesh.Vertices[i+j].Normal.Y,mesh.Vertices[i+j].Normal.Z));
+                t.setTexCoord(j,Vector2f(mesh.Vertices[i+j].TextureCoordinate.X, mesh.Vertices[i+j].TextureCoordinate.Y));
             }
-            TriangleList.push_back(t);
+        }
+    }
+
+    // 同一个网格再建一份索引形式：位置、法线、纹理坐标都相同的顶点只存一次
+    std::vector<Eigen::Vector3f> positions, normals, colors;
+    std::vector<Eigen::Vector2f> texcoords;
+    std::vector<Eigen::Vector3i> indices;
+    std::map<std::array<float, 8>, int> vertex_ids;
+    for (auto& mesh : Loader.LoadedMeshes)
+    {
+        for (size_t i = 0; i + 2 < mesh.Vertices.size(); i += 3)
+        {
+            Eigen::Vector3i tri;
+            for (int j = 0; j < 3; j++)
+            {
+                const objl::Vertex& vert = mesh.Vertices[i + j];
+                std::array<float, 8> key = {vert.Position.X, vert.Position.Y, vert.Position.Z,
+                                            vert.Normal.X, vert.Normal.Y, vert.Normal.Z,
+                                            vert.TextureCoordinate.X, vert.TextureCoordinate.Y};
+                auto inserted = vertex_ids.emplace(key, (int)positions.size());
+                if (inserted.second)
+                {
+                    positions.emplace_back(key[0], key[1], key[2]);
+                    normals.emplace_back(key[3], key[4], key[5]);
+                    texcoords.emplace_back(key[6], key[7]);
+                    colors.emplace_back(148, 121.0, 92.0);
+                }
+                tri[j] = inserted.first->second;
+            }
+            indices.push_back(tri);
         }
     }
 
     rst::rasterizer r(700, 700);
+    // 三角形列表加载之后不再改动，登记一次，背面剔除用缓存的平面
+    rst::mesh_handle static_mesh = r.register_static_mesh(TriangleList);
 
-    auto texture_path = "hmap.jpg";
+    auto pos_id = r.load_positions(positions);
+    auto ind_id = r.load_indices(indices);
+    auto col_id = r.load_colors(colors);
+    auto nor_id = r.load_normals(normals);
+    auto tex_id = r.load_texcoords(texcoords);
+
+    std::string texture_path = rock ? "rock.png" : "hmap.jpg";
     // auto texture_path = "rock.png";
     // auto texture_path = "rock.png";
-    r.set_texture(Texture(obj_path + texture_path));
-
-    std::function<Eigen::Vector3f(fragment_shader_payload)> active_shader = phong_fragment_shader;
-    // std::function<Eigen::Vector3f(fragment_shader_payload)> active_shader = displacement_fragment_shader;
+    Texture::Filter filter = Texture::Filter::Nearest;
+    if (options.count("bilinear"))
+        filter = Texture::Filter::Bilinear;
+    if (options.count("trilinear"))
+        filter = Texture::Filter::Trilinear;
+    if (options.count("aniso"))
+        filter = Texture::Filter::Anisotropic;
+    auto load_texture = [&](const std::string& path) {
+        Texture texture(path);
+        texture.filter = filter;
+        r.set_texture(texture);
+    };
+    load_texture(obj_path + texture_path);
+
+    std::function<Eigen::Vector3f(const fragment_shader_payload&)> active_shader = phong_fragment_shader;
+    // 按 2x2 quad 着色时用的版本；没有专门版本的着色器逐个像素调用
+    rst::quad_fragment_shader_fn active_quad_shader;
+    // std::function<Eigen::Vector3f(const fragment_shader_payload&)> active_shader = displacement_fragment_shader;
     if (argc >= 2)
     {
         command_line = true;
         filename = std::string(argv[1]);
 
-        if (argc == 3 && std::string(argv[2]) == "texture")
+        if (argc >= 3 && std::string(argv[2]) == "texture")
         {
             std::cout << "Rasterizing using the texture shader\n";
             active_shader = texture_fragment_shader;
-            texture_path = "spot_texture_512.jpg";
+            texture_path = rock ? "rock.png" : "spot_texture_512.jpg";
             //texture_path = "rock.png";
             // texture_path = "hmap.jpg";
             // texture_path = "rock.png";
-            r.set_texture(Texture(obj_path + texture_path));
+            load_texture(obj_path + texture_path);
         }
-        else if (argc == 3 && std::string(argv[2]) == "normal")
+        else if (argc >= 3 && std::string(argv[2]) == "normal")
         {
             std::cout << "Rasterizing using the normal shader\n";
             active_shader = normal_fragment_shader;
         }
-        else if (argc == 3 && std::string(argv[2]) == "phong")
+        else if (argc >= 3 && std::string(argv[2]) == "phong")
         {
             std::cout << "Rasterizing using the phong shader\n";
             active_shader = phong_fragment_shader;
         }
-        else if (argc == 3 && std::string(argv[2]) == "bump")
+        else if (argc >= 3 && std::string(argv[2]) == "bump")
         {
             std::cout << "Rasterizing using the bump shader\n";
             active_shader = bump_fragment_shader;
+            active_quad_shader = bump_fragment_shader_quad;
         }
-        else if (argc == 3 && std::string(argv[2]) == "displacement")
+        else if (argc >= 3 && std::string(argv[2]) == "displacement")
         {
             std::cout << "Rasterizing using the displacement shader\n";
             active_shader = displacement_fragment_shader;
+            active_quad_shader = displacement_fragment_shader_quad;
         }
     }
 
+    if (options.count("simd"))
+    {
+        std::cout << "Rasterizing " << rst::simd::width << " pixels at a time\n";
+        r.set_raster_mode(rst::RasterMode::SIMD);
+    }
+    bool indexed = options.count("indexed") > 0;
+    if (indexed)
+        std::cout << "Indexed draw: " << positions.size() << " vertices, " << indices.size() << " triangles\n";
+    // 一帧：按索引或按三角形列表绘制，延迟着色时再做一次 resolve
+    auto draw_frame = [&] {
+        if (indexed)
+            r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle, nor_id, tex_id);
+        else
+            r.draw(TriangleList, static_mesh);
+        r.resolve();
+    };
+
+    if (options.count("nocull"))
+        r.set_cull_mode(rst::CullMode::None);
+    if (options.count("deferred"))
+    {
+        std::cout << "Deferred shading\n";
+        r.set_shading_mode(rst::ShadingMode::Deferred);
+    }
+    if (options.count("depth16"))
+        r.set_depth_format(rst::DepthFormat::Unorm16);
+    else if (options.count("depth24"))
+        r.set_depth_format(rst::DepthFormat::Unorm24);
+    else if (options.count("depthplane"))
+        r.set_depth_format(rst::DepthFormat::TilePlane);
+
     Eigen::Vector3f eye_pos = {0,0,10};
     // Eigen::Vector3f eye_pos = {0,0,40};
+    // far：从远处看模型，纹理被缩小，用来检查 mipmap 的效果
+    if (options.count("far"))
+        eye_pos = {0, 0, 40};
+    // 高光用真实的相机位置
+    uniform_block uniforms;
+    uniforms.eye_pos = eye_pos;
+    r.set_uniforms(uniforms);
     r.set_vertex_shader(vertex_shader);
     r.set_fragment_shader(active_shader);
+    if (!active_quad_shader)
+        active_quad_shader = [active_shader](const fragment_quad& quad) {
+            std::array<Eigen::Vector3f, 4> result;
+            for (int lane = 0; lane < 4; ++lane)
+                if (quad.mask & (1 << lane))
+                    result[lane] = active_shader(quad.lanes[lane]);
+            return result;
+        };
+    if (options.count("quad"))
+    {
+        std::cout << "Shading 2x2 quads\n";
+        r.set_quad_fragment_shader(active_quad_shader);
+    }
 
     int key = 0;
     int frame_count = 0;
@@ -438,32 +216,42 @@ int main(int argc, const char** argv)
         r.set_view(get_view_matrix(eye_pos));
         r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
 
-        r.draw(TriangleList);
-        cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-        image.convertTo(image, CV_8UC3, 1.0f);
-        cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+        draw_frame();
+        if (options.count("stats"))
+        {
+            const rst::frame_stats& stats = r.frame_statistics();
+            std::cout << "triangles: " << TriangleList.size() << "  frustum culled: " << stats.frustum_culled
+                      << "  back-face culled: " << stats.backface_culled << "  clipped: " << stats.clipped
+                      << "  emitted: " << stats.emitted << "  shader invocations: " << stats.shader_invocations << '\n';
+        }
+        cv::Mat image = r.output_image();
 
         cv::imwrite(filename, image);
 
         return 0;
     }
 
+    // 交互时保存图片放到后台线程，不阻塞下一帧
+    rst::image_writer writer;
+    cv::Mat image;
+
     while(key != 27)
     {
-        r.clear(rst::Buffers::Color | rst::Buffers::Depth);
-
         r.set_model(get_model_matrix(angle));
         r.set_view(get_view_matrix(eye_pos));
         r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
 
-        //r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle);
-        r.draw(TriangleList);
-        cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-        image.convertTo(image, CV_8UC3, 1.0f);
-        cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+        // 没有按键时矩阵不变，直接显示上一帧的 8 位图像，不再重新光栅化、转换，也不用再保存一次
+        if (r.frame_changed())
+        {
+            r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+            //r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle);
+            draw_frame();
+            image = r.output_image();
+            writer.write(filename, image);
+        }
 
         cv::imshow("image", image);
-        cv::imwrite(filename, image);
         key = cv::waitKey(10);
 
         if (key == 'a' )
@@ -6,40 +6,70 @@
 #include "rasterizer.hpp"
 #include <opencv2/opencv.hpp>
 #include <math.h>
+#include <chrono>
 
 
-rst::pos_buf_id rst::rasterizer::load_positions(const std::vector<Eigen::Vector3f> &positions)
+int rst::rasterizer::add_stream(const float* data, size_t count, int components)
 {
-    auto id = get_next_id();
-    pos_buf.emplace(id, positions);
+    buffer buf;
+    buf.count = count;
+    buf.components = components;
+    size_t padded = (count + stream_padding - 1) / stream_padding * stream_padding;
+    std::vector<float>* streams[3] = {&buf.x, &buf.y, &buf.z};
+    for (int c = 0; c < components; ++c)
+    {
+        streams[c]->assign(padded, 0.0f);
+        for (size_t i = 0; i < count; ++i)
+            (*streams[c])[i] = data[i * components + c];
+    }
+    buffers.push_back(std::move(buf));
+    state_changed = true;
+    return (int)buffers.size() - 1;
+}
 
-    return {id};
+const rst::rasterizer::buffer& rst::rasterizer::get_buffer(int id, int components, const char* kind) const
+{
+    if (id < 0 || id >= (int)buffers.size() || buffers[id].components != components)
+        throw std::runtime_error(std::string("no ") + kind + " buffer with id " + std::to_string(id));
+    return buffers[id];
+}
+
+rst::pos_buf_id rst::rasterizer::load_positions(const std::vector<Eigen::Vector3f> &positions)
+{
+    return {add_stream(positions.empty() ? nullptr : positions[0].data(), positions.size(), 3)};
 }
 
 rst::ind_buf_id rst::rasterizer::load_indices(const std::vector<Eigen::Vector3i> &indices)
 {
-    auto id = get_next_id();
-    ind_buf.emplace(id, indices);
+    buffer buf;
+    buf.count = indices.size();
+    buf.indices = indices;
+    // 最大的索引只在这里算一次，draw 时和位置数比较
+    for (const Eigen::Vector3i& i : indices)
+    {
+        if (i.minCoeff() < 0)
+            throw std::runtime_error("negative vertex index");
+        buf.max_index = std::max(buf.max_index, i.maxCoeff());
+    }
+    buffers.push_back(std::move(buf));
+    state_changed = true;
 
-    return {id};
+    return {(int)buffers.size() - 1};
 }
 
 rst::col_buf_id rst::rasterizer::load_colors(const std::vector<Eigen::Vector3f> &cols)
 {
-    auto id = get_next_id();
-    col_buf.emplace(id, cols);
-
-    return {id};
+    return {add_stream(cols.empty() ? nullptr : cols[0].data(), cols.size(), 3)};
 }
 
-rst::col_buf_id rst::rasterizer::load_normals(const std::vector<Eigen::Vector3f>& normals)
+rst::tex_buf_id rst::rasterizer::load_texcoords(const std::vector<Eigen::Vector2f>& texcoords)
 {
-    auto id = get_next_id();
-    nor_buf.emplace(id, normals);
-
-    normal_id = id;
+    return {add_stream(texcoords.empty() ? nullptr : texcoords[0].data(), texcoords.size(), 2)};
+}
 
-    return {id};
+rst::nor_buf_id rst::rasterizer::load_normals(const std::vector<Eigen::Vector3f>& normals)
+{
+    return {add_stream(normals.empty() ? nullptr : normals[0].data(), normals.size(), 3)};
 }
 
 
@@ -149,191 +179,643 @@ auto to_vec4(const Eigen::Vector3f& v3, float w = 1.0f)
     return Vector4f(v3.x(), v3.y(), v3.z(), w);
 }
 
-static bool insideTriangle(float x, float y, const Vector4f* _v){// 这里还是一样进行了参数列表的修改
-    Vector3f v[3];
-    for(int i=0;i<3;i++)
-        v[i] = {_v[i].x(),_v[i].y(), 1.0};
-    Vector3f f0,f1,f2;
-    f0 = v[1].cross(v[0]);
-    f1 = v[2].cross(v[1]);
-    f2 = v[0].cross(v[2]);
-    Vector3f p(x,y,1.);
-    if((p.dot(f0)*f0.dot(v[2])>0) && (p.dot(f1)*f1.dot(v[0])>0) && (p.dot(f2)*f2.dot(v[1])>0))
-        return true;
-    return false;
+void rst::rasterizer::draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type,
+                           nor_buf_id nor_buffer, tex_buf_id tex_buffer)
+{
+    if (type != rst::Primitive::Triangle)
+    {
+        throw std::runtime_error("Drawing primitives other than triangle is not implemented yet!");
+    }
+    auto start = std::chrono::steady_clock::now();
+    transform_indexed(pos_buffer, ind_buffer, col_buffer, nor_buffer, tex_buffer);
+    stats.vertex_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (quad_fragment_shader)
+        rasterize_transformed(quad_shading{});
+    else
+        rasterize_transformed([this](const fragment_shader_payload& payload) { return fragment_shader(payload); });
+}
+
+void rst::rasterizer::draw(const std::vector<Triangle>& TriangleList, mesh_handle mesh)
+{
+    if (quad_fragment_shader)
+        draw(TriangleList, quad_shading{}, mesh);
+    else
+        draw(TriangleList, [this](const fragment_shader_payload& payload) { return fragment_shader(payload); }, mesh);
+}
+
+static rst::clip_vertex lerp(const rst::clip_vertex& a, const rst::clip_vertex& b, float s)
+{
+    return {a.pos + s * (b.pos - a.pos),
+            a.view_pos + s * (b.view_pos - a.view_pos),
+            a.normal + s * (b.normal - a.normal),
+            a.tex_coords + s * (b.tex_coords - a.tex_coords),
+            a.color + s * (b.color - a.color)};
 }
 
-static std::tuple<float, float, float> computeBarycentric2D(float x, float y, const Vector4f* v){
-    float c1 = (x*(v[1].y() - v[2].y()) + (v[2].x() - v[1].x())*y + v[1].x()*v[2].y() - v[2].x()*v[1].y()) / (v[0].x()*(v[1].y() - v[2].y()) + (v[2].x() - v[1].x())*v[0].y() + v[1].x()*v[2].y() - v[2].x()*v[1].y());
-    float c2 = (x*(v[2].y() - v[0].y()) + (v[0].x() - v[2].x())*y + v[2].x()*v[0].y() - v[0].x()*v[2].y()) / (v[1].x()*(v[2].y() - v[0].y()) + (v[0].x() - v[2].x())*v[1].y() + v[2].x()*v[0].y() - v[0].x()*v[2].y());
-    float c3 = (x*(v[0].y() - v[1].y()) + (v[1].x() - v[0].x())*y + v[0].x()*v[1].y() - v[1].x()*v[0].y()) / (v[2].x()*(v[0].y() - v[1].y()) + (v[1].x() - v[0].x())*v[2].y() + v[0].x()*v[1].y() - v[1].x()*v[0].y());
-    return {c1,c2,c3};
+// Bit i is set when the point is outside clip plane i: -w <= x, y, z <= w
+static int outcode(float x, float y, float z, float w)
+{
+    return (x < -w ? 1 : 0) | (x > w ? 2 : 0) |
+           (y < -w ? 4 : 0) | (y > w ? 8 : 0) |
+           (z < -w ? 16 : 0) | (z > w ? 32 : 0);
 }
 
-void rst::rasterizer::draw(std::vector<Triangle *> &TriangleList) {
+static int outcode(const Eigen::Vector4f& p)
+{
+    return outcode(p.x(), p.y(), p.z(), p.w());
+}
 
-    float f1 = (50 - 0.1) / 2.0;
-    float f2 = (50 + 0.1) / 2.0;
+// Sutherland-Hodgman against the near plane z <= w; a triangle becomes 0, 3 or 4 vertices.
+static int clip_near(const std::array<rst::clip_vertex, 3>& in, rst::clip_vertex out[4])
+{
+    int n = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        const rst::clip_vertex& a = in[i];
+        const rst::clip_vertex& b = in[(i + 1) % 3];
+        float da = a.pos.w() - a.pos.z();
+        float db = b.pos.w() - b.pos.z();
+        if (da >= 0)
+            out[n++] = a;
+        if ((da >= 0) != (db >= 0))
+            out[n++] = lerp(a, b, da / (da - db));
+    }
+    return n;
+}
 
+Eigen::Matrix4f rst::rasterizer::clip_matrix() const
+{
+    // 这里的投影矩阵把相机前方的点变换到 w < 0，整体乘 -1（齐次坐标不变）之后，
+    // 可见区域就是通常的 -w <= x, y, z <= w，近平面是 z = w
     Eigen::Matrix4f mvp = projection * view * model;
-    for (const auto& t:TriangleList)
+    return projection(3, 2) > 0 ? Eigen::Matrix4f(-mvp) : mvp;
+}
+
+// 删去第 k 列之后的 3x3 行列式，k = 0..3
+static Eigen::Vector4d minors(const Eigen::Matrix<double, 3, 4>& m)
+{
+    Eigen::Vector4d result;
+    for (int k = 0; k < 4; ++k)
     {
-        Triangle newtri = *t;
-
-        std::array<Eigen::Vector4f, 3> mm {
-                (view * model * t->v[0]),
-                (view * model * t->v[1]),
-                (view * model * t->v[2])
-        };//得到相机下的四维坐标
-        
-
-        std::array<Eigen::Vector3f, 3> viewspace_pos;
-        std::transform(mm.begin(), mm.end(), viewspace_pos.begin(), [](auto& v) {
-            return v.template head<3>();
-        });//得到相机下的三维坐标
- 
-        Eigen::Vector4f v[] = {
-                mvp * t->v[0],
-                mvp * t->v[1],
-                mvp * t->v[2]
-        };//计算屏幕坐标
-
-
-        //Homogeneous division
-        for (auto& vec : v) {
-            //std::cout << vec.w() << std::endl;
-            vec.x()/=vec.w();
-            vec.y()/=vec.w();
-            vec.z()/=vec.w();           
-        }//进行了齐次除法，也就是透视除法，视锥体被变换到一个立方体
-
-
-        Eigen::Matrix4f inv_trans = (view * model).inverse().transpose();
-        Eigen::Vector4f n[] = {
-                inv_trans * to_vec4(t->normal[0], 0.0f),
-                inv_trans * to_vec4(t->normal[1], 0.0f),
-                inv_trans * to_vec4(t->normal[2], 0.0f)
-        };//计算变换以后得新法线的方向
-
-        //Viewport transformation
-        for (auto & vert : v)
+        Eigen::Matrix3d sub;
+        for (int c = 0, j = 0; c < 4; ++c)
+            if (c != k)
+                sub.col(j++) = m.col(c);
+        result[k] = sub.determinant();
+    }
+    return result;
+}
+
+rst::mesh_handle rst::rasterizer::register_static_mesh(const std::vector<Triangle>& TriangleList)
+{
+    static_meshes.emplace_back().registered = true;
+    mesh_handle mesh{(int)static_meshes.size() - 1};
+    update_static_mesh(mesh, TriangleList);
+    return mesh;
+}
+
+void rst::rasterizer::update_static_mesh(mesh_handle mesh, const std::vector<Triangle>& TriangleList)
+{
+    // 三个顶点的齐次坐标按行排成 3x4 矩阵，它的 4 个子式就是三角形所在平面，与相机无关
+    mesh_setup& setup = get_static_mesh(mesh);
+    setup.plane.resize(TriangleList.size());
+    for (size_t k = 0; k < TriangleList.size(); ++k)
+    {
+        Eigen::Matrix<double, 3, 4> p;
+        for (int i = 0; i < 3; ++i)
+            p.row(i) = TriangleList[k].v[i].cast<double>().transpose();
+        setup.plane[k] = minors(p).cast<float>();
+    }
+    state_changed = true;
+}
+
+void rst::rasterizer::release_static_mesh(mesh_handle mesh)
+{
+    mesh_setup& setup = get_static_mesh(mesh);
+    setup.registered = false;
+    setup.plane = {};
+}
+
+rst::rasterizer::mesh_setup& rst::rasterizer::get_static_mesh(mesh_handle mesh)
+{
+    if (mesh.mesh_id < 0 || mesh.mesh_id >= (int)static_meshes.size() || !static_meshes[mesh.mesh_id].registered)
+        throw std::runtime_error("no static mesh with id " + std::to_string(mesh.mesh_id));
+    return static_meshes[mesh.mesh_id];
+}
+
+void rst::rasterizer::transform_triangles(const std::vector<Triangle>& TriangleList, mesh_handle mesh) {
+
+    // 矩阵每次 draw 只算一次
+    Eigen::Matrix4f mv = view * model;
+    Eigen::Matrix4f mvp = clip_matrix();
+    Eigen::Matrix4f inv_trans = mv.inverse().transpose();
+
+    /*
+     * 缓存的平面在变换之前做背面剔除。A 是裁剪矩阵的 x, y, w 三行，P 是三个顶点的齐次坐标，
+     * 由 Cauchy-Binet 公式 det(A P^T) = camera . plane，它的符号就是屏幕上三角形面积的符号
+     * （裁剪后的多边形在同一平面上，顶点顺序不变，结论相同）。
+     * 接近 0 的留给 assemble_triangle 按屏幕面积判断，结果和不用缓存时一致。
+     */
+    const mesh_setup* setup = nullptr;
+    Eigen::Vector4f camera;
+    if (mesh.mesh_id >= 0 && cull_mode != CullMode::None)
+    {
+        setup = &get_static_mesh(mesh);
+        if (setup->plane.size() != TriangleList.size())
+            throw std::runtime_error("triangle list of " + std::to_string(TriangleList.size()) + " triangles drawn with static mesh " +
+                                     std::to_string(mesh.mesh_id) + " of " + std::to_string(setup->plane.size()));
+        Eigen::Matrix<double, 3, 4> a;
+        a << mvp.row(0).cast<double>(), mvp.row(1).cast<double>(), mvp.row(3).cast<double>();
+        camera = minors(a).cast<float>();
+    }
+
+    screen_tris.clear();
+    screen_view_pos.clear();
+    // 大多数三角形最多输出一个，预留好之后每帧不再分配
+    screen_tris.reserve(TriangleList.size());
+    screen_view_pos.reserve(TriangleList.size());
+    for (size_t k = 0; k < TriangleList.size(); ++k)
+    {
+        const Triangle& t = TriangleList[k];
+        if (setup)
         {
-            vert.x() = 0.5*width*(vert.x()+1.0);
-            vert.y() = 0.5*height*(vert.y()+1.0);
-            vert.z() = -vert.z() * f1 + f2;//这里要添加一个负号
+            const Eigen::Vector4f& plane = setup->plane[k];
+            float side = camera.dot(plane);
+            float tolerance = 1e-5f * camera.cwiseAbs().dot(plane.cwiseAbs());
+            if (cull_mode == CullMode::Back ? side < -tolerance : side > tolerance)
+            {
+                ++stats.backface_culled;
+                continue;
+            }
         }
 
+        std::array<clip_vertex, 3> clip_tri;
         for (int i = 0; i < 3; ++i)
         {
-            //screen space coordinates
-            newtri.setVertex(i, v[i]);
+            Eigen::Vector4f mm = mv * t.v[i];                           //得到相机下的四维坐标
+            Eigen::Vector4f n = inv_trans * to_vec4(t.normal[i], 0.0f); //计算变换以后得新法线的方向
+            clip_tri[i] = {mvp * t.v[i], mm.head<3>(), n.head<3>(), t.tex_coords[i], vertex_color};
         }
 
-        for (int i = 0; i < 3; ++i)
+        int codes[3] = {outcode(clip_tri[0].pos), outcode(clip_tri[1].pos), outcode(clip_tri[2].pos)};
+        assemble_triangle(clip_tri, codes);
+    }
+}
+
+void rst::rasterizer::transform_indexed(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer,
+                                        nor_buf_id nor_buffer, tex_buf_id tex_buffer)
+{
+    const buffer& pos = get_buffer(pos_buffer.pos_id, 3, "position");
+    const buffer& ind = get_buffer(ind_buffer.ind_id, 0, "index");
+    const buffer& col = get_buffer(col_buffer.col_id, 3, "color");
+    // 没有法线或纹理坐标时用零向量
+    const buffer* nor = nor_buffer.nor_id < 0 ? nullptr : &get_buffer(nor_buffer.nor_id, 3, "normal");
+    const buffer* uv = tex_buffer.tex_id < 0 ? nullptr : &get_buffer(tex_buffer.tex_id, 2, "texture coordinate");
+
+    // 每个属性都要和位置一一对应，索引不能越界；下面按批读取时不再检查
+    for (const buffer* attribute : {&col, nor, uv})
+        if (attribute && attribute->count != pos.count)
+            throw std::runtime_error("vertex attribute count " + std::to_string(attribute->count) +
+                                     " does not match " + std::to_string(pos.count) + " positions");
+    if (ind.max_index >= (int)pos.count)
+        throw std::runtime_error("vertex index " + std::to_string(ind.max_index) + " out of range of " +
+                                 std::to_string(pos.count) + " positions");
+
+    // 矩阵每次 draw 只算一次
+    Eigen::Matrix4f mv = view * model;
+    Eigen::Matrix4f mvp = clip_matrix();
+    Eigen::Matrix4f inv_trans = mv.inverse().transpose();
+
+    // 每个顶点只变换一次，结果按分量分开存放（SoA）。
+    // 一次变换 simd::width 个顶点，各批之间互不相关，多线程并行
+    using simd::vfloat;
+    using simd::set1;
+    vfloat m_clip[4][4], m_view[3][4], m_normal[3][3];
+    for (int r = 0; r < 4; ++r)
+        for (int c = 0; c < 4; ++c)
         {
-            //view space normal
-            newtri.setNormal(i, n[i].head<3>());
+            m_clip[r][c] = set1(mvp(r, c));
+            if (r < 3)
+                m_view[r][c] = set1(mv(r, c));
+            if (r < 3 && c < 3)
+                m_normal[r][c] = set1(inv_trans(r, c));
+        }
+    const vfloat zero = set1(0.0f), one = set1(1.0f), half_width = set1(0.5f * width), half_height = set1(0.5f * height);
+
+    long batches = long((pos.count + simd::width - 1) / simd::width);
+    post_transform.resize(batches * simd::width);
+    int threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+    transformed_vertices& out = post_transform;
+    #pragma omp parallel for schedule(static) num_threads(threads)
+    for (long batch = 0; batch < batches; ++batch)
+    {
+        size_t i = batch * simd::width;
+        vfloat p[3] = {simd::load(&pos.x[i]), simd::load(&pos.y[i]), simd::load(&pos.z[i])};
+        vfloat n[3] = {zero, zero, zero};
+        if (nor)
+        {
+            n[0] = simd::load(&nor->x[i]);
+            n[1] = simd::load(&nor->y[i]);
+            n[2] = simd::load(&nor->z[i]);
+        }
+
+        vfloat clip[4], view_pos[3], normal[3];
+        for (int r = 0; r < 4; ++r)
+            clip[r] = m_clip[r][0] * p[0] + m_clip[r][1] * p[1] + m_clip[r][2] * p[2] + m_clip[r][3];
+        for (int r = 0; r < 3; ++r)
+        {
+            view_pos[r] = m_view[r][0] * p[0] + m_view[r][1] * p[1] + m_view[r][2] * p[2] + m_view[r][3];
+            normal[r] = m_normal[r][0] * n[0] + m_normal[r][1] * n[1] + m_normal[r][2] * n[2];
+        }
+        simd::store(&out.clip_x[i], clip[0]);
+        simd::store(&out.clip_y[i], clip[1]);
+        simd::store(&out.clip_z[i], clip[2]);
+        simd::store(&out.clip_w[i], clip[3]);
+        simd::store(&out.view_x[i], view_pos[0]);
+        simd::store(&out.view_y[i], view_pos[1]);
+        simd::store(&out.view_z[i], view_pos[2]);
+        simd::store(&out.normal_x[i], normal[0]);
+        simd::store(&out.normal_y[i], normal[1]);
+        simd::store(&out.normal_z[i], normal[2]);
+        // 屏幕坐标只用于提前做背面剔除，在近平面后面的顶点上没有意义
+        simd::store(&out.screen_x[i], half_width * (clip[0] / clip[3] + one));
+        simd::store(&out.screen_y[i], half_height * (clip[1] / clip[3] + one));
+        for (int k = 0; k < simd::width; ++k)
+            out.outcode[i + k] = outcode(out.clip_x[i + k], out.clip_y[i + k], out.clip_z[i + k], out.clip_w[i + k]);
+    }
+
+    // 图元装配：按索引取变换好的顶点
+    screen_tris.clear();
+    screen_view_pos.clear();
+    screen_tris.reserve(ind.count);
+    screen_view_pos.reserve(ind.count);
+    for (const Eigen::Vector3i& i : ind.indices)
+    {
+        int codes[3] = {post_transform.outcode[i[0]], post_transform.outcode[i[1]], post_transform.outcode[i[2]]};
+        if (codes[0] & codes[1] & codes[2])
+        {
+            ++stats.frustum_culled;
+            continue;
+        }
+        // 不需要近平面裁剪的三角形，在取顶点属性之前就做背面剔除
+        if (cull_mode != CullMode::None && !((codes[0] | codes[1] | codes[2]) & 32))
+        {
+            const float* sx = post_transform.screen_x.data();
+            const float* sy = post_transform.screen_y.data();
+            float area = (sx[i[1]] - sx[i[0]]) * (sy[i[2]] - sy[i[0]]) - (sx[i[2]] - sx[i[0]]) * (sy[i[1]] - sy[i[0]]);
+            if (cull_mode == CullMode::Back ? area <= 0 : area >= 0)
+            {
+                ++stats.backface_culled;
+                continue;
+            }
+        }
+
+        std::array<clip_vertex, 3> clip_tri;
+        for (int k = 0; k < 3; ++k)
+        {
+            int j = i[k];
+            clip_tri[k] = {{post_transform.clip_x[j], post_transform.clip_y[j], post_transform.clip_z[j], post_transform.clip_w[j]},
+                           {post_transform.view_x[j], post_transform.view_y[j], post_transform.view_z[j]},
+                           {post_transform.normal_x[j], post_transform.normal_y[j], post_transform.normal_z[j]},
+                           uv ? Eigen::Vector2f(uv->x[j], uv->y[j]) : Eigen::Vector2f::Zero(),
+                           {col.x[j], col.y[j], col.z[j]}};
         }
+        assemble_triangle(clip_tri, codes);
+    }
+}
+
+void rst::rasterizer::assemble_triangle(const std::array<clip_vertex, 3>& clip_tri, const int codes[3])
+{
+    float f1 = (50 - 0.1) / 2.0;
+    float f2 = (50 + 0.1) / 2.0;
+
+    // 视锥剔除：三个顶点都在同一个裁剪面外面
+    if (codes[0] & codes[1] & codes[2])
+    {
+        ++stats.frustum_culled;
+        return;
+    }
+
+    // 有顶点在近平面后面才需要裁剪，裁出来的凸多边形再拆成三角形扇
+    clip_vertex poly[4];
+    int count = 3;
+    if ((codes[0] | codes[1] | codes[2]) & 32)
+    {
+        count = clip_near(clip_tri, poly);
+        ++stats.clipped;
+    }
+    else
+        std::copy(clip_tri.begin(), clip_tri.end(), poly);
 
-        newtri.setColor(0, 148,121.0,92.0);
-        newtri.setColor(1, 148,121.0,92.0);
-        newtri.setColor(2, 148,121.0,92.0);
+    //Homogeneous division
+    //Viewport transformation
+    Eigen::Vector4f v[4];
+    for (int i = 0; i < count; ++i)
+    {
+        v[i] = poly[i].pos;
+        v[i].x() /= v[i].w();
+        v[i].y() /= v[i].w();
+        v[i].z() /= v[i].w();
+
+        v[i].x() = 0.5*width*(v[i].x()+1.0);
+        v[i].y() = 0.5*height*(v[i].y()+1.0);
+        v[i].z() = -v[i].z() * f1 + f2;//这里要添加一个负号
+    }
 
-        // Also pass view space vertice position
-        rasterize_triangle(newtri, viewspace_pos);
+    // 背面剔除：屏幕上 y 向上，逆时针（面积为正）的是正面；面积为 0 的退化三角形一起剔除
+    if (cull_mode != CullMode::None)
+    {
+        float area = (v[1].x() - v[0].x()) * (v[2].y() - v[0].y()) - (v[2].x() - v[0].x()) * (v[1].y() - v[0].y());
+        if (cull_mode == CullMode::Back ? area <= 0 : area >= 0)
+        {
+            ++stats.backface_culled;
+            return;
+        }
+    }
+
+    // 直接写进 screen_tris，不经过 Triangle 的 set 函数（在另一个编译单元里，无法内联）
+    for (int k = 1; k + 1 < count; ++k)
+    {
+        Triangle& newtri = screen_tris.emplace_back();
+        std::array<Eigen::Vector3f, 3>& viewspace_pos = screen_view_pos.emplace_back();
+        const int corner[3] = {0, k, k + 1};
+        for (int i = 0; i < 3; ++i)
+        {
+            const clip_vertex& cv = poly[corner[i]];
+            //screen space coordinates
+            newtri.v[i] = v[corner[i]];
+            //view space normal
+            newtri.normal[i] = cv.normal;
+            newtri.tex_coords[i] = cv.tex_coords;
+            newtri.color[i] = cv.color / 255.f;
+            // Also pass view space vertice position
+            viewspace_pos[i] = cv.view_pos;
+        }
+        ++stats.emitted;
     }
 }
 
-static Eigen::Vector3f interpolate(float alpha, float beta, float gamma, const Eigen::Vector3f& vert1, const Eigen::Vector3f& vert2, const Eigen::Vector3f& vert3, float weight)
+void rst::rasterizer::transformed_vertices::resize(size_t n)
 {
-    return (alpha * vert1 + beta * vert2 + gamma * vert3) / weight;
+    for (auto* channel : {&clip_x, &clip_y, &clip_z, &clip_w, &view_x, &view_y, &view_z, &normal_x, &normal_y, &normal_z, &screen_x, &screen_y})
+        channel->resize(n);
+    outcode.resize(n);
 }
 
-static Eigen::Vector2f interpolate(float alpha, float beta, float gamma, const Eigen::Vector2f& vert1, const Eigen::Vector2f& vert2, const Eigen::Vector2f& vert3, float weight)
+void rst::rasterizer::bin_triangles()
 {
-    auto u = (alpha * vert1[0] + beta * vert2[0] + gamma * vert3[0]);
-    auto v = (alpha * vert1[1] + beta * vert2[1] + gamma * vert3[1]);
+    for (auto& bin : tile_bins)
+        bin.clear();
+
+    // Binning: append every triangle to all the tiles its bounding box overlaps.
+    // Triangles are visited in submission order, so every bin stays sorted.
+    // The edge functions are set up here once per triangle, not once per tile.
+    screen_setup.resize(screen_tris.size());
+    for (int i = 0; i < (int)screen_tris.size(); ++i)
+    {
+        const auto& v = screen_tris[i].v;
+        if (!screen_setup[i].setup(v[0].x(), v[0].y(), v[1].x(), v[1].y(), v[2].x(), v[2].y()))
+            continue;
+
+        float min_x = std::min(v[0].x(), std::min(v[1].x(), v[2].x()));
+        float max_x = std::max(v[0].x(), std::max(v[1].x(), v[2].x()));
+        float min_y = std::min(v[0].y(), std::min(v[1].y(), v[2].y()));
+        float max_y = std::max(v[0].y(), std::max(v[1].y(), v[2].y()));
+        if (max_x < 0 || max_y < 0 || min_x >= width || min_y >= height)
+            continue;
+
+        int tx0 = std::max(0, (int)min_x) / tile_size;
+        int tx1 = std::min(width - 1, (int)max_x) / tile_size;
+        int ty0 = std::max(0, (int)min_y) / tile_size;
+        int ty1 = std::min(height - 1, (int)max_y) / tile_size;
+        for (int ty = ty0; ty <= ty1; ++ty)
+            for (int tx = tx0; tx <= tx1; ++tx)
+                tile_bins[ty * tiles_x + tx].push_back(i);
+    }
 
-    u /= weight;
-    v /= weight;
 
-    return Eigen::Vector2f(u, v);
 }
 
-//Screen space rasterization
-void rst::rasterizer::rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos) 
+float rst::rasterizer::nearest_depth(const edge_setup& setup, const float z[3], int x0, int y0, int x1, int y1) const
 {
-    // TODO: From your HW3, get the triangle rasterization code.
-    // TODO: Inside your rasterization loop:
-    //    * v[i].w() is the vertex view space depth value z. //顶点的深度值
-    //    * Z is interpolated view space depth for the current pixel //当前像素的坐标值的深度
-    //    * zp is depth between zNear and zFar, used for z-buffer//zp计算的像素在zNear和zFar之间的深度，使用在z-buffer算法里
-    
-    // float Z = 1.0 / (alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());//alpha beta gamma通过插值函数求出
-    // float zp = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
-    // zp *= Z;
+    // Triangle::toVector4() sets w = 1, so depth is a plane in screen space and its
+    // minimum over the rectangle is at a corner. It never gets nearer than the nearest vertex.
+    int64_t e[3];
+    float bary[3];
+    setup.start(x0, y0, e, bary);
+    float corner = 0, dzdx = 0, dzdy = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        corner += bary[i] * z[i];
+        dzdx += setup.bary_step_x[i] * z[i];
+        dzdy += setup.bary_step_y[i] * z[i];
+    }
+    float nearest = corner + std::min(0.0f, dzdx * (x1 - x0)) + std::min(0.0f, dzdy * (y1 - y0));
+    nearest = std::max(nearest, std::min(z[0], std::min(z[1], z[2])));
+    // leave room for the rounding of the per pixel barycentric stepping
+    return nearest - 1e-4f * (std::abs(nearest) + 1.0f);
+}
 
-    //view_pos: 这里使用的是相机下看到的坐标
+int rst::rasterizer::rasterize_triangle_quads(const Triangle& t, const edge_setup& setup, const std::array<Eigen::Vector3f, 3>& view_pos,
+                                              int min_x, int min_y, int max_x, int max_y, long& helpers)
+{
+    static_assert(tile_size % 2 == 0, "a quad must never straddle two tiles");
 
-    // TODO: Interpolate the attributes:
-    // auto interpolated_color
-    // auto interpolated_normal
-    // auto interpolated_texcoords
-    // auto interpolated_shadingcoords
+    auto v = t.toVector4();
+    int left_x = std::max<int>(min_x, std::min(v[0].x(), std::min(v[1].x(), v[2].x())));
+    int right_x = std::min<int>(max_x, std::max(v[0].x(), std::max(v[1].x(), v[2].x())));
+    int bottom_y = std::max<int>(min_y, std::min(v[0].y(), std::min(v[1].y(), v[2].y())));
+    int top_y = std::min<int>(max_y, std::max(v[0].y(), std::max(v[1].y(), v[2].y())));
+
+    const std::array<Eigen::Vector2f, 2> uv_grad = uv_derivatives(t, setup);
+    float inv_w[3], z_over_w[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        inv_w[i] = 1.0f / v[i].w();
+        z_over_w[i] = v[i].z() / v[i].w();
+    }
 
-    // Use: fragment_shader_payload payload( interpolated_color, interpolated_normal.normalized(), interpolated_texcoords, texture ? &*texture : nullptr);
-    // Use: payload.view_pos = interpolated_shadingcoords;
-    // Use: Instead of passing the triangle's color directly to the frame buffer, pass the color to the shaders first to get the final color;
-    // Use: auto pixel_color = fragment_shader(payload);
-    
+    // 四个像素都先做覆盖和深度测试；没覆盖到或被挡住的是辅助像素，属性照样按重心坐标外插，
+    // 着色只是为了给其它像素求差分，结果丢掉
+    fragment_quad quad;
+    int shaded = 0;
+    for (int quad_y = bottom_y & ~1; quad_y <= top_y; quad_y += 2)
+    {
+        for (int quad_x = left_x & ~1; quad_x <= right_x; quad_x += 2)
+        {
+            int64_t e[3];
+            float bary[3];
+            setup.start(quad_x, quad_y, e, bary);
+            float lane_bary[4][3];
+            int mask = 0;
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                int dx = lane & 1, dy = lane >> 1;
+                int x = quad_x + dx, y = quad_y + dy;
+                int64_t lane_e[3];
+                for (int i = 0; i < 3; ++i)
+                {
+                    lane_e[i] = e[i] + dx * setup.step_x[i] + dy * setup.step_y[i];
+                    lane_bary[lane][i] = bary[i] + dx * setup.bary_step_x[i] + dy * setup.bary_step_y[i];
+                }
+                if (x < left_x || x > right_x || y < bottom_y || y > top_y || !setup.inside(lane_e))
+                    continue;
+                const float* b = lane_bary[lane];
+                float Z = 1.0f / (b[0] * inv_w[0] + b[1] * inv_w[1] + b[2] * inv_w[2]);
+                float zp = (b[0] * z_over_w[0] + b[1] * z_over_w[1] + b[2] * z_over_w[2]) * Z;
+                if (depth_buf.test_and_set(x, y, 0, zp))
+                    mask |= 1 << lane;
+            }
+            if (!mask)
+                continue;
 
-    auto v = t.toVector4();
-    // auto v = t.v;
-       
-    // TODO : Find out the bounding box of current triangle.
-    int bounding_box_left_x = std::min(v[0].x(), std::min(v[1].x(), v[2].x()));
-    int bounding_box_right_x = std::max(v[0].x(), std::max(v[1].x(), v[2].x()));
-    int bounding_box_bottom_y = std::min(v[0].y(), std::min(v[1].y(), v[2].y()));
-    int bounding_box_top_y = std::max(v[0].y(), std::max(v[1].y(), v[2].y()));
-    for (int x = bounding_box_left_x; x <= bounding_box_right_x; x++) {
-        for (int y = bounding_box_bottom_y; y <= bounding_box_top_y; y++) {
-            if (insideTriangle(x + 0.5, y + 0.5, t.v)) {
-                // If so, use the following code to get the interpolated z value.   
-                auto[alpha, beta, gamma] = computeBarycentric2D(1.0 * x + 0.5, 1.0 * y + 0.5, t.v);
-                float Z = 1.0/(alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());
-                // std::cout << Z << std::endl;
-                // 计算正确的深度值
-                float zp = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
-                zp *= Z; //zp是正确的深度值
-
-                // float wk = 1.0/(alpha /w_positive[0] + beta / w_positive[1] + gamma / w_positive[2]);
-                // std::cout << wk << " ";
-                // std::cout << zp << std::endl << std::endl;
-                //计算正确的颜色值
-                
-
-                if (zp <  depth_buf[get_index(x, y)]) {
-                        depth_buf[get_index(x, y)] = zp;
-                    
-                    //auto interpolated_color
-                        auto interpolated_color = interpolate(alpha, beta, gamma, t.color[0], t.color[1], t.color[2], 1.0);
-                        auto interpolated_normal = interpolate(alpha, beta, gamma, t.normal[0], t.normal[1], t.normal[2], 1.0);
-                        auto interpolated_texcoords = interpolate(alpha, beta, gamma, t.tex_coords[0], t.tex_coords[1], t.tex_coords[2], 1.0);
-                        auto interpolated_shadingcoords = interpolate(alpha, beta, gamma, view_pos[0], view_pos[1], view_pos[2], 1.0);
-                        fragment_shader_payload payload( interpolated_color, interpolated_normal.normalized(), interpolated_texcoords, texture ? &*texture : nullptr);
-                        payload.view_pos = interpolated_shadingcoords;
-                        auto pixel_color = fragment_shader(payload);
-                        set_pixel(Eigen::Vector2i(x, y),  pixel_color);
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                const float* b = lane_bary[lane];
+                fragment_shader_payload& payload = quad.lanes[lane];
+                payload.color = interpolate(b[0], b[1], b[2], t.color[0], t.color[1], t.color[2], 1.0);
+                payload.normal = interpolate(b[0], b[1], b[2], t.normal[0], t.normal[1], t.normal[2], 1.0).normalized();
+                payload.tex_coords = interpolate(b[0], b[1], b[2], t.tex_coords[0], t.tex_coords[1], t.tex_coords[2], 1.0);
+                payload.view_pos = interpolate(b[0], b[1], b[2], view_pos[0], view_pos[1], view_pos[2], 1.0);
+                payload.duv_dx = uv_grad[0];
+                payload.duv_dy = uv_grad[1];
+                payload.texture = texture.get();
+                payload.uniforms = uniforms.get();
+                payload.quad = &quad;
+                payload.lane = lane;
+            }
+            quad.mask = mask;
+            std::array<Eigen::Vector3f, 4> colors = quad_fragment_shader(quad);
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                if (mask & (1 << lane))
+                {
+                    frame_buf[get_index(quad_x + (lane & 1), quad_y + (lane >> 1))] = colors[lane];
+                    ++shaded;
                 }
+                else
+                    ++helpers;
             }
         }
-    } 
+    }
+    return shaded;
+}
 
+void rst::rasterizer::resolve_quad(int x, int y, long& shaded, long& helpers)
+{
+    int index[4];
+    int material_id[4];
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        int lane_x = x + (lane & 1), lane_y = y + (lane >> 1);
+        bool on_screen = lane_x < width && lane_y < height;
+        index[lane] = on_screen ? get_index(lane_x, lane_y) : -1;
+        material_id[lane] = on_screen ? gbuffer[index[lane]].material_id : -1;
+    }
 
-} 
+    // 一个 quad 里可能有几种材质，每种材质各着色一次
+    int done = 0;
+    fragment_quad quad;
+    for (int first = 0; first < 4; ++first)
+    {
+        if ((done & (1 << first)) || material_id[first] < 0)
+            continue;
+        deferred_material& material = materials[material_id[first]];
+        int mask = 0;
+        for (int lane = first; lane < 4; ++lane)
+            if (material_id[lane] == material_id[first])
+                mask |= 1 << lane;
+        done |= mask;
+
+        if (!material.quad_shader)
+        {
+            for (int lane = first; lane < 4; ++lane)
+            {
+                if (!(mask & (1 << lane)))
+                    continue;
+                const gbuffer_texel& texel = gbuffer[index[lane]];
+                fragment_shader_payload payload(texel.color, texel.normal, texel.tex_coords, material.texture.get());
+                payload.view_pos = texel.view_pos;
+                payload.duv_dx = texel.duv_dx;
+                payload.duv_dy = texel.duv_dy;
+                payload.uniforms = material.uniforms.get();
+                frame_buf[index[lane]] = material.shader(payload);
+                ++shaded;
+            }
+            continue;
+        }
 
+        // G-buffer 里没有别的像素的属性，辅助像素从 first 出发按纹理坐标的导数外插，其余属性照抄
+        const gbuffer_texel& reference = gbuffer[index[first]];
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            const gbuffer_texel& texel = (mask & (1 << lane)) ? gbuffer[index[lane]] : reference;
+            fragment_shader_payload& payload = quad.lanes[lane];
+            payload = fragment_shader_payload(texel.color, texel.normal, texel.tex_coords, material.texture.get());
+            payload.view_pos = texel.view_pos;
+            payload.duv_dx = texel.duv_dx;
+            payload.duv_dy = texel.duv_dy;
+            payload.uniforms = material.uniforms.get();
+            if (!(mask & (1 << lane)))
+                payload.tex_coords += float((lane & 1) - (first & 1)) * texel.duv_dx +
+                                      float((lane >> 1) - (first >> 1)) * texel.duv_dy;
+            payload.quad = &quad;
+            payload.lane = lane;
+        }
+        quad.mask = mask;
+        std::array<Eigen::Vector3f, 4> colors = material.quad_shader(quad);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            if (mask & (1 << lane))
+            {
+                frame_buf[index[lane]] = colors[lane];
+                ++shaded;
+            }
+            else
+                ++helpers;
+        }
+    }
+}
 
+void rst::rasterizer::resolve()
+{
+    if (shading_mode != ShadingMode::Deferred)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    // 每个像素只着色一次，按 2x2 的 quad 走；各行 quad 互不相关，按行并行
+    int threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+    long shaded = 0, helpers = 0;
+    #pragma omp parallel for schedule(dynamic, 8) num_threads(threads) reduction(+:shaded, helpers)
+    for (int y = 0; y < height; y += 2)
+    {
+        for (int x = 0; x < width; x += 2)
+            resolve_quad(x, y, shaded, helpers);
+    }
+    stats.shader_invocations += shaded;
+    stats.helper_lanes += helpers;
+    stats.resolve_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
+void rst::rasterizer::set_shading_mode(ShadingMode mode)
+{
+    // 前向着色用不到 G-buffer，每像素 64 字节，等真正切到延迟着色时再分配
+    if (mode == ShadingMode::Deferred && gbuffer.empty())
+        gbuffer.resize(width * height);
+    shading_mode = mode;
+    state_changed = true;
+}
+
+bool rst::rasterizer::frame_changed()
+{
+    if (!state_changed && model == frame_model && view == frame_view && projection == frame_projection)
+        return false;
+    frame_model = model;
+    frame_view = view;
+    frame_projection = projection;
+    state_changed = false;
+    return true;
+}
 
 void rst::rasterizer::set_model(const Eigen::Matrix4f& m)
 {
@@ -350,45 +832,75 @@ void rst::rasterizer::set_projection(const Eigen::Matrix4f& p)
     projection = p;
 }
 
+cv::Mat rst::rasterizer::output_image()
+{
+    output_buf.resize(frame_buf.size() * output_channels);
+    quantize_bgr(frame_buf.data(), output_buf.data(), frame_buf.size(), output_channels);
+    return cv::Mat(height, width, output_channels == 4 ? CV_8UC4 : CV_8UC3, output_buf.data());
+}
+
 void rst::rasterizer::clear(rst::Buffers buff)
 {
     if ((buff & rst::Buffers::Color) == rst::Buffers::Color)
     {
         std::fill(frame_buf.begin(), frame_buf.end(), Eigen::Vector3f{0, 0, 0});
+        // resolve 只看 material_id，其余属性留着上一帧的也不会被读到
+        for (gbuffer_texel& texel : gbuffer)
+            texel.material_id = -1;
+        materials.clear();
+        stats = frame_stats{};
     }
     if ((buff & rst::Buffers::Depth) == rst::Buffers::Depth)
     {
-        std::fill(depth_buf.begin(), depth_buf.end(), std::numeric_limits<float>::infinity());
+        depth_buf.clear();
     }
 }
 
 rst::rasterizer::rasterizer(int w, int h) : width(w), height(h)
 {
     frame_buf.resize(w * h);
-    depth_buf.resize(w * h);
+    depth_buf.resize(w, h, 1);
+    // draw 的视口变换把深度映射到 [0.1, 50]
+    depth_buf.set_range(0.1f, 50.0f);
 
-    texture = std::nullopt;
-}
+    tiles_x = (w + tile_size - 1) / tile_size;
+    tiles_y = (h + tile_size - 1) / tile_size;
+    tile_bins.resize(tiles_x * tiles_y);
 
-int rst::rasterizer::get_index(int x, int y)
-{
-    return (height-y)*width + x;
+    texture = nullptr;
+    uniforms = std::make_shared<const uniform_block>();
 }
 
 void rst::rasterizer::set_pixel(const Vector2i &point, const Eigen::Vector3f &color)
 {
     //old index: auto ind = point.y() + point.x() * width;
-    int ind = (height-point.y())*width + point.x();
+    int ind = (height-1-point.y())*width + point.x();
     frame_buf[ind] = color;
 }
 
 void rst::rasterizer::set_vertex_shader(std::function<Eigen::Vector3f(vertex_shader_payload)> vert_shader)
 {
     vertex_shader = vert_shader;
+    state_changed = true;
 }
 
-void rst::rasterizer::set_fragment_shader(std::function<Eigen::Vector3f(fragment_shader_payload)> frag_shader)
+void rst::rasterizer::set_fragment_shader(std::function<Eigen::Vector3f(const fragment_shader_payload&)> frag_shader)
 {
     fragment_shader = frag_shader;
+    state_changed = true;
+}
+
+void rst::rasterizer::set_uniforms(const uniform_block& block)
+{
+    auto updated = std::make_shared<uniform_block>(block);
+    updated->update();
+    uniforms = std::move(updated);
+    state_changed = true;
+}
+
+void rst::rasterizer::set_quad_fragment_shader(quad_fragment_shader_fn quad_shader)
+{
+    quad_fragment_shader = quad_shader;
+    state_changed = true;
 }
 
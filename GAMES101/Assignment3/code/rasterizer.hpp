@@ -6,11 +6,19 @@
 
 #include <eigen3/Eigen/Eigen>
 #include <optional>
+#include <memory>
+#include <type_traits>
+#include <chrono>
 #include <algorithm>
 #include "global.hpp"
 #include "Shader.hpp"
 #include "Triangle.hpp"
 #include "Texture.hpp"
+#include "EdgeFunction.hpp"
+#include "DepthBuffer.hpp"
+#include "Simd.hpp"
+#include "FrameExport.hpp"
+#include <omp.h>
 using namespace Eigen;
 
 namespace rst
@@ -37,6 +45,71 @@ namespace rst
         Triangle
     };
 
+    // Scalar tests one pixel at a time, SIMD tests simd::width pixels of a row at once
+    enum class RasterMode
+    {
+        Scalar,
+        SIMD
+    };
+
+    // Forward shades every fragment that passes the depth test. Deferred only writes the
+    // G-buffer while rasterizing and shades each covered pixel once in resolve().
+    enum class ShadingMode
+    {
+        Forward,
+        Deferred
+    };
+
+    // Which side of a triangle is thrown away before rasterization. Front faces are
+    // counter clockwise on screen, as in the OBJ files.
+    enum class CullMode
+    {
+        None,
+        Back,
+        Front
+    };
+
+    // Counters of the current frame, reset by clear(Buffers::Color)
+    struct frame_stats
+    {
+        long frustum_culled = 0;  // triangles completely outside the view frustum
+        long backface_culled = 0; // including zero area triangles
+        long clipped = 0;         // triangles cut by the near plane
+        long emitted = 0;         // triangles sent to the rasterizer, after clipping
+        long shader_invocations = 0;
+        long fragments = 0;       // pixels that passed the depth test, forward or G-buffer
+        double vertex_ms = 0;     // time spent transforming and assembling triangles
+        double setup_ms = 0;      // edge function setup and binning
+        double raster_ms = 0;     // coverage, depth test and forward shading / G-buffer writes
+        double resolve_ms = 0;    // deferred shading in resolve()
+        long helper_lanes = 0;    // quad shading: lanes shaded only to take derivatives
+    };
+
+    // Shades the four lanes of a 2x2 quad at once, see fragment_quad
+    using quad_fragment_shader_fn = std::function<std::array<Eigen::Vector3f, 4>(const fragment_quad&)>;
+
+    // One pixel of the G-buffer
+    struct gbuffer_texel
+    {
+        Eigen::Vector3f color = Eigen::Vector3f::Zero();
+        Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+        Eigen::Vector3f view_pos = Eigen::Vector3f::Zero();
+        Eigen::Vector2f tex_coords = Eigen::Vector2f::Zero();
+        Eigen::Vector2f duv_dx = Eigen::Vector2f::Zero(), duv_dy = Eigen::Vector2f::Zero();
+        int material_id = -1; // -1: nothing was drawn here
+    };
+
+    // A vertex between the MVP and the viewport transform, with everything the near plane
+    // clipper has to interpolate. pos is in clip space, color in [0, 255].
+    struct clip_vertex
+    {
+        Eigen::Vector4f pos;
+        Eigen::Vector3f view_pos;
+        Eigen::Vector3f normal;
+        Eigen::Vector2f tex_coords;
+        Eigen::Vector3f color;
+    };
+
     /*
      * For the curious : The draw function takes two buffer id's as its arguments. These two structs
      * make sure that if you mix up with their orders, the compiler won't compile it.
@@ -57,6 +130,23 @@ namespace rst
         int col_id = 0;
     };
 
+    // Optional vertex attributes of the indexed draw; the default -1 means none (zero vectors)
+    struct nor_buf_id
+    {
+        int nor_id = -1;
+    };
+
+    struct tex_buf_id
+    {
+        int tex_id = -1;
+    };
+
+    // A triangle list registered with rasterizer::register_static_mesh(); the default -1 is none
+    struct mesh_handle
+    {
+        int mesh_id = -1;
+    };
+
     class rasterizer
     {
     public:
@@ -64,30 +154,205 @@ namespace rst
         pos_buf_id load_positions(const std::vector<Eigen::Vector3f>& positions);
         ind_buf_id load_indices(const std::vector<Eigen::Vector3i>& indices);
         col_buf_id load_colors(const std::vector<Eigen::Vector3f>& colors);
-        col_buf_id load_normals(const std::vector<Eigen::Vector3f>& normals);
+        nor_buf_id load_normals(const std::vector<Eigen::Vector3f>& normals);
+        tex_buf_id load_texcoords(const std::vector<Eigen::Vector2f>& texcoords);
 
         void set_model(const Eigen::Matrix4f& m);
         void set_view(const Eigen::Matrix4f& v);
         void set_projection(const Eigen::Matrix4f& p);
 
-        void set_texture(Texture tex) { texture = tex; }
+        void set_texture(Texture tex) { texture = std::make_shared<Texture>(std::move(tex)); state_changed = true; }
+        // Lights, material and camera of the following draws
+        void set_uniforms(const uniform_block& block);
+        const uniform_block& get_uniforms() const { return *uniforms; }
 
         void set_vertex_shader(std::function<Eigen::Vector3f(vertex_shader_payload)> vert_shader);
-        void set_fragment_shader(std::function<Eigen::Vector3f(fragment_shader_payload)> frag_shader);
+        void set_fragment_shader(std::function<Eigen::Vector3f(const fragment_shader_payload&)> frag_shader);
+        // While a quad shader is set, draw(TriangleList) and the indexed draw shade 2x2 quads
+        // with it instead of calling the fragment shader per pixel, so it can take screen
+        // space derivatives of anything it computes. Quads are rasterized by the scalar
+        // path whatever the raster mode. Pass nullptr to go back.
+        void set_quad_fragment_shader(quad_fragment_shader_fn quad_shader);
 
         void set_pixel(const Vector2i &point, const Eigen::Vector3f &color);
 
+        // 0 uses the OpenMP default (one thread per core)
+        void set_num_threads(int n) { num_threads = n; }
+        void set_raster_mode(RasterMode mode) { raster_mode = mode; }
+        // The G-buffer is allocated the first time Deferred is selected and kept after that
+        void set_shading_mode(ShadingMode mode);
+        void set_cull_mode(CullMode mode) { cull_mode = mode; state_changed = true; }
+        // Rejects 8x8 blocks that are hidden behind what is already drawn. Off by default: on
+        // the bundled models it rejects almost nothing and the per block bookkeeping costs more
+        // than it saves. Change it only right before a clear of the depth buffer.
+        void set_hierarchical_z(bool enable) { hierarchical_z = enable; depth_buf.set_tile_bounds(enable); }
+        // Storage format of the depth buffer. The SIMD raster path needs Float32 and falls
+        // back to the scalar path for the other formats.
+        void set_depth_format(DepthFormat format) { depth_buf.set_format(format); state_changed = true; }
+
+        // Static triangle lists: register_static_mesh() computes the object space plane of
+        // every triangle once, and a draw of the list with the returned handle culls back faces
+        // against those planes before any vertex is transformed. Call update_static_mesh()
+        // after changing the list and release_static_mesh() when it is no longer drawn; the
+        // handle is not valid after that. Drawing with a handle that is not valid, or with a
+        // list of a different size than the registered one, throws std::runtime_error.
+        mesh_handle register_static_mesh(const std::vector<Triangle>& TriangleList);
+        void update_static_mesh(mesh_handle mesh, const std::vector<Triangle>& TriangleList);
+        void release_static_mesh(mesh_handle mesh);
+
+        // Call once per frame after setting the matrices. Returns false when neither the
+        // matrices nor any other state the image depends on changed since the last frame it
+        // returned true for, so the caller can skip clear() and draw() and show the previous
+        // frame buffer again. Assumes a frame is drawn with one set of matrices.
+        bool frame_changed();
+        size_t depth_bytes() const { return depth_buf.bytes(); }
+        int depth_plane_tiles() const { return depth_buf.plane_tiles(); }
+
         void clear(Buffers buff);
 
-        void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type);
-        void draw(std::vector<Triangle *> &TriangleList);
+        // Indexed path: every vertex of the position buffer is transformed once. The color,
+        // normal and texture coordinate buffers need one entry per position and the indices
+        // must lie in the position buffer, otherwise it throws std::runtime_error.
+        void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type,
+                  nor_buf_id nor_buffer = {}, tex_buf_id tex_buffer = {});
+        // Triangle list path over a contiguous triangle stream. Screen space triangles go
+        // into per-frame buffers that keep their capacity, so a frame does no heap allocation
+        // once they have grown. Runtime selected path: shades with whatever
+        // set_fragment_shader() was given. Pass the handle of a registered list to cull with
+        // its cached planes.
+        void draw(const std::vector<Triangle>& TriangleList, mesh_handle mesh = {});
+        // Compile time bound path: the shader type is a template parameter, so a lambda or
+        // functor is inlined into the raster loop, e.g.
+        //     r.draw(TriangleList, [](const fragment_shader_payload& p) { return phong_fragment_shader(p); });
+        template <typename FragmentShader>
+        void draw(const std::vector<Triangle>& TriangleList, const FragmentShader& shader, mesh_handle mesh = {});
+
+        // Deferred mode: shades the G-buffer into the frame buffer, one shader call per
+        // covered pixel. Does nothing in forward mode.
+        void resolve();
 
         std::vector<Eigen::Vector3f>& frame_buffer() { return frame_buf; }
 
+        // 3 for BGR, 4 for BGRA with an opaque alpha
+        void set_output_channels(int channels) { output_channels = channels; }
+        // Quantizes the frame buffer into the 8-bit output buffer in OpenCV's channel order and
+        // returns a cv::Mat that views it without a copy, ready for imshow/imwrite. The view is
+        // valid until the next call.
+        cv::Mat output_image();
+
+        const frame_stats& frame_statistics() const { return stats; }
+
     private:
         void draw_line(Eigen::Vector3f begin, Eigen::Vector3f end);
 
-        void rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos);
+        // MVP of every triangle of the list / of every indexed vertex, then assemble_triangle()
+        void transform_triangles(const std::vector<Triangle>& TriangleList, mesh_handle mesh);
+        void transform_indexed(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer,
+                               nor_buf_id nor_buffer, tex_buf_id tex_buffer);
+        // Culling, near plane clipping, homogeneous division and viewport transform of one
+        // triangle into screen_tris
+        void assemble_triangle(const std::array<clip_vertex, 3>& clip_tri, const int codes[3]);
+        // projection * view * model, with the sign flipped so visible points have w > 0
+        Eigen::Matrix4f clip_matrix() const;
+        // Sets up the edge functions of screen_tris and sorts them into the tile bins
+        void bin_triangles();
+
+        // Per triangle data of a static list that does not depend on the camera
+        struct mesh_setup
+        {
+            bool registered = false;
+            // 3x3 minors of the 4x3 matrix of the homogeneous object space vertices: the
+            // triangle's plane. Dotted with the minors of the x, y, w rows of the clip matrix
+            // it gives the sign of the triangle's area on screen.
+            std::vector<Eigen::Vector4f> plane;
+        };
+        mesh_setup& get_static_mesh(mesh_handle mesh);
+
+        // Bins and rasterizes screen_tris, or fills the G-buffer in deferred mode
+        template <typename FragmentShader>
+        void rasterize_transformed(const FragmentShader& shader);
+
+        // Rasterizes the tiles in parallel. A tile only ever touches its own slice of
+        // frame_buf/depth_buf, and keeps the submission order of its triangles, so the
+        // result matches the serial path.
+        template <typename FragmentShader>
+        void rasterize_tiles(const FragmentShader& shader);
+
+        // The rasterize_* functions return the number of pixels they shaded.
+        template <typename FragmentShader>
+        int rasterize_triangle(const FragmentShader& shader, const Triangle& t, const edge_setup& setup,
+                                const std::array<Eigen::Vector3f, 3>& world_pos,
+                                int min_x, int min_y, int max_x, int max_y);
+        // Evaluates coverage, depth and the depth test for simd::width pixels at once and
+        // only shades the lanes that survive the depth test.
+        template <typename FragmentShader>
+        int rasterize_triangle_simd(const FragmentShader& shader, const Triangle& t, const edge_setup& setup,
+                                     const std::array<Eigen::Vector3f, 3>& view_pos,
+                                     int min_x, int min_y, int max_x, int max_y);
+        // Hierarchical z: a conservative bound of the nearest depth of the triangle over the
+        // pixels [x0, x1] x [y0, y1], compared with the depth buffer's tile_max().
+        float nearest_depth(const edge_setup& setup, const float z[3], int x0, int y0, int x1, int y1) const;
+        // Kept out of line so the raster loop stays small; the shader is inlined in here.
+        // With a gbuffer_writer as the shader it stores the attributes instead of shading.
+        template <typename FragmentShader>
+        [[gnu::noinline]] void shade_pixel(const FragmentShader& shader, const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos,
+                         const std::array<Eigen::Vector2f, 2>& uv_grad, int x, int y, float alpha, float beta, float gamma);
+        // Walks the triangle in 2x2 quads aligned to even pixels and shades every quad with a
+        // covered lane with quad_fragment_shader; helper lanes are counted in helpers.
+        int rasterize_triangle_quads(const Triangle& t, const edge_setup& setup, const std::array<Eigen::Vector3f, 3>& view_pos,
+                                     int min_x, int min_y, int max_x, int max_y, long& helpers);
+        // Deferred resolve of the 2x2 quad at (x, y), x and y even
+        void resolve_quad(int x, int y, long& shaded, long& helpers);
+
+        // Stand-in shader for the deferred pre-pass
+        struct gbuffer_writer
+        {
+            int material_id;
+        };
+
+        // Stand-in shader that selects rasterize_triangle_quads()
+        struct quad_shading
+        {
+        };
+
+        // What resolve() needs to shade the pixels of one deferred draw: either a per pixel
+        // or a quad shader
+        struct deferred_material
+        {
+            std::function<Eigen::Vector3f(const fragment_shader_payload&)> shader;
+            quad_fragment_shader_fn quad_shader;
+            std::shared_ptr<Texture> texture;
+            std::shared_ptr<const uniform_block> uniforms;
+        };
+
+        // Post-transform buffer of the indexed path, one entry per vertex, one array per component
+        struct transformed_vertices
+        {
+            std::vector<float> clip_x, clip_y, clip_z, clip_w;
+            std::vector<float> view_x, view_y, view_z;
+            std::vector<float> normal_x, normal_y, normal_z;
+            std::vector<float> screen_x, screen_y;
+            std::vector<int> outcode;
+
+            void resize(size_t n);
+        };
+
+        // One loaded buffer, addressed by its id: vertex attributes as one float stream per
+        // component (z stays empty for texture coordinates), or the triangle indices. The
+        // streams are zero padded to a multiple of stream_padding so the vertex stage can
+        // always load whole SIMD batches.
+        struct buffer
+        {
+            size_t count = 0;
+            int components = 0; // 0 for indices
+            std::vector<float> x, y, z;
+            std::vector<Eigen::Vector3i> indices;
+            int max_index = -1;
+        };
+        static constexpr int stream_padding = 8;
+        int add_stream(const float* data, size_t count, int components);
+        // The buffer behind an id, checked to exist and to hold that many components
+        const buffer& get_buffer(int id, int components, const char* kind) const;
 
         // VERTEX SHADER -> MVP -> Clipping -> /.W -> VIEWPORT -> DRAWLINE/DRAWTRI -> FRAGSHADER
 
@@ -96,25 +361,368 @@ namespace rst
         Eigen::Matrix4f view;
         Eigen::Matrix4f projection;
 
-        int normal_id = -1;
-
-        std::map<int, std::vector<Eigen::Vector3f>> pos_buf;
-        std::map<int, std::vector<Eigen::Vector3i>> ind_buf;
-        std::map<int, std::vector<Eigen::Vector3f>> col_buf;
-        std::map<int, std::vector<Eigen::Vector3f>> nor_buf;
+        // all the *_buf_id index this table
+        std::vector<buffer> buffers;
+        transformed_vertices post_transform;
 
-        std::optional<Texture> texture;
+        // shared with the deferred materials, so recording one per draw does not copy the texture
+        std::shared_ptr<Texture> texture;
+        // shared with the deferred materials the same way; replaced, never changed in place
+        std::shared_ptr<const uniform_block> uniforms;
 
-        std::function<Eigen::Vector3f(fragment_shader_payload)> fragment_shader;
+        std::function<Eigen::Vector3f(const fragment_shader_payload&)> fragment_shader;
+        quad_fragment_shader_fn quad_fragment_shader;
         std::function<Eigen::Vector3f(vertex_shader_payload)> vertex_shader;
 
+        // indexed by mesh_handle; released entries stay as empty placeholders, so a stale
+        // handle never names another mesh
+        std::vector<mesh_setup> static_meshes;
+
+        // matrices of the last frame frame_changed() returned true for
+        Eigen::Matrix4f frame_model, frame_view, frame_projection;
+        bool state_changed = true;
+
         std::vector<Eigen::Vector3f> frame_buf;
-        std::vector<float> depth_buf;
-        int get_index(int x, int y);
+        std::vector<uint8_t> output_buf;
+        int output_channels = 3;
+        depth_buffer depth_buf;
+        // empty until the first set_shading_mode(Deferred)
+        std::vector<gbuffer_texel> gbuffer;
+        std::vector<deferred_material> materials;
+        int get_index(int x, int y) const { return (height-1-y)*width + x; }
 
         int width, height;
 
-        int next_id = 0;
-        int get_next_id() { return next_id++; }
+        static constexpr int tile_size = 64;
+        int tiles_x, tiles_y;
+        static constexpr int hiz_size = depth_buffer::tile; // must divide tile_size
+        bool hierarchical_z = false;
+        int num_threads = 0;
+        RasterMode raster_mode = RasterMode::Scalar;
+        ShadingMode shading_mode = ShadingMode::Forward;
+        CullMode cull_mode = CullMode::Back;
+        frame_stats stats;
+
+        // vertex color of the triangles of draw(TriangleList)
+        Eigen::Vector3f vertex_color{148, 121.0, 92.0};
+
+        // screen space triangles of the current draw and the per tile lists of their indices
+        std::vector<Triangle> screen_tris;
+        std::vector<std::array<Eigen::Vector3f, 3>> screen_view_pos;
+        std::vector<edge_setup> screen_setup;
+        std::vector<std::vector<int>> tile_bins;
+
     };
+
+    inline Eigen::Vector3f interpolate(float alpha, float beta, float gamma, const Eigen::Vector3f& vert1, const Eigen::Vector3f& vert2, const Eigen::Vector3f& vert3, float weight)
+    {
+        return (alpha * vert1 + beta * vert2 + gamma * vert3) / weight;
+    }
+
+    inline Eigen::Vector2f interpolate(float alpha, float beta, float gamma, const Eigen::Vector2f& vert1, const Eigen::Vector2f& vert2, const Eigen::Vector2f& vert3, float weight)
+    {
+        auto u = (alpha * vert1[0] + beta * vert2[0] + gamma * vert3[0]);
+        auto v = (alpha * vert1[1] + beta * vert2[1] + gamma * vert3[1]);
+
+        u /= weight;
+        v /= weight;
+
+        return Eigen::Vector2f(u, v);
+    }
+
+    // Screen space derivatives of the texture coordinates for texture LOD. Attributes are
+    // interpolated affinely in screen space, so they are constant over a triangle and equal
+    // to the differences across any 2x2 pixel quad.
+    inline std::array<Eigen::Vector2f, 2> uv_derivatives(const Triangle& t, const edge_setup& setup)
+    {
+        std::array<Eigen::Vector2f, 2> d = {Eigen::Vector2f::Zero(), Eigen::Vector2f::Zero()};
+        for (int i = 0; i < 3; ++i)
+        {
+            d[0] += setup.bary_step_x[i] * t.tex_coords[i];
+            d[1] += setup.bary_step_y[i] * t.tex_coords[i];
+        }
+        return d;
+    }
+
+    template <typename FragmentShader>
+    void rasterizer::draw(const std::vector<Triangle>& TriangleList, const FragmentShader& shader, mesh_handle mesh)
+    {
+        auto start = std::chrono::steady_clock::now();
+        transform_triangles(TriangleList, mesh);
+        stats.vertex_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        rasterize_transformed(shader);
+    }
+
+    template <typename FragmentShader>
+    void rasterizer::rasterize_transformed(const FragmentShader& shader)
+    {
+        if constexpr (!std::is_same_v<FragmentShader, gbuffer_writer>)
+        {
+            if (shading_mode == ShadingMode::Deferred)
+            {
+                if constexpr (std::is_same_v<FragmentShader, quad_shading>)
+                    materials.push_back({nullptr, quad_fragment_shader, texture, uniforms});
+                else
+                    materials.push_back({shader, nullptr, texture, uniforms});
+                rasterize_transformed(gbuffer_writer{(int)materials.size() - 1});
+                return;
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        bin_triangles();
+        auto binned = std::chrono::steady_clock::now();
+        rasterize_tiles(shader);
+        stats.setup_ms += std::chrono::duration<double, std::milli>(binned - start).count();
+        stats.raster_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - binned).count();
+    }
+
+    template <typename FragmentShader>
+    void rasterizer::rasterize_tiles(const FragmentShader& shader)
+    {
+        int threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+        long shaded = 0, helpers = 0;
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(threads) reduction(+:shaded, helpers)
+        for (int tile = 0; tile < tiles_x * tiles_y; ++tile)
+        {
+            int min_x = (tile % tiles_x) * tile_size;
+            int min_y = (tile / tiles_x) * tile_size;
+            int max_x = std::min(min_x + tile_size, width) - 1;
+            int max_y = std::min(min_y + tile_size, height) - 1;
+            for (int i : tile_bins[tile])
+            {
+                if constexpr (std::is_same_v<FragmentShader, quad_shading>)
+                    shaded += rasterize_triangle_quads(screen_tris[i], screen_setup[i], screen_view_pos[i], min_x, min_y, max_x, max_y, helpers);
+                else if (raster_mode == RasterMode::SIMD && depth_buf.get_format() == DepthFormat::Float32)
+                    shaded += rasterize_triangle_simd(shader, screen_tris[i], screen_setup[i], screen_view_pos[i], min_x, min_y, max_x, max_y);
+                else
+                    shaded += rasterize_triangle(shader, screen_tris[i], screen_setup[i], screen_view_pos[i], min_x, min_y, max_x, max_y);
+            }
+        }
+        stats.fragments += shaded;
+        stats.helper_lanes += helpers;
+        // the pre-pass only fills the G-buffer, resolve() counts the real shader calls
+        if constexpr (!std::is_same_v<FragmentShader, gbuffer_writer>)
+            stats.shader_invocations += shaded;
+    }
+
+    template <typename FragmentShader>
+    int rasterizer::rasterize_triangle(const FragmentShader& shader, const Triangle& t, const edge_setup& setup,
+                                        const std::array<Eigen::Vector3f, 3>& view_pos,
+                                        int min_x, int min_y, int max_x, int max_y)
+    {
+        // TODO: From your HW3, get the triangle rasterization code.
+        // TODO: Inside your rasterization loop:
+        //    * v[i].w() is the vertex view space depth value z. //顶点的深度值
+        //    * Z is interpolated view space depth for the current pixel //当前像素的坐标值的深度
+        //    * zp is depth between zNear and zFar, used for z-buffer//zp计算的像素在zNear和zFar之间的深度，使用在z-buffer算法里
+    
+        // float Z = 1.0 / (alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());//alpha beta gamma通过插值函数求出
+        // float zp = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
+        // zp *= Z;
+
+        //view_pos: 这里使用的是相机下看到的坐标
+
+        // TODO: Interpolate the attributes:
+        // auto interpolated_color
+        // auto interpolated_normal
+        // auto interpolated_texcoords
+        // auto interpolated_shadingcoords
+
+        // Use: fragment_shader_payload payload( interpolated_color, interpolated_normal.normalized(), interpolated_texcoords, texture ? &*texture : nullptr);
+        // Use: payload.view_pos = interpolated_shadingcoords;
+        // Use: Instead of passing the triangle's color directly to the frame buffer, pass the color to the shaders first to get the final color;
+        // Use: auto pixel_color = fragment_shader(payload);
+    
+
+        auto v = t.toVector4();
+        // auto v = t.v;
+       
+        // TODO : Find out the bounding box of current triangle.
+        // 包围盒裁剪到当前tile的范围内
+        int bounding_box_left_x = std::max<int>(min_x, std::min(v[0].x(), std::min(v[1].x(), v[2].x())));
+        int bounding_box_right_x = std::min<int>(max_x, std::max(v[0].x(), std::max(v[1].x(), v[2].x())));
+        int bounding_box_bottom_y = std::max<int>(min_y, std::min(v[0].y(), std::min(v[1].y(), v[2].y())));
+        int bounding_box_top_y = std::min<int>(max_y, std::max(v[0].y(), std::max(v[1].y(), v[2].y())));
+
+        // 每个顶点的 z/w 和 1/w 在三角形内是常量，提前算好；纹理坐标的屏幕空间导数也是
+        const std::array<Eigen::Vector2f, 2> uv_grad = uv_derivatives(t, setup);
+        float inv_w[3], z_over_w[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            inv_w[i] = 1.0f / v[i].w();
+            z_over_w[i] = v[i].z() / v[i].w();
+        }
+
+        // 按 8x8 的块扫描：块内最近的深度都比 hi-z 记录的最远深度还远，整块跳过，不做任何重心坐标计算
+        // 块内逐行扫描：每行开头算一次边函数，之后每个像素只做加法
+        int shaded = 0;
+        for (int block_y = bounding_box_bottom_y; block_y <= bounding_box_top_y; block_y = (block_y / hiz_size + 1) * hiz_size) {
+            int block_top_y = std::min(bounding_box_top_y, (block_y / hiz_size + 1) * hiz_size - 1);
+            for (int block_x = bounding_box_left_x; block_x <= bounding_box_right_x; block_x = (block_x / hiz_size + 1) * hiz_size) {
+                int block_right_x = std::min(bounding_box_right_x, (block_x / hiz_size + 1) * hiz_size - 1);
+                if (hierarchical_z) {
+                    float block_max = depth_buf.tile_max(block_x / hiz_size, block_y / hiz_size);
+                    if (std::isfinite(block_max) && nearest_depth(setup, z_over_w, block_x, block_y, block_right_x, block_top_y) >= block_max)
+                        continue;
+                }
+
+                // 整块被覆盖且更近时深度块只存平面，块内不再逐像素做深度测试
+                bool covered = depth_buf.try_plane(setup, z_over_w, block_x / hiz_size, block_y / hiz_size);
+                int written = 0;
+                for (int y = block_y; y <= block_top_y; y++) {
+                    int64_t e[3];
+                    float bary[3];
+                    setup.start(block_x, y, e, bary);
+                    for (int x = block_x; x <= block_right_x; x++) {
+                        if (covered || setup.inside(e)) {
+                            float alpha = bary[0], beta = bary[1], gamma = bary[2];
+                            float Z = 1.0/(alpha * inv_w[0] + beta * inv_w[1] + gamma * inv_w[2]);
+                            // 计算正确的深度值
+                            float zp = alpha * z_over_w[0] + beta * z_over_w[1] + gamma * z_over_w[2];
+                            zp *= Z; //zp是正确的深度值
+
+                            if (covered || depth_buf.test_and_set(x, y, 0, zp)) {
+                                    shade_pixel(shader, t, view_pos, uv_grad, x, y, alpha, beta, gamma);
+                                    ++written;
+                            }
+                        }
+                        for (int i = 0; i < 3; ++i) {
+                            e[i] += setup.step_x[i];
+                            bary[i] += setup.bary_step_x[i];
+                        }
+                    }
+                }
+                shaded += written;
+            }
+        }
+        return shaded;
+    }
+
+    template <typename FragmentShader>
+    int rasterizer::rasterize_triangle_simd(const FragmentShader& shader, const Triangle& t, const edge_setup& setup,
+                                             const std::array<Eigen::Vector3f, 3>& view_pos,
+                                             int min_x, int min_y, int max_x, int max_y)
+    {
+        using simd::vfloat;
+        using simd::set1;
+
+        auto v = t.toVector4();
+        int left_x = std::max<int>(min_x, std::min(v[0].x(), std::min(v[1].x(), v[2].x())));
+        int right_x = std::min<int>(max_x, std::max(v[0].x(), std::max(v[1].x(), v[2].x())));
+        int bottom_y = std::max<int>(min_y, std::min(v[0].y(), std::min(v[1].y(), v[2].y())));
+        int top_y = std::min<int>(max_y, std::max(v[0].y(), std::max(v[1].y(), v[2].y())));
+
+        // Per lane offsets of the biased edge functions, and per lane barycentric steps.
+        int64_t lane_offset[3][simd::width];
+        vfloat bary_lane_step[3];
+        vfloat inv_w[3], z_over_w[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int k = 0; k < simd::width; ++k)
+                lane_offset[i][k] = setup.bias[i] + k * setup.step_x[i];
+            bary_lane_step[i] = simd::lane_index() * set1(setup.bary_step_x[i]);
+            inv_w[i] = set1(1.0f / v[i].w());
+            z_over_w[i] = set1(v[i].z() / v[i].w());
+        }
+        const vfloat one = set1(1.0f);
+        const std::array<Eigen::Vector2f, 2> uv_grad = uv_derivatives(t, setup);
+        int shaded = 0;
+
+        float plane_z[3] = {v[0].z() / v[0].w(), v[1].z() / v[1].w(), v[2].z() / v[2].w()};
+
+        for (int block_y = bottom_y; block_y <= top_y; block_y = (block_y / hiz_size + 1) * hiz_size) {
+            int block_top_y = std::min(top_y, (block_y / hiz_size + 1) * hiz_size - 1);
+            for (int block_x = left_x; block_x <= right_x; block_x = (block_x / hiz_size + 1) * hiz_size) {
+                int block_right_x = std::min(right_x, (block_x / hiz_size + 1) * hiz_size - 1);
+                if (hierarchical_z) {
+                    float block_max = depth_buf.tile_max(block_x / hiz_size, block_y / hiz_size);
+                    if (std::isfinite(block_max) && nearest_depth(setup, plane_z, block_x, block_y, block_right_x, block_top_y) >= block_max)
+                        continue;
+                }
+
+                int written = 0;
+                for (int y = block_y; y <= block_top_y; y++) {
+                    int64_t e[3];
+                    float bary[3];
+                    setup.start(block_x, y, e, bary);
+                    const float* depth_row = depth_buf.float_row(y);
+
+                    for (int x = block_x; x <= block_right_x; x += simd::width) {
+                        int lanes = std::min(simd::width, block_right_x - x + 1);
+                        int mask = simd::coverage(e, lane_offset) & ((1 << lanes) - 1);
+                        if (mask) {
+                            vfloat alpha = set1(bary[0]) + bary_lane_step[0];
+                            vfloat beta = set1(bary[1]) + bary_lane_step[1];
+                            vfloat gamma = set1(bary[2]) + bary_lane_step[2];
+                            vfloat Z = one / (alpha * inv_w[0] + beta * inv_w[1] + gamma * inv_w[2]);
+                            vfloat zp = (alpha * z_over_w[0] + beta * z_over_w[1] + gamma * z_over_w[2]) * Z;
+
+                            // the last group of a block may stick out of the bounding box, never read past it
+                            vfloat depth;
+                            if (lanes == simd::width) {
+                                depth = simd::load(depth_row + x);
+                            } else {
+                                float tail[simd::width];
+                                for (int k = 0; k < simd::width; ++k)
+                                    tail[k] = k < lanes ? depth_row[x + k] : 0.0f;
+                                depth = simd::load(tail);
+                            }
+                            mask &= simd::less(zp, depth);
+
+                            if (mask) {
+                                float lane_zp[simd::width], lane_alpha[simd::width], lane_beta[simd::width], lane_gamma[simd::width];
+                                simd::store(lane_zp, zp);
+                                simd::store(lane_alpha, alpha);
+                                simd::store(lane_beta, beta);
+                                simd::store(lane_gamma, gamma);
+                                for (int k = 0; k < lanes; ++k) {
+                                    if (mask & (1 << k)) {
+                                        depth_buf.set_float(x + k, y, lane_zp[k]);
+                                        shade_pixel(shader, t, view_pos, uv_grad, x + k, y, lane_alpha[k], lane_beta[k], lane_gamma[k]);
+                                        ++written;
+                                    }
+                                }
+                            }
+                        }
+                        for (int i = 0; i < 3; ++i) {
+                            e[i] += simd::width * setup.step_x[i];
+                            bary[i] += simd::width * setup.bary_step_x[i];
+                        }
+                    }
+                }
+                shaded += written;
+            }
+        }
+        return shaded;
+    }
+
+    template <typename FragmentShader>
+    void rasterizer::shade_pixel(const FragmentShader& shader, const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos,
+                                 const std::array<Eigen::Vector2f, 2>& uv_grad, int x, int y, float alpha, float beta, float gamma)
+    {
+        if constexpr (std::is_same_v<FragmentShader, gbuffer_writer>)
+        {
+            auto& texel = gbuffer[get_index(x, y)];
+            texel.color = interpolate(alpha, beta, gamma, t.color[0], t.color[1], t.color[2], 1.0);
+            texel.normal = interpolate(alpha, beta, gamma, t.normal[0], t.normal[1], t.normal[2], 1.0).normalized();
+            texel.view_pos = interpolate(alpha, beta, gamma, view_pos[0], view_pos[1], view_pos[2], 1.0);
+            texel.tex_coords = interpolate(alpha, beta, gamma, t.tex_coords[0], t.tex_coords[1], t.tex_coords[2], 1.0);
+            texel.duv_dx = uv_grad[0];
+            texel.duv_dy = uv_grad[1];
+            texel.material_id = shader.material_id;
+        }
+        else
+        {
+            auto interpolated_color = interpolate(alpha, beta, gamma, t.color[0], t.color[1], t.color[2], 1.0);
+            auto interpolated_normal = interpolate(alpha, beta, gamma, t.normal[0], t.normal[1], t.normal[2], 1.0);
+            auto interpolated_texcoords = interpolate(alpha, beta, gamma, t.tex_coords[0], t.tex_coords[1], t.tex_coords[2], 1.0);
+            auto interpolated_shadingcoords = interpolate(alpha, beta, gamma, view_pos[0], view_pos[1], view_pos[2], 1.0);
+            fragment_shader_payload payload( interpolated_color, interpolated_normal.normalized(), interpolated_texcoords, texture.get());
+            payload.view_pos = interpolated_shadingcoords;
+            payload.duv_dx = uv_grad[0];
+            payload.duv_dy = uv_grad[1];
+            payload.uniforms = uniforms.get();
+            frame_buf[get_index(x, y)] = shader(payload);
+        }
+    }
 }
@@ -0,0 +1,428 @@
+//
+// Runtime-degree fallbacks and the multi-curve batch of Bezier.hpp.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+#include "Bezier.hpp"
+
+namespace
+{
+    // 次数过高时用的缓冲区，每个线程一份，只增不减，所以稳定之后不再分配
+    template <typename T>
+    T* thread_scratch(size_t size)
+    {
+        thread_local std::vector<T> scratch;
+        if (scratch.size() < size)
+            scratch.resize(size);
+        return scratch.data();
+    }
+
+    cv::Point2f de_casteljau_generic(const cv::Point2f* points, int count, float t, float* x, float* y)
+    {
+        for (int k = 0; k < count; ++k)
+        {
+            x[k] = points[k].x;
+            y[k] = points[k].y;
+        }
+        const float u = 1.0f - t;
+        for (int level = count - 1; level > 0; --level)
+        {
+            for (int k = 0; k < level; ++k)
+            {
+                x[k] = u * x[k] + t * x[k + 1];
+                y[k] = u * y[k] + t * y[k + 1];
+            }
+        }
+        return {x[0], y[0]};
+    }
+
+    void evaluate_generic(const cv::Point2f* points, int point_count, const float* t, int count, cv::Point2f* out,
+                          curve::simd::vfloat* x, curve::simd::vfloat* y)
+    {
+        using namespace curve::simd;
+        int i = 0;
+        for (; i + width <= count; i += width)
+        {
+            vfloat s = load(t + i);
+            vfloat u = set1(1.0f) - s;
+            for (int k = 0; k < point_count; ++k)
+            {
+                x[k] = set1(points[k].x);
+                y[k] = set1(points[k].y);
+            }
+            for (int level = point_count - 1; level > 0; --level)
+            {
+                for (int k = 0; k < level; ++k)
+                {
+                    x[k] = u * x[k] + s * x[k + 1];
+                    y[k] = u * y[k] + s * y[k + 1];
+                }
+            }
+            float xs[width], ys[width];
+            store(xs, x[0]);
+            store(ys, y[0]);
+            for (int lane = 0; lane < width; ++lane)
+                out[i + lane] = {xs[lane], ys[lane]};
+        }
+        for (; i < count; ++i)
+            out[i] = curve::de_casteljau(points, point_count, t[i]);
+    }
+
+    // 在 t = 0.5 处把控制多边形分成左右两半；right 兼作每一层的中点数组。有理曲线用齐次坐标，做法一样
+    template <typename Point>
+    void split_half(const Point* points, int count, Point* left, Point* right)
+    {
+        std::copy(points, points + count, right);
+        for (int i = 0; i < count; ++i)
+        {
+            left[i] = right[0];
+            for (int k = 0; k < count - 1 - i; ++k)
+                right[k] = 0.5f * (right[k] + right[k + 1]);
+        }
+    }
+
+    // 内部控制点到首尾连线段的距离都不超过 tolerance
+    bool is_flat(const cv::Point2f* points, int count, float tolerance)
+    {
+        const cv::Point2f a = points[0];
+        const cv::Point2f chord = points[count - 1] - a;
+        const float length2 = chord.x * chord.x + chord.y * chord.y;
+        const float tolerance2 = tolerance * tolerance;
+        for (int k = 1; k < count - 1; ++k)
+        {
+            cv::Point2f d = points[k] - a;
+            // 投影夹到线段上：共线但超出端点的控制点也要算进去
+            float s = length2 > 0 ? std::min(std::max((d.x * chord.x + d.y * chord.y) / length2, 0.0f), 1.0f) : 0.0f;
+            float dx = d.x - s * chord.x, dy = d.y - s * chord.y;
+            if (dx * dx + dy * dy > tolerance2)
+                return false;
+        }
+        return true;
+    }
+
+    // scratch 每层用 2 * count 个点，右半在左半递归的时候保持不动
+    int subdivide(const cv::Point2f* points, int count, float tolerance, int depth, cv::Point2f* scratch,
+                  std::vector<cv::Point2f>& polyline)
+    {
+        if (depth == 0 || is_flat(points, count, tolerance))
+        {
+            polyline.push_back(points[count - 1]);
+            return 0;
+        }
+        cv::Point2f* left = scratch;
+        cv::Point2f* right = scratch + count;
+        split_half(points, count, left, right);
+        int splits = 1;
+        splits += subdivide(left, count, tolerance, depth - 1, scratch + 2 * count, polyline);
+        splits += subdivide(right, count, tolerance, depth - 1, scratch + 2 * count, polyline);
+        return splits;
+    }
+
+    // 有理曲线：在齐次坐标里细分，投影之后的控制点判断平坦（权重为正时曲线在它们的凸包里）
+    int subdivide_rational(const cv::Point3f* points, int count, float tolerance, int depth, cv::Point3f* scratch,
+                           cv::Point2f* projected, std::vector<cv::Point2f>& polyline)
+    {
+        for (int k = 0; k < count; ++k)
+            projected[k] = {points[k].x / points[k].z, points[k].y / points[k].z};
+        if (depth == 0 || is_flat(projected, count, tolerance))
+        {
+            polyline.push_back(projected[count - 1]);
+            return 0;
+        }
+        cv::Point3f* left = scratch;
+        cv::Point3f* right = scratch + count;
+        split_half(points, count, left, right);
+        int splits = 1;
+        splits += subdivide_rational(left, count, tolerance, depth - 1, scratch + 2 * count, projected, polyline);
+        splits += subdivide_rational(right, count, tolerance, depth - 1, scratch + 2 * count, projected, polyline);
+        return splits;
+    }
+}
+
+cv::Point2f curve::de_casteljau(const cv::Point2f* points, int count, float t)
+{
+    // 七次以内的曲线走完全展开的模板版本
+    switch (count)
+    {
+        case 1: return points[0];
+        case 2: return de_casteljau<1>(points, t);
+        case 3: return de_casteljau<2>(points, t);
+        case 4: return de_casteljau<3>(points, t);
+        case 5: return de_casteljau<4>(points, t);
+        case 6: return de_casteljau<5>(points, t);
+        case 7: return de_casteljau<6>(points, t);
+        case 8: return de_casteljau<7>(points, t);
+        default: break;
+    }
+    if (count <= max_stack_degree + 1)
+    {
+        float x[max_stack_degree + 1], y[max_stack_degree + 1];
+        return de_casteljau_generic(points, count, t, x, y);
+    }
+    float* scratch = thread_scratch<float>(2 * size_t(count));
+    return de_casteljau_generic(points, count, t, scratch, scratch + count);
+}
+
+void curve::evaluate(const cv::Point2f* points, int point_count, const float* t, int count, cv::Point2f* out)
+{
+    switch (point_count)
+    {
+        case 1: std::fill(out, out + count, points[0]); return;
+        case 2: evaluate<1>(points, t, count, out); return;
+        case 3: evaluate<2>(points, t, count, out); return;
+        case 4: evaluate<3>(points, t, count, out); return;
+        case 5: evaluate<4>(points, t, count, out); return;
+        case 6: evaluate<5>(points, t, count, out); return;
+        case 7: evaluate<6>(points, t, count, out); return;
+        case 8: evaluate<7>(points, t, count, out); return;
+        default: break;
+    }
+    if (point_count <= max_stack_degree + 1)
+    {
+        simd::vfloat x[max_stack_degree + 1], y[max_stack_degree + 1];
+        evaluate_generic(points, point_count, t, count, out, x, y);
+        return;
+    }
+    simd::vfloat* scratch = thread_scratch<simd::vfloat>(2 * size_t(point_count));
+    evaluate_generic(points, point_count, t, count, out, scratch, scratch + point_count);
+}
+
+void curve::evaluate_curves(const cv::Point2f* points, int point_count, int curve_count,
+                            const float* t, int count, cv::Point2f* out, int num_threads)
+{
+    int threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+#pragma omp parallel for schedule(dynamic, 64) num_threads(threads)
+    for (int c = 0; c < curve_count; ++c)
+        evaluate(points + size_t(c) * point_count, point_count, t, count, out + size_t(c) * count);
+}
+
+int curve::flatten(const cv::Point2f* points, int count, float tolerance, std::vector<cv::Point2f>& polyline, int max_depth)
+{
+    polyline.push_back(points[0]);
+    if (count < 2)
+        return 0;
+    cv::Point2f* scratch = thread_scratch<cv::Point2f>(2 * size_t(count) * max_depth);
+    return subdivide(points, count, tolerance, max_depth, scratch, polyline);
+}
+
+namespace
+{
+    // 三次曲线的幂基系数：B(t) = a t^3 + b t^2 + c t + d
+    template <typename T>
+    void cubic_coefficients(const T p[4], T& a, T& b, T& c, T& d)
+    {
+        a = -p[0] + 3 * p[1] - 3 * p[2] + p[3];
+        b = 3 * p[0] - 6 * p[1] + 3 * p[2];
+        c = -3 * p[0] + 3 * p[1];
+        d = p[0];
+    }
+
+    // 整数除法，四舍五入（远离零）；被除数用 128 位，差分的分子超过 64 位
+    int64_t round_div(__int128 value, int64_t divisor)
+    {
+        return int64_t(value >= 0 ? (value + divisor / 2) / divisor : -((-value + divisor / 2) / divisor));
+    }
+
+    // 定点数差分的小数位数：±32768 px 的坐标和差分都还在 64 位以内
+    constexpr int fraction_bits = 40;
+
+    // 舍入到 16.16
+    int32_t to_16_16(int64_t value)
+    {
+        return int32_t((value + (int64_t(1) << (fraction_bits - 17))) >> (fraction_bits - 16));
+    }
+}
+
+void curve::forward_difference_cubic(const cv::Point2f* points, int steps, cv::Point2f* out)
+{
+    // 差分在 float 里累加一千步会漂 0.02 px 左右，用 double 累加，每步还是三次加法
+    double h = 1.0 / steps;
+    double x[4] = {points[0].x, points[1].x, points[2].x, points[3].x};
+    double y[4] = {points[0].y, points[1].y, points[2].y, points[3].y};
+    double ax, bx, cx, dx, ay, by, cy, dy;
+    cubic_coefficients(x, ax, bx, cx, dx);
+    cubic_coefficients(y, ay, by, cy, dy);
+
+    // 步长 h 的前向差分：一阶 a h^3 + b h^2 + c h，二阶 6 a h^3 + 2 b h^2，三阶 6 a h^3
+    double h2 = h * h, h3 = h2 * h;
+    double fx = dx, d1x = ax * h3 + bx * h2 + cx * h, d2x = 6 * ax * h3 + 2 * bx * h2, d3x = 6 * ax * h3;
+    double fy = dy, d1y = ay * h3 + by * h2 + cy * h, d2y = 6 * ay * h3 + 2 * by * h2, d3y = 6 * ay * h3;
+    for (int i = 0; i < steps; ++i)
+    {
+        out[i] = {float(fx), float(fy)};
+        fx += d1x;
+        d1x += d2x;
+        d2x += d3x;
+        fy += d1y;
+        d1y += d2y;
+        d2y += d3y;
+    }
+    // 最后一个点直接用端点，不带累积误差
+    out[steps] = points[3];
+}
+
+void curve::forward_difference_cubic_fixed(const cv::Point2f* points, int steps, fixed_point* out)
+{
+    // 控制点只在这里用一次浮点：llround 的结果在任何机器上都一样，后面全是整数运算
+    int64_t x[4], y[4];
+    for (int k = 0; k < 4; ++k)
+    {
+        x[k] = std::llround(std::ldexp(double(points[k].x), fraction_bits));
+        y[k] = std::llround(std::ldexp(double(points[k].y), fraction_bits));
+    }
+    int64_t ax, bx, cx, dx, ay, by, cy, dy;
+    cubic_coefficients(x, ax, bx, cx, dx);
+    cubic_coefficients(y, ay, by, cy, dy);
+
+    // 每个差分通分到 n^3 只舍入一次，误差不会被 6 倍、2 倍放大
+    const int64_t n = steps, n3 = n * n * n;
+    auto differences = [&](int64_t a, int64_t b, int64_t c, int64_t d[3]) {
+        __int128 a128 = a, b128 = b, c128 = c;
+        d[0] = round_div(a128 + b128 * n + c128 * n * n, n3);
+        d[1] = round_div(6 * a128 + 2 * b128 * n, n3);
+        d[2] = round_div(6 * a128, n3);
+    };
+    int64_t ddx[3], ddy[3];
+    differences(ax, bx, cx, ddx);
+    differences(ay, by, cy, ddy);
+    int64_t fx = dx, d1x = ddx[0], d2x = ddx[1], d3x = ddx[2];
+    int64_t fy = dy, d1y = ddy[0], d2y = ddy[1], d3y = ddy[2];
+    for (int i = 0; i < steps; ++i)
+    {
+        out[i] = {to_16_16(fx), to_16_16(fy)};
+        fx += d1x;
+        d1x += d2x;
+        d2x += d3x;
+        fy += d1y;
+        d1y += d2y;
+        d2y += d3y;
+    }
+    out[steps] = {to_16_16(x[3]), to_16_16(y[3])};
+}
+
+int curve::forward_difference_cubic_adaptive(const cv::Point2f* points, float max_step, std::vector<cv::Point2f>& out)
+{
+    float x[4] = {points[0].x, points[1].x, points[2].x, points[3].x};
+    float y[4] = {points[0].y, points[1].y, points[2].y, points[3].y};
+    float ax, bx, cx, dx, ay, by, cy, dy;
+    cubic_coefficients(x, ax, bx, cx, dx);
+    cubic_coefficients(y, ay, by, cy, dy);
+
+    // 参数用整数记录，步长总是 2 的幂个单位，这样正好停在 t = 1
+    const int end = 1 << 24;
+    int position = 0, step = end;
+    // 步长 h = 1 时的差分
+    cv::Point2f f = {dx, dy};
+    cv::Point2f d1 = {ax + bx + cx, ay + by + cy};
+    cv::Point2f d2 = {6 * ax + 2 * bx, 6 * ay + 2 * by};
+    cv::Point2f d3 = {6 * ax, 6 * ay};
+
+    auto too_long = [&] { return std::max(std::abs(d1.x), std::abs(d1.y)) > max_step; };
+    auto too_short = [&] { return std::max(std::abs(d1.x), std::abs(d1.y)) < 0.5f * max_step; };
+
+    size_t first = out.size();
+    out.push_back(f);
+    while (position < end)
+    {
+        // 步长减半：d1 = d1/2 - d2/8 + d3/16，d2 = d2/4 - d3/8，d3 = d3/8
+        while (too_long() && step > 1)
+        {
+            // 先更新 d3、d2，再用新的 d2：d1/2 - (d2/4 - d3/8)/2 正好是 d1/2 - d2/8 + d3/16
+            d3 = 0.125f * d3;
+            d2 = 0.25f * d2 - d3;
+            d1 = 0.5f * d1 - 0.5f * d2;
+            step >>= 1;
+        }
+        // 步长加倍：d1 = 2 d1 + d2，d2 = 4 d2 + 4 d3，d3 = 8 d3；只在对齐并且不越过终点时
+        while (too_short() && position % (2 * step) == 0 && position + 2 * step <= end)
+        {
+            d1 = 2.0f * d1 + d2;
+            d2 = 4.0f * d2 + 4.0f * d3;
+            d3 = 8.0f * d3;
+            step <<= 1;
+        }
+        f = f + d1;
+        d1 = d1 + d2;
+        d2 = d2 + d3;
+        position += step;
+        out.push_back(position == end ? points[3] : f);
+    }
+    return int(out.size() - first);
+}
+
+int curve::flatten_rational(const cv::Point3f* points, int count, float tolerance, std::vector<cv::Point2f>& polyline, int max_depth)
+{
+    polyline.push_back({points[0].x / points[0].z, points[0].y / points[0].z});
+    if (count < 2)
+        return 0;
+    cv::Point3f* scratch = thread_scratch<cv::Point3f>(2 * size_t(count) * max_depth);
+    cv::Point2f* projected = thread_scratch<cv::Point2f>(count);
+    return subdivide_rational(points, count, tolerance, max_depth, scratch, projected, polyline);
+}
+
+/*
+ * Piegl & Tiller, The NURBS Book, A5.6：依次把每个内部节点插入到重数等于次数，
+ * 相邻两段 Bezier 的控制点在节点处分开。alphas 只和节点有关，两个坐标和权重共用。
+ */
+int curve::decompose_bspline(const cv::Point3f* points, int count, int degree, const float* knots,
+                             std::vector<cv::Point3f>& beziers)
+{
+    const int p = degree, m = count + p;
+    size_t first = beziers.size();
+    beziers.insert(beziers.end(), points, points + p + 1);
+    float* alphas = thread_scratch<float>(p + 1);
+    int a = p, b = p + 1, pieces = 0;
+    while (b < m)
+    {
+        cv::Point3f* piece = &beziers[first + size_t(pieces) * (p + 1)];
+        int i = b;
+        while (b < m && knots[b + 1] == knots[b])
+            ++b;
+        int multiplicity = b - i + 1;
+        bool more = b < m;
+        if (more)
+        {
+            // 下一段的控制点先占位，插入节点的时候会写进去
+            beziers.resize(beziers.size() + p + 1);
+            piece = &beziers[first + size_t(pieces) * (p + 1)];
+        }
+        cv::Point3f* next = piece + p + 1;
+        if (multiplicity < p)
+        {
+            float numerator = knots[b] - knots[a];
+            for (int j = p; j > multiplicity; --j)
+                alphas[j - multiplicity - 1] = numerator / (knots[a + j] - knots[a]);
+            int r = p - multiplicity;
+            for (int j = 1; j <= r; ++j)
+            {
+                int save = r - j, s = multiplicity + j;
+                for (int k = p; k >= s; --k)
+                {
+                    float alpha = alphas[k - s];
+                    piece[k] = alpha * piece[k] + (1.0f - alpha) * piece[k - 1];
+                }
+                if (more)
+                    next[save] = piece[p];
+            }
+        }
+        ++pieces;
+        if (more)
+        {
+            for (int k = p - multiplicity; k <= p; ++k)
+                next[k] = points[b - p + k];
+            a = b;
+            ++b;
+        }
+    }
+    return pieces;
+}
+
+std::vector<float> curve::uniform_parameters(int count)
+{
+    std::vector<float> t(count);
+    for (int i = 0; i < count; ++i)
+        t[i] = float(i) / float(count - 1);
+    return t;
+}
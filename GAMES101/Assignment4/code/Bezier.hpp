@@ -0,0 +1,162 @@
+//
+// de Casteljau evaluation of Bezier curves without heap allocations.
+//
+
+#ifndef BEZIER_BEZIER_H
+#define BEZIER_BEZIER_H
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "Simd.hpp"
+
+namespace curve
+{
+    // Curves up to this degree are evaluated in a stack buffer, higher degrees in a
+    // per-thread buffer that only ever grows.
+    constexpr int max_stack_degree = 31;
+
+    /*
+     * Point at t of the Bezier curve with Degree + 1 control points. Iterative de Casteljau
+     * on a copy of the coordinates on the stack: every level overwrites the first entries in
+     * place, and the loop bounds are compile-time constants, so it unrolls completely.
+     * */
+    template <int Degree>
+    inline cv::Point2f de_casteljau(const cv::Point2f* points, float t)
+    {
+        static_assert(Degree >= 0 && Degree <= max_stack_degree, "higher degrees go through the runtime overload");
+        float x[Degree + 1], y[Degree + 1];
+        for (int k = 0; k <= Degree; ++k)
+        {
+            x[k] = points[k].x;
+            y[k] = points[k].y;
+        }
+        const float u = 1.0f - t;
+        for (int level = Degree; level > 0; --level)
+        {
+            for (int k = 0; k < level; ++k)
+            {
+                x[k] = u * x[k] + t * x[k + 1];
+                y[k] = u * y[k] + t * y[k + 1];
+            }
+        }
+        return {x[0], y[0]};
+    }
+
+    // Same for a degree only known at run time: count >= 1 control points.
+    cv::Point2f de_casteljau(const cv::Point2f* points, int count, float t);
+
+    /*
+     * Evaluates one curve at count parameters t[0..count) into out. simd::width parameters
+     * run side by side, one per lane, through the same de Casteljau levels; the leftover
+     * parameters take the scalar path.
+     * */
+    template <int Degree>
+    void evaluate(const cv::Point2f* points, const float* t, int count, cv::Point2f* out)
+    {
+        using namespace simd;
+        static_assert(Degree >= 0 && Degree <= max_stack_degree, "higher degrees go through the runtime overload");
+        int i = 0;
+        for (; i + width <= count; i += width)
+        {
+            vfloat s = load(t + i);
+            vfloat u = set1(1.0f) - s;
+            vfloat x[Degree + 1], y[Degree + 1];
+            for (int k = 0; k <= Degree; ++k)
+            {
+                x[k] = set1(points[k].x);
+                y[k] = set1(points[k].y);
+            }
+            for (int level = Degree; level > 0; --level)
+            {
+                for (int k = 0; k < level; ++k)
+                {
+                    x[k] = u * x[k] + s * x[k + 1];
+                    y[k] = u * y[k] + s * y[k + 1];
+                }
+            }
+            float xs[width], ys[width];
+            store(xs, x[0]);
+            store(ys, y[0]);
+            for (int lane = 0; lane < width; ++lane)
+                out[i + lane] = {xs[lane], ys[lane]};
+        }
+        for (; i < count; ++i)
+            out[i] = de_casteljau<Degree>(points, t[i]);
+    }
+
+    // Same for a degree only known at run time: point_count >= 1 control points.
+    void evaluate(const cv::Point2f* points, int point_count, const float* t, int count, cv::Point2f* out);
+
+    /*
+     * Evaluates curve_count curves of point_count control points each, stored one after
+     * another in points, at the same count parameters: out[c * count + i] is curve c at t[i].
+     * The curves are spread over num_threads threads (0 uses all of them).
+     * */
+    void evaluate_curves(const cv::Point2f* points, int point_count, int curve_count,
+                         const float* t, int count, cv::Point2f* out, int num_threads = 0);
+
+    /*
+     * Flattens the curve with count control points into a polyline that stays within
+     * tolerance of the curve (in the units of the points, pixels here). The curve is split at
+     * t = 0.5 until the inner control points are within tolerance of the chord segment -- the
+     * curve lies in their convex hull -- or max_depth splits deep. Appends the vertices to
+     * polyline, starting with the first control point. Returns the number of splits, i.e.
+     * the de Casteljau passes spent.
+     * */
+    int flatten(const cv::Point2f* points, int count, float tolerance, std::vector<cv::Point2f>& polyline, int max_depth = 16);
+
+    /*
+     * Same for a rational curve whose control points are given in homogeneous form
+     * (w x, w y, w) with w > 0: the subdivision runs on the homogeneous points and the
+     * flatness test on the projected ones, which bound the curve just the same.
+     * */
+    int flatten_rational(const cv::Point3f* points, int count, float tolerance, std::vector<cv::Point2f>& polyline, int max_depth = 16);
+
+    /*
+     * Splits a B-spline of the given degree with count homogeneous control points and
+     * count + degree + 1 clamped knots into Bezier pieces by knot insertion. Appends
+     * degree + 1 control points per piece to beziers and returns the number of pieces.
+     * For a NURBS the points are (w x, w y, w); for a plain B-spline w = 1.
+     * */
+    int decompose_bspline(const cv::Point3f* points, int count, int degree, const float* knots,
+                          std::vector<cv::Point3f>& beziers);
+
+    /*
+     * Cubic curve (4 control points) at t = 0, 1 / steps, ..., 1 into out[0..steps] by forward
+     * differencing: after the setup every point costs three vector additions. The
+     * differences are accumulated in double, which keeps the drift after 1000 steps on a
+     * 700 px curve below 1e-4 px.
+     * */
+    void forward_difference_cubic(const cv::Point2f* points, int steps, cv::Point2f* out);
+
+    // 16.16 fixed point
+    struct fixed_point
+    {
+        int32_t x, y;
+    };
+
+    inline cv::Point2f to_float(fixed_point p) { return {p.x / 65536.0f, p.y / 65536.0f}; }
+
+    /*
+     * Same in integer arithmetic: the control points are rounded to 2^-40 px once, the
+     * differences are set up and stepped in 64-bit integers with 40 fraction bits, and each
+     * point is rounded to 16.16. The result is bit-identical on every machine and compiler.
+     * Coordinates must stay within +-32768 px and steps at most 2^20; the stepping error is about
+     * steps^3 / 12 * 2^-40 px per axis, 1e-4 px at 1024 steps.
+     * */
+    void forward_difference_cubic_fixed(const cv::Point2f* points, int steps, fixed_point* out);
+
+    /*
+     * Adaptive forward differencing of a cubic: the step is halved while the next point would
+     * be more than max_step away in x or y, and doubled while it would stay under half of it,
+     * by rescaling the three differences in place. Appends the points, both ends included, to
+     * out and returns how many were appended.
+     * */
+    int forward_difference_cubic_adaptive(const cv::Point2f* points, float max_step, std::vector<cv::Point2f>& out);
+
+    // count >= 2 evenly spaced parameters from 0 to 1, both included
+    std::vector<float> uniform_parameters(int count);
+}
+
+#endif //BEZIER_BEZIER_H
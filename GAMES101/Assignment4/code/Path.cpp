@@ -0,0 +1,341 @@
+//
+// Path file loader and batch path renderer.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <omp.h>
+#include "Path.hpp"
+#include "Bezier.hpp"
+
+namespace
+{
+    // 把整个文件切成记号，逐个读取；数字前面没有命令时沿用上一个命令
+    class path_parser
+    {
+    public:
+        explicit path_parser(std::istream& in)
+        {
+            std::string line;
+            while (std::getline(in, line))
+            {
+                line = line.substr(0, line.find('#'));
+                std::replace(line.begin(), line.end(), ',', ' ');
+                std::istringstream words(line);
+                std::string word;
+                while (words >> word)
+                    tokens.push_back(word);
+            }
+        }
+
+        curve::path_scene parse()
+        {
+            scene.styles.push_back({});
+            char command = 0;
+            while (pos < tokens.size())
+            {
+                const std::string& token = tokens[pos];
+                if (is_number(token))
+                {
+                    // 只有路径命令可以省略重复的命令字母，M 之后的坐标对是直线
+                    if (command != 'M' && command != 'L' && command != 'Q' && command != 'C')
+                        fail("number without a command");
+                    path_command(command == 'M' ? 'L' : command);
+                    continue;
+                }
+                ++pos;
+                if (token == "size")
+                {
+                    scene.width = (int)number();
+                    scene.height = (int)number();
+                    if (scene.width <= 0 || scene.height <= 0)
+                        fail("bad image size");
+                }
+                else if (token == "stroke")
+                {
+                    curve::stroke_style style;
+                    style.width = number();
+                    float r = number(), g = number(), b = number();
+                    style.color = {cv::saturate_cast<uchar>(b), cv::saturate_cast<uchar>(g), cv::saturate_cast<uchar>(r)};
+                    if (style.width <= 0)
+                        fail("bad stroke width");
+                    scene.styles.push_back(style);
+                }
+                else if (token == "M" || token == "L" || token == "Q" || token == "C")
+                {
+                    command = token[0];
+                    path_command(command);
+                }
+                else if (token == "Z" || token == "z")
+                {
+                    if (has_current && current != start)
+                        add_bezier({current, start});
+                    current = start;
+                    command = 0;
+                }
+                else if (token == "B" || token == "N")
+                {
+                    spline(token == "N");
+                    command = 0;
+                }
+                else if (token == "K")
+                    fail("K without a preceding B or N");
+                else
+                    fail("unknown command '" + token + "'");
+            }
+            return std::move(scene);
+        }
+
+    private:
+        static bool is_number(const std::string& token)
+        {
+            char c = token[0];
+            return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+        }
+
+        [[noreturn]] void fail(const std::string& message) const
+        {
+            throw std::runtime_error("path: " + message + " at token " + std::to_string(pos));
+        }
+
+        float number()
+        {
+            if (pos >= tokens.size() || !is_number(tokens[pos]))
+                fail("expected a number");
+            const std::string& token = tokens[pos];
+            // stof 只解析开头能用的部分，"12abc" 会得到 12，所以还要检查整个 token 都用掉了
+            size_t used = 0;
+            float value = 0;
+            try
+            {
+                value = std::stof(token, &used);
+            }
+            catch (const std::exception&)
+            {
+                used = 0;
+            }
+            if (used != token.size())
+                fail("bad number '" + token + "'");
+            ++pos;
+            return value;
+        }
+
+        cv::Point2f point()
+        {
+            float x = number();
+            return {x, number()};
+        }
+
+        void path_command(char command)
+        {
+            if (command == 'M')
+            {
+                start = current = point();
+                has_current = true;
+                return;
+            }
+            if (!has_current)
+                fail("path does not start with M");
+            cv::Point2f p1 = point();
+            if (command == 'L')
+                add_bezier({current, p1});
+            else if (command == 'Q')
+            {
+                cv::Point2f p2 = point();
+                add_bezier({current, p1, p2});
+                p1 = p2;
+            }
+            else
+            {
+                cv::Point2f p2 = point(), p3 = point();
+                add_bezier({current, p1, p2, p3});
+                p1 = p3;
+            }
+            current = p1;
+        }
+
+        void add_bezier(std::initializer_list<cv::Point2f> points)
+        {
+            curve::path_curve c;
+            c.type = curve::path_curve_type::bezier;
+            c.degree = (int)points.size() - 1;
+            c.first_point = (int)scene.points.size();
+            c.point_count = (int)points.size();
+            c.style = (int)scene.styles.size() - 1;
+            scene.points.insert(scene.points.end(), points);
+            scene.weights.insert(scene.weights.end(), points.size(), 1.0f);
+            scene.curves.push_back(c);
+        }
+
+        void spline(bool rational)
+        {
+            curve::path_curve c;
+            c.type = rational ? curve::path_curve_type::nurbs : curve::path_curve_type::bspline;
+            c.degree = (int)number();
+            c.point_count = (int)number();
+            c.first_point = (int)scene.points.size();
+            c.first_knot = (int)scene.knots.size();
+            c.style = (int)scene.styles.size() - 1;
+            const int p = c.degree, n = c.point_count;
+            if (p < 1 || n < p + 1)
+                fail("a spline of degree p needs at least p + 1 control points");
+            for (int k = 0; k < n; ++k)
+            {
+                scene.points.push_back(point());
+                float w = rational ? number() : 1.0f;
+                if (w <= 0)
+                    fail("weights must be positive");
+                scene.weights.push_back(w);
+            }
+
+            // 默认是两端夹紧的均匀节点
+            if (pos < tokens.size() && tokens[pos] == "K")
+            {
+                ++pos;
+                for (int k = 0; k < n + p + 1; ++k)
+                    scene.knots.push_back(number());
+            }
+            else
+            {
+                scene.knots.insert(scene.knots.end(), p + 1, 0.0f);
+                for (int k = 1; k < n - p; ++k)
+                    scene.knots.push_back(float(k) / (n - p));
+                scene.knots.insert(scene.knots.end(), p + 1, 1.0f);
+            }
+
+            // 分解成 Bezier 段要求节点不减、两端各有 p + 1 个相同的值、内部节点重数不超过 p
+            const float* u = &scene.knots[c.first_knot];
+            int multiplicity = 1;
+            for (int k = 1; k < n + p + 1; ++k)
+            {
+                if (u[k] < u[k - 1])
+                    fail("knots must not decrease");
+                multiplicity = u[k] == u[k - 1] ? multiplicity + 1 : 1;
+                if (k > p && k < n && multiplicity > p)
+                    fail("inner knot repeated more than p times");
+            }
+            if (u[p] != u[0] || u[n] != u[n + p] || !(u[p] < u[n]))
+                fail("knots must be clamped");
+            scene.curves.push_back(c);
+            current = scene.points.back();
+        }
+
+        std::vector<std::string> tokens;
+        size_t pos = 0;
+        curve::path_scene scene;
+        cv::Point2f current, start;
+        bool has_current = false;
+    };
+}
+
+curve::path_scene curve::parse_path(std::istream& in)
+{
+    return path_parser(in).parse();
+}
+
+curve::path_scene curve::load_path_file(const std::string& filename)
+{
+    std::ifstream in(filename);
+    if (!in)
+        throw std::runtime_error("cannot load " + filename);
+    return parse_path(in);
+}
+
+curve::path_renderer::path_renderer(int num_threads) : num_threads(num_threads)
+{
+}
+
+void curve::path_renderer::flatten_curve(const path_scene& scene, const path_curve& c, float tolerance,
+                                         std::vector<cv::Point2f>& polyline)
+{
+    const cv::Point2f* points = &scene.points[c.first_point];
+    if (c.type == path_curve_type::bezier)
+    {
+        flatten(points, c.point_count, tolerance, polyline);
+        return;
+    }
+
+    // 齐次坐标下分解成 Bezier 段，逐段展开；后一段的起点就是前一段的终点，只留一个
+    static thread_local std::vector<cv::Point3f> homogeneous, pieces;
+    static thread_local std::vector<cv::Point2f> projected;
+    const float* weights = &scene.weights[c.first_point];
+    homogeneous.resize(c.point_count);
+    for (int k = 0; k < c.point_count; ++k)
+        homogeneous[k] = {points[k].x * weights[k], points[k].y * weights[k], weights[k]};
+    pieces.clear();
+    int piece_count = decompose_bspline(homogeneous.data(), c.point_count, c.degree, &scene.knots[c.first_knot], pieces);
+
+    const int order = c.degree + 1;
+    projected.resize(order);
+    for (int i = 0; i < piece_count; ++i)
+    {
+        if (i > 0)
+            polyline.pop_back();
+        const cv::Point3f* piece = &pieces[size_t(i) * order];
+        if (c.type == path_curve_type::nurbs)
+            flatten_rational(piece, order, tolerance, polyline);
+        else
+        {
+            // 权重都是 1，直接用多项式的版本
+            for (int k = 0; k < order; ++k)
+                projected[k] = {piece[k].x, piece[k].y};
+            flatten(projected.data(), order, tolerance, polyline);
+        }
+    }
+}
+
+void curve::path_renderer::render(const path_scene& scene, cv::Mat& image, float tolerance)
+{
+    auto start = std::chrono::steady_clock::now();
+    stats = {};
+    stats.curves = (int)scene.curves.size();
+    if (raster_width != scene.width || raster_height != scene.height)
+    {
+        stroker = stroke_rasterizer(scene.width, scene.height);
+        raster_width = scene.width;
+        raster_height = scene.height;
+    }
+    if (image.rows != scene.height || image.cols != scene.width || image.type() != CV_8UC3)
+        image = cv::Mat(scene.height, scene.width, CV_8UC3, cv::Scalar(0));
+
+    // 每条曲线各自展开，互不依赖；曲线的代价差别很大，所以动态分配
+    const int curve_count = stats.curves;
+    if ((int)polylines.size() < curve_count)
+        polylines.resize(curve_count);
+    int threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+#pragma omp parallel for schedule(dynamic, 16) num_threads(threads)
+    for (int c = 0; c < curve_count; ++c)
+    {
+        polylines[c].clear();
+        flatten_curve(scene, scene.curves[c], tolerance, polylines[c]);
+    }
+    auto flattened = std::chrono::steady_clock::now();
+    stats.flatten_ms = std::chrono::duration<double, std::milli>(flattened - start).count();
+
+    // 样式相同的相邻曲线一起光栅化，再整体混合一次
+    for (int begin = 0; begin < curve_count;)
+    {
+        const int style = scene.curves[begin].style;
+        int end = begin;
+        segments.clear();
+        const float half_width = 0.5f * scene.styles[style].width;
+        for (; end < curve_count && scene.curves[end].style == style; ++end)
+        {
+            const auto& polyline = polylines[end];
+            for (size_t i = 1; i < polyline.size(); ++i)
+                segments.push_back({polyline[i - 1], polyline[i], half_width});
+        }
+        stroker.clear();
+        stroker.stroke_segments(segments, num_threads);
+        stroker.composite(image, scene.styles[style].color);
+        stats.segments += segments.size();
+        stats.pixel_writes += stroker.pixel_writes();
+        begin = end;
+    }
+    auto finished = std::chrono::steady_clock::now();
+    stats.raster_ms = std::chrono::duration<double, std::milli>(finished - flattened).count();
+    stats.total_ms = std::chrono::duration<double, std::milli>(finished - start).count();
+}
@@ -0,0 +1,103 @@
+//
+// Vector paths made of many curves, loaded from a text file and rendered in one batch.
+//
+
+#ifndef BEZIER_PATH_H
+#define BEZIER_PATH_H
+
+#include <istream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "Stroke.hpp"
+
+namespace curve
+{
+    struct stroke_style
+    {
+        float width = 1.0f;
+        cv::Vec3b color = {255, 255, 255}; // BGR
+    };
+
+    enum class path_curve_type
+    {
+        bezier,  // point_count = degree + 1 control points
+        bspline, // clamped knots, point_count + degree + 1 of them from first_knot
+        nurbs    // same, with a weight per control point
+    };
+
+    struct path_curve
+    {
+        path_curve_type type = path_curve_type::bezier;
+        int degree = 3;
+        int first_point = 0, point_count = 0;
+        int first_knot = 0;
+        int style = 0;
+    };
+
+    /*
+     * All curves of a file in flat arrays: a curve refers to its control points, weights
+     * and knots by index, so thousands of curves are a handful of allocations.
+     * weights has one entry per point, 1 for everything but NURBS.
+     * */
+    struct path_scene
+    {
+        int width = 700, height = 700;
+        std::vector<stroke_style> styles;
+        std::vector<cv::Point2f> points;
+        std::vector<float> weights;
+        std::vector<float> knots;
+        std::vector<path_curve> curves;
+    };
+
+    /*
+     * Reads a path file. Whitespace or commas separate the tokens, # starts a comment:
+     *   size W H            image size
+     *   stroke W R G B      stroke width and color for the curves that follow
+     *   M x y  L x y  Q x1 y1 x y  C x1 y1 x2 y2 x y  Z
+     *                       the SVG path commands in absolute coordinates; the arguments
+     *                       of a command may repeat, and pairs after M are lines
+     *   B p n x y ...       B-spline of degree p with n control points, uniform clamped knots
+     *   N p n x y w ...     NURBS, the same with a weight per control point
+     *   K u ...             replaces the knots of the preceding B or N (n + p + 1 values)
+     * Throws std::runtime_error on a file that cannot be read or parsed.
+     * */
+    path_scene parse_path(std::istream& in);
+    path_scene load_path_file(const std::string& filename);
+
+    /*
+     * Flattens every curve of a scene in parallel (num_threads = 0 uses all threads),
+     * B-splines and NURBS by way of their Bezier pieces, and strokes the polylines with
+     * analytic coverage. Each run of consecutive curves with the same style is rasterized
+     * into the coverage buffer and composited in one pass, so later styles draw over
+     * earlier ones. An image that does not match the scene size is replaced by a black
+     * one. The buffers are kept between calls.
+     * */
+    class path_renderer
+    {
+    public:
+        struct statistics
+        {
+            int curves = 0;
+            size_t segments = 0, pixel_writes = 0;
+            double flatten_ms = 0, raster_ms = 0, total_ms = 0;
+        };
+
+        explicit path_renderer(int num_threads = 0);
+
+        void render(const path_scene& scene, cv::Mat& image, float tolerance = 0.1f);
+        const statistics& last_statistics() const { return stats; }
+
+    private:
+        void flatten_curve(const path_scene& scene, const path_curve& c, float tolerance, std::vector<cv::Point2f>& polyline);
+
+        int num_threads;
+        statistics stats;
+        int raster_width = 0, raster_height = 0;
+        stroke_rasterizer stroker{0, 0};
+        std::vector<std::vector<cv::Point2f>> polylines;
+        std::vector<stroke_segment> segments;
+    };
+}
+
+#endif //BEZIER_PATH_H
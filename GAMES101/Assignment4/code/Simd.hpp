@@ -0,0 +1,86 @@
+//
+// Small SIMD wrapper for the batch curve evaluators and the stroke rasterizer: 8 lanes with
+// AVX2, 4 lanes with SSE2, and a one lane scalar fallback everywhere else.
+//
+
+#ifndef BEZIER_SIMD_H
+#define BEZIER_SIMD_H
+
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace curve
+{
+namespace simd
+{
+#if defined(__AVX2__)
+    constexpr int width = 8;
+
+    struct vfloat
+    {
+        __m256 v;
+    };
+
+    inline vfloat set1(float a) { return {_mm256_set1_ps(a)}; }
+    inline vfloat load(const float* p) { return {_mm256_loadu_ps(p)}; }
+    inline void store(float* p, vfloat a) { _mm256_storeu_ps(p, a.v); }
+    inline vfloat operator+(vfloat a, vfloat b) { return {_mm256_add_ps(a.v, b.v)}; }
+    inline vfloat operator-(vfloat a, vfloat b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    inline vfloat operator*(vfloat a, vfloat b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    inline vfloat lane_index() { return {_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)}; }
+    inline vfloat min(vfloat a, vfloat b) { return {_mm256_min_ps(a.v, b.v)}; }
+    inline vfloat max(vfloat a, vfloat b) { return {_mm256_max_ps(a.v, b.v)}; }
+    inline vfloat sqrt(vfloat a) { return {_mm256_sqrt_ps(a.v)}; }
+
+    // Bit k is set when lane k of a is less than lane k of b.
+    inline int less(vfloat a, vfloat b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+#elif defined(__SSE2__)
+    constexpr int width = 4;
+
+    struct vfloat
+    {
+        __m128 v;
+    };
+
+    inline vfloat set1(float a) { return {_mm_set1_ps(a)}; }
+    inline vfloat load(const float* p) { return {_mm_loadu_ps(p)}; }
+    inline void store(float* p, vfloat a) { _mm_storeu_ps(p, a.v); }
+    inline vfloat operator+(vfloat a, vfloat b) { return {_mm_add_ps(a.v, b.v)}; }
+    inline vfloat operator-(vfloat a, vfloat b) { return {_mm_sub_ps(a.v, b.v)}; }
+    inline vfloat operator*(vfloat a, vfloat b) { return {_mm_mul_ps(a.v, b.v)}; }
+    inline vfloat lane_index() { return {_mm_setr_ps(0, 1, 2, 3)}; }
+    inline vfloat min(vfloat a, vfloat b) { return {_mm_min_ps(a.v, b.v)}; }
+    inline vfloat max(vfloat a, vfloat b) { return {_mm_max_ps(a.v, b.v)}; }
+    inline vfloat sqrt(vfloat a) { return {_mm_sqrt_ps(a.v)}; }
+
+    inline int less(vfloat a, vfloat b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+#else
+    constexpr int width = 1;
+
+    struct vfloat
+    {
+        float v;
+    };
+
+    inline vfloat set1(float a) { return {a}; }
+    inline vfloat load(const float* p) { return {*p}; }
+    inline void store(float* p, vfloat a) { *p = a.v; }
+    inline vfloat operator+(vfloat a, vfloat b) { return {a.v + b.v}; }
+    inline vfloat operator-(vfloat a, vfloat b) { return {a.v - b.v}; }
+    inline vfloat operator*(vfloat a, vfloat b) { return {a.v * b.v}; }
+    inline vfloat lane_index() { return {0.0f}; }
+    inline vfloat min(vfloat a, vfloat b) { return {b.v < a.v ? b.v : a.v}; }
+    inline vfloat max(vfloat a, vfloat b) { return {a.v < b.v ? b.v : a.v}; }
+    inline vfloat sqrt(vfloat a) { return {std::sqrt(a.v)}; }
+
+    inline int less(vfloat a, vfloat b) { return a.v < b.v ? 1 : 0; }
+#endif
+}
+}
+
+#endif //BEZIER_SIMD_H
@@ -0,0 +1,194 @@
+//
+// Analytic-coverage stroke rasterizer.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+#include "Stroke.hpp"
+#include "Bezier.hpp"
+#include "Simd.hpp"
+
+curve::stroke_rasterizer::stroke_rasterizer(int width, int height)
+    : width(width), height(height), coverage_buf(size_t(width) * height, 0.0f)
+{
+}
+
+void curve::stroke_rasterizer::clear()
+{
+    std::fill(coverage_buf.begin(), coverage_buf.end(), 0.0f);
+    writes = 0;
+}
+
+void curve::stroke_rasterizer::stroke_polyline(const cv::Point2f* points, int count, float width)
+{
+    if (count == 1)
+    {
+        writes += rasterize_segment({points[0], points[0], 0.5f * width}, 0, height);
+        return;
+    }
+    for (int i = 1; i < count; ++i)
+        writes += rasterize_segment({points[i - 1], points[i], 0.5f * width}, 0, height);
+}
+
+void curve::stroke_rasterizer::stroke_curve(const cv::Point2f* control_points, int count, float width, float tolerance)
+{
+    if (polylines.empty())
+        polylines.resize(1);
+    auto& polyline = polylines[0];
+    polyline.clear();
+    flatten(control_points, count, tolerance, polyline);
+    stroke_polyline(polyline.data(), (int)polyline.size(), width);
+}
+
+void curve::stroke_rasterizer::stroke_curves(const cv::Point2f* control_points, int point_count, int curve_count,
+                                             float width, float tolerance, int num_threads)
+{
+    // 每条曲线各自展开成折线，缓冲区在多次调用之间复用
+    if ((int)polylines.size() < curve_count)
+        polylines.resize(curve_count);
+    int threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+#pragma omp parallel for schedule(dynamic, 16) num_threads(threads)
+    for (int c = 0; c < curve_count; ++c)
+    {
+        polylines[c].clear();
+        flatten(control_points + size_t(c) * point_count, point_count, tolerance, polylines[c]);
+    }
+
+    segments_buf.clear();
+    for (int c = 0; c < curve_count; ++c)
+    {
+        const auto& polyline = polylines[c];
+        for (size_t i = 1; i < polyline.size(); ++i)
+            segments_buf.push_back({polyline[i - 1], polyline[i], 0.5f * width});
+    }
+    stroke_segments(segments_buf, num_threads);
+}
+
+void curve::stroke_rasterizer::stroke_segments(const std::vector<stroke_segment>& segments, int num_threads)
+{
+    int bands = (height + band_height - 1) / band_height;
+    bins.resize(bands);
+    for (auto& bin : bins)
+        bin.clear();
+
+    // 按线段（加上半个线宽）覆盖的行分到各个条带，一条线段可能落在多个条带里
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        const stroke_segment& s = segments[i];
+        float reach = s.half_width + 0.5f;
+        int y_lo = std::max(int(std::floor(std::min(s.a.y, s.b.y) - reach)), 0);
+        int y_hi = std::min(int(std::floor(std::max(s.a.y, s.b.y) + reach)), height - 1);
+        for (int b = y_lo / band_height; b <= y_hi / band_height; ++b)
+            bins[b].push_back(int(i));
+    }
+
+    // 条带之间没有共享的像素
+    size_t stored = 0;
+    int threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads) reduction(+ : stored)
+    for (int b = 0; b < bands; ++b)
+    {
+        int y0 = b * band_height, y1 = std::min(y0 + band_height, height);
+        for (int i : bins[b])
+            stored += rasterize_segment(segments[i], y0, y1);
+    }
+    writes += stored;
+}
+
+/*
+ * 像素 (x, y) 的中心在 (x + 0.5, y + 0.5)。对每一行先求出线段两侧 half_width + 0.5 范围内的
+ * 那一段 x，再逐个像素求中心到线段的距离 d；覆盖率是区间 [d - w/2, d + w/2] 和像素
+ * [-0.5, 0.5] 的重叠长度，比已有的覆盖率大才写入。
+ */
+size_t curve::stroke_rasterizer::rasterize_segment(const stroke_segment& s, int y_begin, int y_end)
+{
+    const float hw = s.half_width;
+    const float reach = hw + 0.5f;
+    const cv::Point2f d = s.b - s.a;
+    const float length2 = d.x * d.x + d.y * d.y;
+    const float inv_length2 = length2 > 0 ? 1.0f / length2 : 0.0f;
+    const float inv_dy = std::abs(d.y) > 1e-6f ? 1.0f / d.y : 0.0f;
+
+    int y_lo = std::max(int(std::ceil(std::min(s.a.y, s.b.y) - reach - 0.5f)), std::max(y_begin, 0));
+    int y_hi = std::min(int(std::floor(std::max(s.a.y, s.b.y) + reach - 0.5f)), std::min(y_end, height) - 1);
+    size_t stored = 0;
+    for (int y = y_lo; y <= y_hi; ++y)
+    {
+        const float cy = y + 0.5f;
+        // 这一行上线段落在 [cy - reach, cy + reach] 内的参数区间，两端再向外放 reach
+        float t0 = 0.0f, t1 = 1.0f;
+        if (inv_dy != 0.0f)
+        {
+            t0 = (cy - reach - s.a.y) * inv_dy;
+            t1 = (cy + reach - s.a.y) * inv_dy;
+            if (t0 > t1)
+                std::swap(t0, t1);
+            t0 = std::max(t0, 0.0f);
+            t1 = std::min(t1, 1.0f);
+            if (t0 > t1)
+                continue;
+        }
+        float xa = s.a.x + t0 * d.x, xb = s.a.x + t1 * d.x;
+        int x_lo = std::max(int(std::ceil(std::min(xa, xb) - reach - 0.5f)), 0);
+        int x_hi = std::min(int(std::floor(std::max(xa, xb) + reach - 0.5f)), width - 1);
+
+        float* row = &coverage_buf[size_t(y) * width];
+        const float py = cy - s.a.y;
+        auto coverage_at = [&](float px) {
+            float t = std::min(std::max((px * d.x + py * d.y) * inv_length2, 0.0f), 1.0f);
+            float ex = px - t * d.x, ey = py - t * d.y;
+            float distance = std::sqrt(ex * ex + ey * ey);
+            return std::min(0.5f, distance + hw) - std::max(-0.5f, distance - hw);
+        };
+
+        // simd::width 个像素一组；覆盖率为负的像素取 max 之后不变，不需要分支。
+        // 超出 x_hi 的通道离线段都超过 reach，覆盖率不大于 0，所以最后一组不用截断，只有图像右边缘要逐个像素算
+        int x = x_lo;
+        {
+            using namespace simd;
+            const vfloat dx = set1(d.x), dy = set1(d.y), vhw = set1(hw);
+            const vfloat zero = set1(0.0f), one = set1(1.0f), half = set1(0.5f), minus_half = set1(-0.5f);
+            const vfloat offset = lane_index() + set1(0.5f - s.a.x);
+            const vfloat vpy = set1(py), pyd = set1(py * d.y), inv = set1(inv_length2);
+            for (; x <= x_hi && x + simd::width <= width; x += simd::width)
+            {
+                vfloat px = set1(float(x)) + offset;
+                vfloat t = min(max((px * dx + pyd) * inv, zero), one);
+                vfloat ex = px - t * dx, ey = vpy - t * dy;
+                vfloat distance = sqrt(ex * ex + ey * ey);
+                vfloat c = min(half, distance + vhw) - max(minus_half, distance - vhw);
+                vfloat old = load(row + x);
+                stored += __builtin_popcount(less(old, c));
+                store(row + x, max(old, c));
+            }
+        }
+        for (; x <= x_hi; ++x)
+        {
+            float c = coverage_at(x + 0.5f - s.a.x);
+            if (c > row[x])
+            {
+                row[x] = c;
+                ++stored;
+            }
+        }
+    }
+    return stored;
+}
+
+void curve::stroke_rasterizer::composite(cv::Mat& image, const cv::Vec3b& color) const
+{
+    for (int y = 0; y < height; ++y)
+    {
+        const float* row = &coverage_buf[size_t(y) * width];
+        cv::Vec3b* pixels = image.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < width; ++x)
+        {
+            float c = row[x];
+            if (c <= 0.0f)
+                continue;
+            for (int k = 0; k < 3; ++k)
+                pixels[x][k] = cv::saturate_cast<uchar>(pixels[x][k] + (color[k] - pixels[x][k]) * c);
+        }
+    }
+}
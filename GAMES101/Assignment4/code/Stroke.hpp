@@ -0,0 +1,70 @@
+//
+// Anti-aliased strokes from analytic pixel coverage.
+//
+
+#ifndef BEZIER_STROKE_H
+#define BEZIER_STROKE_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace curve
+{
+    // One flattened piece of a stroke: the points within half_width of the segment a-b.
+    struct stroke_segment
+    {
+        cv::Point2f a, b;
+        float half_width;
+    };
+
+    /*
+     * Rasterizes strokes into a float coverage buffer and composites it onto an image once.
+     * A pixel's coverage is the overlap of the pixel with a band of the stroke width at the
+     * pixel centre's distance from the stroke's centre line: exact for horizontal and vertical
+     * strokes and close to it for the others, thin strokes included. Overlapping segments and
+     * strokes combine by taking the larger coverage, so joints are not counted twice.
+     * */
+    class stroke_rasterizer
+    {
+    public:
+        stroke_rasterizer(int width, int height);
+
+        void clear();
+
+        // One polyline or one curve, on the calling thread
+        void stroke_polyline(const cv::Point2f* points, int count, float width);
+        void stroke_curve(const cv::Point2f* control_points, int count, float width, float tolerance = 0.1f);
+
+        /*
+         * curve_count curves of point_count control points each, stored one after another:
+         * the curves are flattened in parallel, their segments binned into bands of rows and
+         * the bands rasterized in parallel (num_threads = 0 uses all threads).
+         * */
+        void stroke_curves(const cv::Point2f* control_points, int point_count, int curve_count, float width,
+                           float tolerance = 0.1f, int num_threads = 0);
+        void stroke_segments(const std::vector<stroke_segment>& segments, int num_threads = 0);
+
+        // Blends color over the CV_8UC3 image with the coverage as alpha, in one pass.
+        void composite(cv::Mat& image, const cv::Vec3b& color) const;
+
+        const std::vector<float>& coverage() const { return coverage_buf; }
+        // Coverage values stored since the last clear()
+        size_t pixel_writes() const { return writes; }
+
+    private:
+        // Only the rows [y_begin, y_end); returns the number of coverage values stored.
+        size_t rasterize_segment(const stroke_segment& segment, int y_begin, int y_end);
+
+        int width, height;
+        std::vector<float> coverage_buf;
+        size_t writes = 0;
+
+        // 多条曲线时按行分带，每个带由一个线程处理，带内没有写冲突
+        static constexpr int band_height = 16;
+        std::vector<std::vector<int>> bins;
+        std::vector<std::vector<cv::Point2f>> polylines;
+        std::vector<stroke_segment> segments_buf;
+    };
+}
+
+#endif //BEZIER_STROKE_H
@@ -1,6 +1,13 @@
 #include <chrono>
 #include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
 #include <opencv2/opencv.hpp>
+#include "Bezier.hpp"
+#include "Path.hpp"
+#include "Stroke.hpp"
 
 std::vector<cv::Point2f> control_points;
 
@@ -14,25 +21,39 @@ void mouse_handler(int event, int x, int y, int flags, void *userdata)
     }     
 }
 
-void naive_bezier(const std::vector<cv::Point2f> &points, cv::Mat &window) 
+cv::Point2f naive_bezier_point(const std::vector<cv::Point2f> &points, double t) 
 {
     auto &p_0 = points[0];
     auto &p_1 = points[1];
     auto &p_2 = points[2];
     auto &p_3 = points[3];
 
+    return std::pow(1 - t, 3) * p_0 + 3 * t * std::pow(1 - t, 2) * p_1 +
+           3 * std::pow(t, 2) * (1 - t) * p_2 + std::pow(t, 3) * p_3;
+}
+
+void naive_bezier(const std::vector<cv::Point2f> &points, cv::Mat &window) 
+{
     for (double t = 0.0; t <= 1.0; t += 0.001) 
     {
-        auto point = std::pow(1 - t, 3) * p_0 + 3 * t * std::pow(1 - t, 2) * p_1 +
-                 3 * std::pow(t, 2) * (1 - t) * p_2 + std::pow(t, 3) * p_3;
+        auto point = naive_bezier_point(points, t);
 
         window.at<cv::Vec3b>(point.y, point.x)[2] = 255; //显示是红色
     }
 }
 
-cv::Point2f recursive_bezier(const std::vector<cv::Point2f> &control_points, float t) 
+// 同样的 1001 个点用前向差分算，每个点只要三次向量加法
+void forward_bezier(const std::vector<cv::Point2f> &points, cv::Mat &window) 
+{
+    cv::Point2f samples[1001];
+    curve::forward_difference_cubic(points.data(), 1000, samples);
+    for (auto& point : samples)
+        window.at<cv::Vec3b>(point.y, point.x)[2] = 255; //显示是红色
+}
+
+// 原来的递归实现，每一层都分配一个新的 vector；只留给 bench 做对比
+cv::Point2f recursive_bezier_vector(const std::vector<cv::Point2f> &control_points, float t) 
 {
-    // TODO: Implement de Casteljau's algorithm
     int len = control_points.size();
     if (len == 1)
         return control_points[0];
@@ -40,59 +61,495 @@ cv::Point2f recursive_bezier(const std::vector<cv::Point2f> &control_points, flo
     std::vector<cv::Point2f> lerp_control_points(len - 1, cv::Point2f(0.0, 0.0));
     for (int i = 0; i < len - 1; ++i)
     {
-        lerp_control_points[i] = t * control_points[i] + (1 - t) * control_points[i + 1];
+        lerp_control_points[i] = (1 - t) * control_points[i] + t * control_points[i + 1];
     }
     
-    return recursive_bezier(lerp_control_points, t);
+    return recursive_bezier_vector(lerp_control_points, t);
 
 }
 
+cv::Point2f recursive_bezier(const std::vector<cv::Point2f> &control_points, float t) 
+{
+    // de Casteljau：在栈上原地迭代，不再分配内存
+    return curve::de_casteljau(control_points.data(), (int)control_points.size(), t);
+}
+
+// 一个采样点的反走样：所在像素设为绿色，按距离比例调整离它最近的三个相邻像素
+void draw_antialiased_point(cv::Mat &window, const cv::Point2f &point)
+{
+    window.at<cv::Vec3b>(point.y, point.x)[1] = 255; //显示是绿色
+
+    float xDelta = point.x - std:: floor(point.x);
+    float yDelta = point.y - std:: floor(point.y);
+
+    int  xDir = xDelta < 0.5f ? -1 : 1;
+    int yDir = yDelta < 0.5f ? -1 : 1;
+
+    cv::Point2f p0 = cv::Point2f(std::floor(point.x) + 0.5f, std::floor(point.y) + 0.5f);
+    cv::Point2f p1 = cv::Point2f(std::floor(point.x + xDir * 1.0f) + 0.5f, std::floor(point.y) + 0.5f);
+    cv::Point2f p2 = cv::Point2f(std::floor(point.x) + 0.5f, std::floor(point.y + yDir * 1.0f) + 0.5f);
+    cv::Point2f p3 = cv::Point2f(std::floor(point.x + xDir * 1.0f) + 0.5f, std::floor(point.y + yDir * 1.0) + 0.5f);
+
+    std::vector<cv::Point2f> pvec;
+    pvec.push_back(p1);
+    pvec.push_back(p2);
+    pvec.push_back(p3);
+
+    float d1 = std::sqrt(std::pow(p0.x - point.x, 2) + std::pow(p0.y - point.y, 2));
+
+    for (auto& p: pvec)
+    {
+
+
+        float dp = std::sqrt(std::pow(p.x - point.x, 2) + std::pow(p.y - point.y, 2));
+        float weight = d1 / dp;
+        float colorG = window.at<cv::Vec3b>(p.y, p.x)[1];
+        colorG = std::fmin(colorG, weight * 255.0);
+        window.at<cv::Vec3b>(p.y, p.x)[1] = (int)colorG;
+    }
+}
+
 void bezier(const std::vector<cv::Point2f> &control_points, cv::Mat &window) 
 {
-    // TODO: Iterate through all t = 0 to t = 1 with small steps, and call de Casteljau's 
-    // recursive Bezier algorithm.
-    for (double t = 0.0; t <= 1.0; t += 0.001)
+    // 步长 0.001 的 1001 个点一次批量算完，几个 t 在 SIMD 的不同通道里同时计算
+    static const std::vector<float> parameters = curve::uniform_parameters(1001);
+    std::vector<cv::Point2f> samples(parameters.size());
+    curve::evaluate(control_points.data(), (int)control_points.size(), parameters.data(), (int)parameters.size(), samples.data());
+    // 反走样结果和画点的顺序有关；原来的插值方向是反的，曲线从最后一个控制点画起，这里保持同样的顺序
+    for (auto it = samples.rbegin(); it != samples.rend(); ++it)
+        draw_antialiased_point(window, *it);
+}
+
+// 折线上相邻两个采样点的最大间距，1 像素以内画出来的曲线就没有断点
+const float polyline_step = 1.0f;
+
+// 沿折线按不超过 polyline_step 的间距取点画出来，返回画了多少个点
+int draw_polyline(const std::vector<cv::Point2f> &polyline, cv::Mat &window)
+{
+    draw_antialiased_point(window, polyline[0]);
+    int samples = 1;
+    for (size_t i = 1; i < polyline.size(); ++i)
+    {
+        cv::Point2f a = polyline[i - 1];
+        cv::Point2f d = polyline[i] - a;
+        int steps = std::max(1, (int)std::ceil(std::sqrt(d.x * d.x + d.y * d.y) / polyline_step));
+        for (int k = 1; k <= steps; ++k)
+            draw_antialiased_point(window, a + d * (float(k) / steps));
+        samples += steps;
+    }
+    return samples;
+}
+
+// 自适应细分：不够平就在 t = 0.5 处一分为二，平坦到 tolerance 像素以内后按折线画
+void adaptive_bezier(const std::vector<cv::Point2f> &control_points, cv::Mat &window, float tolerance = 0.25f)
+{
+    std::vector<cv::Point2f> polyline;
+    curve::flatten(control_points.data(), (int)control_points.size(), tolerance, polyline);
+    draw_polyline(polyline, window);
+}
+
+// 各种求值方式每个点的耗时，以及和原来递归实现的最大差异
+void benchmark_evaluators()
+{
+    std::mt19937 rng(4);
+    std::uniform_real_distribution<float> coordinate(0.0f, 700.0f);
+    const std::vector<float> parameters = curve::uniform_parameters(1001);
+    const int count = (int)parameters.size();
+    std::vector<cv::Point2f> out(count);
+
+    auto ns_per_point = [&](int repeat, auto&& run) {
+        double best = 1e30;
+        for (int r = 0; r < 5; ++r)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < repeat; ++i)
+                run();
+            auto stop = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::nano>(stop - start).count() / (double(repeat) * count));
+        }
+        return best;
+    };
+
+    for (int degree : {3, 7, 40})
     {
-        auto point = recursive_bezier(control_points, t) ;
+        std::vector<cv::Point2f> points(degree + 1);
+        for (auto& p : points)
+            p = {coordinate(rng), coordinate(rng)};
+        const int repeat = std::max(1, 200 / degree);
 
-        window.at<cv::Vec3b>(point.y, point.x)[1] = 255; //显示是绿色
+        double vector_ns = ns_per_point(repeat, [&] {
+            for (int i = 0; i < count; ++i)
+                out[i] = recursive_bezier_vector(points, parameters[i]);
+        });
+        std::vector<cv::Point2f> reference = out;
+        double scalar_ns = ns_per_point(repeat, [&] {
+            for (int i = 0; i < count; ++i)
+                out[i] = recursive_bezier(points, parameters[i]);
+        });
+        float scalar_diff = 0;
+        for (int i = 0; i < count; ++i)
+            scalar_diff = std::max(scalar_diff, (float)cv::norm(out[i] - reference[i]));
+        double batch_ns = ns_per_point(repeat, [&] {
+            curve::evaluate(points.data(), (int)points.size(), parameters.data(), count, out.data());
+        });
+        float batch_diff = 0;
+        for (int i = 0; i < count; ++i)
+            batch_diff = std::max(batch_diff, (float)cv::norm(out[i] - reference[i]));
 
-        float xDelta = point.x - std:: floor(point.x);
-        float yDelta = point.y - std:: floor(point.y);
+        std::cout << "degree " << degree << "  recursive (vector): " << vector_ns << " ns/point  in place: " << scalar_ns
+                  << " ns/point  batch: " << batch_ns << " ns/point  max difference: " << std::max(scalar_diff, batch_diff) << " px\n";
+    }
+
+    // 很多条三次曲线一起算，曲线分给各个线程
+    const int curve_count = 10000;
+    std::vector<cv::Point2f> points(4 * curve_count);
+    for (auto& p : points)
+        p = {coordinate(rng), coordinate(rng)};
+    std::vector<cv::Point2f> curves(size_t(curve_count) * count);
+    auto start = std::chrono::steady_clock::now();
+    curve::evaluate_curves(points.data(), 4, curve_count, parameters.data(), count, curves.data());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << curve_count << " cubic curves x " << count << " points: " << seconds * 1000 << " ms  "
+              << curves.size() / seconds / 1e6 << " Mpoints/s\n";
+}
 
-        int  xDir = xDelta < 0.5f ? -1 : 1;
-        int yDir = yDelta < 0.5f ? -1 : 1;
+// 固定步长和自适应细分在不同长度的曲线上比较：de Casteljau 次数、画的点数、相邻点的最大间距和耗时
+void benchmark_adaptive()
+{
+    const std::vector<cv::Point2f> shape = {{120, 560}, {210, 110}, {470, 140}, {590, 600}};
+    for (float scale : {0.05f, 1.0f, 6.0f})
+    {
+        std::vector<cv::Point2f> points;
+        for (auto& p : shape)
+            points.push_back(scale * p);
+        int size = std::max(700, (int)std::ceil(700 * scale));
+        cv::Mat window = cv::Mat(size, size, CV_8UC3, cv::Scalar(0));
 
-        cv::Point2f p0 = cv::Point2f(std::floor(point.x) + 0.5f, std::floor(point.y) + 0.5f);
-        cv::Point2f p1 = cv::Point2f(std::floor(point.x + xDir * 1.0f) + 0.5f, std::floor(point.y) + 0.5f);
-        cv::Point2f p2 = cv::Point2f(std::floor(point.x) + 0.5f, std::floor(point.y + yDir * 1.0f) + 0.5f);
-        cv::Point2f p3 = cv::Point2f(std::floor(point.x + xDir * 1.0f) + 0.5f, std::floor(point.y + yDir * 1.0) + 0.5f);
+        auto best_ms = [&](auto&& draw) {
+            double best = 1e30;
+            for (int run = 0; run < 10; ++run)
+            {
+                auto start = std::chrono::steady_clock::now();
+                draw();
+                auto stop = std::chrono::steady_clock::now();
+                best = std::min(best, std::chrono::duration<double, std::milli>(stop - start).count());
+            }
+            return best;
+        };
 
-        std::vector<cv::Point2f> pvec;
-        pvec.push_back(p1);
-        pvec.push_back(p2);
-        pvec.push_back(p3);
+        double fixed_ms = best_ms([&] { bezier(points, window); });
+        std::vector<float> parameters = curve::uniform_parameters(1001);
+        std::vector<cv::Point2f> samples(parameters.size());
+        curve::evaluate(points.data(), (int)points.size(), parameters.data(), (int)parameters.size(), samples.data());
+        float fixed_gap = 0;
+        for (size_t i = 1; i < samples.size(); ++i)
+            fixed_gap = std::max(fixed_gap, (float)cv::norm(samples[i] - samples[i - 1]));
 
-        float d1 = std::sqrt(std::pow(p0.x - point.x, 2) + std::pow(p0.y - point.y, 2));
+        std::vector<cv::Point2f> polyline;
+        int splits = 0, drawn = 0;
+        double adaptive_ms = best_ms([&] {
+            polyline.clear();
+            splits = curve::flatten(points.data(), (int)points.size(), 0.25f, polyline);
+            drawn = draw_polyline(polyline, window);
+        });
 
-        for (auto& p: pvec)
+        std::cout << "curve scale " << scale << "\n"
+                  << "  fixed step:  1001 evaluations, 1001 points, max gap " << fixed_gap << " px, " << fixed_ms << " ms\n"
+                  << "  adaptive:    " << splits << " splits, " << polyline.size() - 1 << " segments, " << drawn
+                  << " points, max gap <= " << polyline_step << " px, " << adaptive_ms << " ms\n";
+    }
+}
+
+// 三次曲线的各种求值方式：每秒多少个点，以及和双精度结果的最大偏差
+void benchmark_forward()
+{
+    const std::vector<cv::Point2f> points = {{120, 560}, {210, 110}, {470, 140}, {590, 600}};
+    const int steps = 1000, count = steps + 1;
+    const std::vector<float> parameters = curve::uniform_parameters(count);
+
+    // 双精度的参考值
+    auto exact = [&](double t) {
+        double u = 1 - t;
+        double b[4] = {u * u * u, 3 * t * u * u, 3 * t * t * u, t * t * t};
+        double x = 0, y = 0;
+        for (int k = 0; k < 4; ++k)
+        {
+            x += b[k] * points[k].x;
+            y += b[k] * points[k].y;
+        }
+        return std::make_pair(x, y);
+    };
+    auto deviation = [&](const cv::Point2f* out) {
+        double worst = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            auto e = exact(double(i) / steps);
+            worst = std::max(worst, std::hypot(out[i].x - e.first, out[i].y - e.second));
+        }
+        return worst;
+    };
+
+    std::vector<cv::Point2f> out(count);
+    std::vector<curve::fixed_point> fixed(count);
+    std::vector<cv::Point2f> adaptive;
+    const int repeat = 200;
+    auto report = [&](const char* name, auto&& run, auto&& check) {
+        double best = 1e30;
+        int produced = 0;
+        for (int r = 0; r < 5; ++r)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < repeat; ++i)
+                produced = run();
+            auto stop = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double>(stop - start).count());
+        }
+        std::cout << name << double(produced) * repeat / best / 1e6 << " Mpoints/s  max deviation " << check() << " px\n";
+    };
+
+    report("naive_bezier (std::pow):      ", [&] {
+        for (int i = 0; i < count; ++i)
+            out[i] = naive_bezier_point(points, double(i) / steps);
+        return count;
+    }, [&] { return deviation(out.data()); });
+    report("recursive_bezier (in place):  ", [&] {
+        for (int i = 0; i < count; ++i)
+            out[i] = recursive_bezier(points, parameters[i]);
+        return count;
+    }, [&] { return deviation(out.data()); });
+    report("batch de Casteljau:           ", [&] {
+        curve::evaluate(points.data(), 4, parameters.data(), count, out.data());
+        return count;
+    }, [&] { return deviation(out.data()); });
+    report("forward differences:          ", [&] {
+        curve::forward_difference_cubic(points.data(), steps, out.data());
+        return count;
+    }, [&] { return deviation(out.data()); });
+    report("forward differences 16.16:    ", [&] {
+        curve::forward_difference_cubic_fixed(points.data(), steps, fixed.data());
+        return count;
+    }, [&] {
+        for (int i = 0; i < count; ++i)
+            out[i] = curve::to_float(fixed[i]);
+        return deviation(out.data());
+    });
+    report("adaptive forward (1 px):      ", [&] {
+        adaptive.clear();
+        return curve::forward_difference_cubic_adaptive(points.data(), 1.0f, adaptive);
+    }, [&] {
+        // 自适应步长的点不知道参数，用到密集采样的参考曲线的距离；点是按顺序的，只需往前找
+        const int dense = 1 << 18;
+        double worst = 0;
+        int j = 0;
+        for (auto& p : adaptive)
         {
+            auto distance = [&](int k) {
+                auto e = exact(double(k) / dense);
+                return std::hypot(p.x - e.first, p.y - e.second);
+            };
+            while (j < dense && distance(j + 1) <= distance(j))
+                ++j;
+            worst = std::max(worst, distance(j));
+        }
+        return worst;
+    });
+    std::cout << "adaptive forward differencing used " << adaptive.size() << " points for " << count << " uniform ones\n";
+}
+
+// 很多条随机的三次曲线：原来逐点反走样的 bezier() 和覆盖率描边比较耗时和像素写入次数
+void benchmark_coverage()
+{
+    std::mt19937 rng(24);
+    // 离边界留出余量，bezier() 的反走样会读写采样点周围的像素
+    std::uniform_real_distribution<float> coordinate(20.0f, 680.0f);
+    curve::stroke_rasterizer stroker(700, 700);
+    for (int curve_count : {100, 1000, 5000})
+    {
+        std::vector<cv::Point2f> points(4 * curve_count);
+        for (auto& p : points)
+            p = {coordinate(rng), coordinate(rng)};
+
+        cv::Mat window = cv::Mat(700, 700, CV_8UC3, cv::Scalar(0));
+        auto start = std::chrono::steady_clock::now();
+        std::vector<cv::Point2f> curve(4);
+        for (int c = 0; c < curve_count; ++c)
+        {
+            std::copy(points.begin() + 4 * c, points.begin() + 4 * c + 4, curve.begin());
+            bezier(curve, window);
+        }
+        double per_sample_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        double coverage_ms = 1e30;
+        for (int run = 0; run < 3; ++run)
+        {
+            window = cv::Mat(700, 700, CV_8UC3, cv::Scalar(0));
+            start = std::chrono::steady_clock::now();
+            stroker.clear();
+            stroker.stroke_curves(points.data(), 4, curve_count, 1.0f);
+            stroker.composite(window, {0, 255, 0});
+            coverage_ms = std::min(coverage_ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        // bezier() 每个采样点写 1 个像素，再读写 3 个相邻像素
+        std::cout << curve_count << " curves  per-sample AA: " << per_sample_ms << " ms, " << size_t(curve_count) * 1001 * 4
+                  << " pixel writes  coverage: " << coverage_ms << " ms, " << stroker.pixel_writes() << " coverage writes + 1 composite pass\n";
+    }
+}
 
+void print_path_statistics(const curve::path_renderer::statistics& stats)
+{
+    std::cout << stats.curves << " curves, " << stats.segments << " segments, " << stats.pixel_writes
+              << " coverage writes  flatten " << stats.flatten_ms << " ms + raster " << stats.raster_ms
+              << " ms = " << stats.total_ms << " ms  " << stats.curves / stats.total_ms * 1000 << " curves/s\n";
+}
 
-            float dp = std::sqrt(std::pow(p.x - point.x, 2) + std::pow(p.y - point.y, 2));
-            float weight = d1 / dp;
-            float colorG = window.at<cv::Vec3b>(p.y, p.x)[1];
-            colorG = std::fmin(colorG, weight * 255.0);
-            window.at<cv::Vec3b>(p.y, p.x)[1] = (int)colorG;
+// 随机生成的 1024x1024 地图瓦片：等高线、河流、道路和边界，几种曲线混在一起
+std::string synthetic_tile(int curve_count)
+{
+    std::mt19937 rng(25);
+    std::uniform_real_distribution<float> coordinate(10.0f, 1014.0f), offset(-60.0f, 60.0f), weight(0.5f, 2.0f);
+    std::ostringstream out;
+    out << "size 1024 1024\n";
+    const char* styles[] = {"stroke 1 140 110 70", "stroke 4 60 120 220", "stroke 2.5 250 250 250", "stroke 1.5 250 200 60"};
+    auto near = [&](cv::Point2f& p) {
+        p.x = std::min(std::max(p.x + offset(rng), 10.0f), 1014.0f);
+        p.y = std::min(std::max(p.y + offset(rng), 10.0f), 1014.0f);
+        out << p.x << ' ' << p.y << ' ';
+    };
+    for (int layer = 0; layer < 4; ++layer)
+    {
+        out << styles[layer] << '\n';
+        for (int c = 0; c < curve_count / 4; ++c)
+        {
+            cv::Point2f p(coordinate(rng), coordinate(rng));
+            switch ((layer + c) % 5)
+            {
+            case 0:
+                out << "M " << p.x << ' ' << p.y << " C ";
+                for (int k = 0; k < 3; ++k)
+                    near(p);
+                break;
+            case 1:
+                out << "M " << p.x << ' ' << p.y << " Q ";
+                for (int k = 0; k < 2; ++k)
+                    near(p);
+                break;
+            case 2:
+                out << "M " << p.x << ' ' << p.y << " L ";
+                near(p);
+                break;
+            case 3:
+                out << "B 3 6 ";
+                for (int k = 0; k < 6; ++k)
+                    near(p);
+                break;
+            default:
+                out << "N 2 5 ";
+                for (int k = 0; k < 5; ++k)
+                {
+                    near(p);
+                    out << weight(rng) << ' ';
+                }
+                break;
+            }
+            out << '\n';
         }
- 
-               
     }
+    return out.str();
+}
+
+void benchmark_paths()
+{
+    for (int curve_count : {1000, 4000, 16000})
+    {
+        std::istringstream tile(synthetic_tile(curve_count));
+        auto start = std::chrono::steady_clock::now();
+        curve::path_scene scene = curve::parse_path(tile);
+        double parse_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
+        curve::path_renderer renderer;
+        cv::Mat image;
+        // 第一次分配缓冲区，取后面几次里最快的
+        renderer.render(scene, image);
+        curve::path_renderer::statistics best = renderer.last_statistics();
+        for (int run = 0; run < 3; ++run)
+        {
+            image.setTo(cv::Scalar(0));
+            renderer.render(scene, image);
+            if (renderer.last_statistics().total_ms < best.total_ms)
+                best = renderer.last_statistics();
+        }
+        std::cout << "parse " << parse_ms << " ms  ";
+        print_path_statistics(best);
+    }
 }
 
-int main() 
+int main(int argc, const char** argv) 
 {
+    if (argc >= 2)
+    {
+        // 命令行模式：固定的四个控制点，不开窗口，直接把结果写到 argv[1]
+        std::string filename = argv[1];
+        if (argc >= 4 && std::string(argv[2]) == "paths")
+        {
+            // 路径文件里的所有曲线一次画到同一张图上
+            try
+            {
+                auto start = std::chrono::steady_clock::now();
+                curve::path_scene scene = curve::load_path_file(argv[3]);
+                double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                curve::path_renderer renderer;
+                cv::Mat image;
+                renderer.render(scene, image);
+                std::cout << "load " << load_ms << " ms  ";
+                print_path_statistics(renderer.last_statistics());
+                if (!cv::imwrite(filename, image))
+                {
+                    std::cerr << "cannot write " << filename << '\n';
+                    return 1;
+                }
+            }
+            catch (const std::exception& e)
+            {
+                // 文件打不开或者格式不对
+                std::cerr << e.what() << '\n';
+                return 1;
+            }
+            return 0;
+        }
+        std::set<std::string> options(argv + 2, argv + argc);
+        if (options.count("bench"))
+            benchmark_evaluators();
+        if (options.count("adaptive_bench"))
+            benchmark_adaptive();
+        if (options.count("forward_bench"))
+            benchmark_forward();
+        if (options.count("coverage_bench"))
+            benchmark_coverage();
+        if (options.count("path_bench"))
+            benchmark_paths();
+
+        control_points = {{120, 560}, {210, 110}, {470, 140}, {590, 600}};
+        cv::Mat window = cv::Mat(700, 700, CV_8UC3, cv::Scalar(0));
+        if (options.count("naive"))
+            naive_bezier(control_points, window);
+        else if (options.count("forward"))
+            forward_bezier(control_points, window);
+        else if (options.count("adaptive"))
+            adaptive_bezier(control_points, window);
+        else if (options.count("coverage"))
+        {
+            // 1 像素宽的描边，覆盖率最后一次性混合成绿色
+            curve::stroke_rasterizer stroker(window.cols, window.rows);
+            stroker.stroke_curve(control_points.data(), (int)control_points.size(), 1.0f);
+            stroker.composite(window, {0, 255, 0});
+        }
+        else
+            bezier(control_points, window);
+        cv::imwrite(filename, window);
+        return 0;
+    }
+
     cv::Mat window = cv::Mat(700, 700, CV_8UC3, cv::Scalar(0));
     cv::cvtColor(window, window, cv::COLOR_BGR2RGB);
     cv::namedWindow("Bezier Curve", cv::WINDOW_AUTOSIZE);